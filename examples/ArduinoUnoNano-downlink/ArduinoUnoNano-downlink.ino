@@ -136,9 +136,18 @@ void loop()
       }
       case TX_WITH_RX:
       {
-        String received = myLora.getRx();
-        received = myLora.base16decode(received);
-        Serial.print("Received downlink: " + received);
+        uint8_t received[32];
+        uint8_t port;
+        size_t length = myLora.getRxBytes(received, sizeof(received), &port);
+        Serial.print("Received downlink on port ");
+        Serial.print(port);
+        Serial.print(":");
+        for (size_t i = 0; i < length; i++)
+        {
+          Serial.print(" ");
+          Serial.print(received[i], HEX);
+        }
+        Serial.println();
         break;
       }
       default:
@@ -16,6 +16,12 @@
 // create an instance of the Library.
 rn2xx3 myLora(loraSerial);
 
+// lets the library change the baud rate of the serial port to the radio
+void setLoraBaud(uint32_t baud)
+{
+  loraSerial.begin(baud);
+}
+
 
 void setup()
 {
@@ -51,6 +57,19 @@ void initialize_radio()
 
   myLora.autobaud();
 
+  // Payloads travel over the serial port as HEX. At a higher baud rate
+  // that takes less time.
+  myLora.setHostBaudRate(setLoraBaud, 9600);
+  debugSerial.print(F("UART time of a 51 byte uplink at 9600 baud: "));
+  debugSerial.print(myLora.uartTime(51));
+  debugSerial.println(F(" us"));
+  if (myLora.setBaudRate(57600))
+  {
+    debugSerial.print(F("UART time at 57600 baud: "));
+    debugSerial.print(myLora.uartTime(51));
+    debugSerial.println(F(" us"));
+  }
+
   debugSerial.println("DevEUI? ");debugSerial.print(F("> "));
   debugSerial.println(myLora.hweui());
   debugSerial.println("Version?");debugSerial.print(F("> "));
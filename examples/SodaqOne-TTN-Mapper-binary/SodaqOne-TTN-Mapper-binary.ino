@@ -23,50 +23,47 @@
  * Green waiting for a new GPS fix
  * Red: GPS fix taking a long time. Try to go outdoors.
  *
- * To decode the binary payload, you can use the following
- * javascript decoder function. It should work with the TTN console.
+ * The payload is described by MapperPayload below. To decode it, use the
+ * following payload formatter in The Things Stack console. It is printed by
+ * MapperPayload::printDecoder(), so print it again after changing the fields.
  *
-function Decoder(bytes, port) {
-  // Decode an uplink message from a buffer
-  // (array) of bytes to an object of fields.
-  var decoded = {};
-
-  // if (port === 1) decoded.led = bytes[0];
-  decoded.lat = ((bytes[0]<<16)>>>0) + ((bytes[1]<<8)>>>0) + bytes[2];
-  decoded.lat = (decoded.lat / 16777215.0 * 180) - 90;
-
-  decoded.lon = ((bytes[3]<<16)>>>0) + ((bytes[4]<<8)>>>0) + bytes[5];
-  decoded.lon = (decoded.lon / 16777215.0 * 360) - 180;
-
-  var altValue = ((bytes[6]<<8)>>>0) + bytes[7];
-  var sign = bytes[6] & (1 << 7);
-  if(sign)
-  {
-    decoded.alt = 0xFFFF0000 | altValue;
-  }
-  else
-  {
-    decoded.alt = altValue;
+function decodeUplink(input) {
+  var b = input.bytes;
+  function bits(offset, width) {
+    var v = 0;
+    for (var i = offset; i < offset + width; i++) v = v * 2 + ((b[i >> 3] >> (7 - (i & 7))) & 1);
+    return v;
   }
-
-  decoded.hdop = bytes[8] / 10.0;
-
-  return decoded;
+  if (b.length < 9) return { errors: ['payload too short'] };
+  return { data: {
+    latitude: bits(0, 24) / 50000 + (-90),
+    longitude: bits(24, 25) / 50000 + (-180),
+    altitude: bits(49, 14) / 1 + (-500),
+    hdop: bits(63, 8) / 10 + (0)
+  } };
 }
  *
  */
 #include "Sodaq_UBlox_GPS.h"
 #include <rn2xx3.h>
+#include <rn2xx3_schema.h>
 
 // Create an instance of the rn2xx3 library,
 // Giving Serial1 as stream to use for communication with the radio
 rn2xx3 myLora(Serial1);
 
-String toLog;
-uint8_t txBuffer[9];
-uint32_t LatitudeBinary, LongitudeBinary;
-uint16_t altitudeGps;
-uint8_t hdopGps;
+// Latitude and longitude in steps of 1/50000 degree (about 2 meters),
+// altitude in meters and HDOP in steps of 0.1, 71 bits in total
+typedef rn2xx3_schema<
+  rn2xx3_field<-90, 90, 50000>,
+  rn2xx3_field<-180, 180, 50000>,
+  rn2xx3_field<-500, 9000>,
+  rn2xx3_field<0, 25, 10>
+> MapperPayload;
+
+const char* const fieldNames[] = {"latitude", "longitude", "altitude", "hdop"};
+
+uint8_t txBuffer[MapperPayload::size];
 int dr = 0;
 
 void setup()
@@ -81,6 +78,8 @@ void setup()
     while ((!SerialUSB) && (millis() < 10000));
 
     SerialUSB.println("SODAQ LoRaONE TTN Mapper starting");
+    SerialUSB.println("Payload formatter:");
+    MapperPayload::printDecoder(SerialUSB, fieldNames);
 
     initialize_radio();
 
@@ -168,31 +167,8 @@ void loop()
 
   digitalWrite(LED_RED, HIGH);
 
-  LatitudeBinary = ((sodaq_gps.getLat() + 90) / 180) * 16777215;
-  LongitudeBinary = ((sodaq_gps.getLon() + 180) / 360) * 16777215;
-
-  txBuffer[0] = ( LatitudeBinary >> 16 ) & 0xFF;
-  txBuffer[1] = ( LatitudeBinary >> 8 ) & 0xFF;
-  txBuffer[2] = LatitudeBinary & 0xFF;
-
-  txBuffer[3] = ( LongitudeBinary >> 16 ) & 0xFF;
-  txBuffer[4] = ( LongitudeBinary >> 8 ) & 0xFF;
-  txBuffer[5] = LongitudeBinary & 0xFF;
-
-  altitudeGps = sodaq_gps.getAlt();
-  txBuffer[6] = ( altitudeGps >> 8 ) & 0xFF;
-  txBuffer[7] = altitudeGps & 0xFF;
-
-  hdopGps = sodaq_gps.getHDOP()*10;
-  txBuffer[8] = hdopGps & 0xFF;
-
-  toLog = "";
-  for(size_t i = 0; i<sizeof(txBuffer); i++)
-  {
-    char buffer[3];
-    sprintf(buffer, "%02x", txBuffer[i]);
-    toLog = toLog + String(buffer);
-  }
+  MapperPayload::encode(txBuffer, sodaq_gps.getLat(), sodaq_gps.getLon(),
+                        sodaq_gps.getAlt(), sodaq_gps.getHDOP());
 
   SerialUSB.print("Transmit on DR");
   SerialUSB.print(dr);
@@ -205,7 +181,12 @@ void loop()
   SerialUSB.print(" and HDOP ");
   SerialUSB.print(sodaq_gps.getHDOP(), 2);
   SerialUSB.print(" hex ");
-  SerialUSB.println(toLog);
+  for(size_t i = 0; i<sizeof(txBuffer); i++)
+  {
+    if (txBuffer[i] < 0x10) SerialUSB.print('0');
+    SerialUSB.print(txBuffer[i], HEX);
+  }
+  SerialUSB.println();
 
   // Turn on blue to indicate Lora usage
   digitalWrite(LED_BLUE, LOW);
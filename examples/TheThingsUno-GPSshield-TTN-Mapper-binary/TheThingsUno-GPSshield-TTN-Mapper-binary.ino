@@ -35,52 +35,50 @@
  *     imported into TTN Mapper.
  *
  *
- * To decode the binary payload, you can use the following
- * javascript decoder function. It should work with the TTN console.
+ * The payload is described by MapperPayload below. To decode it, use the
+ * following payload formatter in The Things Stack console. It is printed by
+ * MapperPayload::printDecoder(), so print it again after changing the fields.
  *
-function Decoder(bytes, port) {
-  // Decode an uplink message from a buffer
-  // (array) of bytes to an object of fields.
-  var decoded = {};
-
-  // if (port === 1) decoded.led = bytes[0];
-  decoded.lat = ((bytes[0]<<16)>>>0) + ((bytes[1]<<8)>>>0) + bytes[2];
-  decoded.lat = (decoded.lat / 16777215.0 * 180) - 90;
-
-  decoded.lon = ((bytes[3]<<16)>>>0) + ((bytes[4]<<8)>>>0) + bytes[5];
-  decoded.lon = (decoded.lon / 16777215.0 * 360) - 180;
-
-  var altValue = ((bytes[6]<<8)>>>0) + bytes[7];
-  var sign = bytes[6] & (1 << 7);
-  if(sign)
-  {
-    decoded.alt = 0xFFFF0000 | altValue;
-  }
-  else
-  {
-    decoded.alt = altValue;
+function decodeUplink(input) {
+  var b = input.bytes;
+  function bits(offset, width) {
+    var v = 0;
+    for (var i = offset; i < offset + width; i++) v = v * 2 + ((b[i >> 3] >> (7 - (i & 7))) & 1);
+    return v;
   }
-
-  decoded.hdop = bytes[8] / 10.0;
-
-  return decoded;
+  if (b.length < 9) return { errors: ['payload too short'] };
+  return { data: {
+    latitude: bits(0, 24) / 50000 + (-90),
+    longitude: bits(24, 25) / 50000 + (-180),
+    altitude: bits(49, 14) / 1 + (-500),
+    hdop: bits(63, 8) / 10 + (0)
+  } };
 }
  *
  */
 #include "TinyGPS++.h"
 #include <SoftwareSerial.h>
 #include <rn2xx3.h>
+#include <rn2xx3_schema.h>
 
 SoftwareSerial gpsSerial(8, 9); // RX, TX
 TinyGPSPlus gps;
 rn2xx3 myLora(Serial1);
 
 unsigned long last_update = 0;
-String toLog;
-uint8_t txBuffer[9];
-uint32_t LatitudeBinary, LongitudeBinary;
-uint16_t altitudeGps;
-uint8_t hdopGps;
+
+// Latitude and longitude in steps of 1/50000 degree (about 2 meters),
+// altitude in meters and HDOP in steps of 0.1, 71 bits in total
+typedef rn2xx3_schema<
+  rn2xx3_field<-90, 90, 50000>,
+  rn2xx3_field<-180, 180, 50000>,
+  rn2xx3_field<-500, 9000>,
+  rn2xx3_field<0, 25, 10>
+> MapperPayload;
+
+const char* const fieldNames[] = {"latitude", "longitude", "altitude", "hdop"};
+
+uint8_t txBuffer[MapperPayload::size];
 
 #define PMTK_SET_NMEA_UPDATE_05HZ  "$PMTK220,2000*1C"
 #define PMTK_SET_NMEA_UPDATE_1HZ  "$PMTK220,1000*1F"
@@ -101,6 +99,8 @@ void setup() {
   while ((!Serial) && (millis() < 10000));
 
   Serial.println("TTN UNO + GPS shield startup");
+  Serial.println("Payload formatter:");
+  MapperPayload::printDecoder(Serial, fieldNames);
 
   //set up RN2xx3
   initialize_radio();
@@ -164,7 +164,7 @@ void loop() {
 
     build_packet();
 
-    Serial.println(toLog);
+    print_packet();
     myLora.txBytes(txBuffer, sizeof(txBuffer));
     Serial.println("TX done");
 
@@ -175,33 +175,29 @@ void loop() {
 
 }
 
-void build_packet()
+// A float on AVR can not hold a longitude to 1/50000 degree, so scale the
+// whole degrees and billionths TinyGPS++ keeps with integers instead
+int32_t steps(const RawDegrees& raw)
 {
-  LatitudeBinary = ((gps.location.lat() + 90) / 180.0) * 16777215;
-  LongitudeBinary = ((gps.location.lng() + 180) / 360.0) * 16777215;
-
-  txBuffer[0] = ( LatitudeBinary >> 16 ) & 0xFF;
-  txBuffer[1] = ( LatitudeBinary >> 8 ) & 0xFF;
-  txBuffer[2] = LatitudeBinary & 0xFF;
-
-  txBuffer[3] = ( LongitudeBinary >> 16 ) & 0xFF;
-  txBuffer[4] = ( LongitudeBinary >> 8 ) & 0xFF;
-  txBuffer[5] = LongitudeBinary & 0xFF;
-
-  altitudeGps = gps.altitude.meters();
-  txBuffer[6] = ( altitudeGps >> 8 ) & 0xFF;
-  txBuffer[7] = altitudeGps & 0xFF;
+  int32_t value = (int32_t)raw.deg * 50000 + (raw.billionths + 10000) / 20000;
+  return raw.negative ? -value : value;
+}
 
-  hdopGps = gps.hdop.value()/10;
-  txBuffer[8] = hdopGps & 0xFF;
+void build_packet()
+{
+  // Altitude is kept in centimeters and HDOP in hundredths
+  MapperPayload::encodeSteps(txBuffer, steps(gps.location.rawLat()), steps(gps.location.rawLng()),
+                             gps.altitude.value() / 100, gps.hdop.value() / 10);
+}
 
-  toLog = "";
+void print_packet()
+{
   for(size_t i = 0; i<sizeof(txBuffer); i++)
   {
-    char buffer[3];
-    sprintf(buffer, "%02x", txBuffer[i]);
-    toLog = toLog + String(buffer);
+    if (txBuffer[i] < 0x10) Serial.print('0');
+    Serial.print(txBuffer[i], HEX);
   }
+  Serial.println();
 }
 
 void led_on(){
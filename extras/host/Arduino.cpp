@@ -0,0 +1,256 @@
+/*
+ * Minimal Arduino core API for building the rn2xx3 library on a POSIX host.
+ */
+
+#include "Arduino.h"
+
+#include <time.h>
+#include <ctype.h>
+
+static uint64_t monotonicMicros()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+static const uint64_t startMicros = monotonicMicros();
+
+unsigned long millis()
+{
+  return (unsigned long)((monotonicMicros() - startMicros) / 1000ULL);
+}
+
+unsigned long micros()
+{
+  return (unsigned long)(monotonicMicros() - startMicros);
+}
+
+void delay(unsigned long ms)
+{
+  struct timespec ts;
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+  while (nanosleep(&ts, &ts) != 0) {}
+}
+
+void yield()
+{
+}
+
+static std::string formatUnsigned(unsigned long value, unsigned char base)
+{
+  if (base < 2) base = 10;
+  char buf[8 * sizeof(long) + 1];
+  char* p = &buf[sizeof(buf) - 1];
+  *p = '\0';
+  do {
+    unsigned long digit = value % base;
+    *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    value /= base;
+  } while (value);
+  return std::string(p);
+}
+
+static std::string formatSigned(long value, unsigned char base)
+{
+  if (base == 10 && value < 0)
+  {
+    return "-" + formatUnsigned(0UL - (unsigned long)value, base);
+  }
+  return formatUnsigned((unsigned long)value, base);
+}
+
+static std::string formatDouble(double value, unsigned char decimalPlaces)
+{
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%.*f", (int)decimalPlaces, value);
+  return std::string(buf);
+}
+
+String::String(unsigned char value, unsigned char base) : _s(formatUnsigned(value, base)) {}
+String::String(int value, unsigned char base) : _s(formatSigned(value, base)) {}
+String::String(unsigned int value, unsigned char base) : _s(formatUnsigned(value, base)) {}
+String::String(long value, unsigned char base) : _s(formatSigned(value, base)) {}
+String::String(unsigned long value, unsigned char base) : _s(formatUnsigned(value, base)) {}
+String::String(float value, unsigned char decimalPlaces) : _s(formatDouble(value, decimalPlaces)) {}
+String::String(double value, unsigned char decimalPlaces) : _s(formatDouble(value, decimalPlaces)) {}
+
+unsigned char String::equalsIgnoreCase(const String& s) const
+{
+  if (_s.length() != s._s.length()) return 0;
+  for (size_t i = 0; i < _s.length(); i++)
+  {
+    if (tolower((unsigned char)_s[i]) != tolower((unsigned char)s._s[i])) return 0;
+  }
+  return 1;
+}
+
+unsigned char String::startsWith(const String& prefix, unsigned int offset) const
+{
+  if (offset > _s.length()) return 0;
+  return _s.compare(offset, prefix._s.length(), prefix._s) == 0;
+}
+
+unsigned char String::endsWith(const String& suffix) const
+{
+  if (suffix._s.length() > _s.length()) return 0;
+  return _s.compare(_s.length() - suffix._s.length(), suffix._s.length(), suffix._s) == 0;
+}
+
+char& String::operator[](unsigned int index)
+{
+  if (index >= _s.length())
+  {
+    _dummy = 0;
+    return _dummy;
+  }
+  return _s[index];
+}
+
+int String::indexOf(char ch, unsigned int fromIndex) const
+{
+  size_t pos = _s.find(ch, fromIndex);
+  return pos == std::string::npos ? -1 : (int)pos;
+}
+
+int String::indexOf(const String& str, unsigned int fromIndex) const
+{
+  size_t pos = _s.find(str._s, fromIndex);
+  return pos == std::string::npos ? -1 : (int)pos;
+}
+
+int String::lastIndexOf(char ch) const
+{
+  size_t pos = _s.rfind(ch);
+  return pos == std::string::npos ? -1 : (int)pos;
+}
+
+String String::substring(unsigned int beginIndex) const
+{
+  return substring(beginIndex, _s.length());
+}
+
+String String::substring(unsigned int beginIndex, unsigned int endIndex) const
+{
+  if (beginIndex > endIndex)
+  {
+    unsigned int tmp = endIndex;
+    endIndex = beginIndex;
+    beginIndex = tmp;
+  }
+  if (beginIndex >= _s.length()) return String();
+  if (endIndex > _s.length()) endIndex = _s.length();
+  return String(_s.substr(beginIndex, endIndex - beginIndex));
+}
+
+void String::toUpperCase()
+{
+  for (size_t i = 0; i < _s.length(); i++) _s[i] = toupper((unsigned char)_s[i]);
+}
+
+void String::toLowerCase()
+{
+  for (size_t i = 0; i < _s.length(); i++) _s[i] = tolower((unsigned char)_s[i]);
+}
+
+void String::trim()
+{
+  size_t begin = 0;
+  while (begin < _s.length() && isspace((unsigned char)_s[begin])) begin++;
+  size_t end = _s.length();
+  while (end > begin && isspace((unsigned char)_s[end - 1])) end--;
+  _s = _s.substr(begin, end - begin);
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size)
+{
+  size_t n = 0;
+  while (size--)
+  {
+    if (write(*buffer++)) n++;
+    else break;
+  }
+  return n;
+}
+
+size_t Print::print(long n, int base)
+{
+  std::string s = formatSigned(n, (unsigned char)base);
+  return write((const uint8_t*)s.data(), s.length());
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+  std::string s = formatUnsigned(n, (unsigned char)base);
+  return write((const uint8_t*)s.data(), s.length());
+}
+
+size_t Print::print(double n, int digits)
+{
+  std::string s = formatDouble(n, (unsigned char)digits);
+  return write((const uint8_t*)s.data(), s.length());
+}
+
+int Stream::timedRead()
+{
+  unsigned long start = millis();
+  do {
+    int c = read();
+    if (c >= 0) return c;
+    unsigned long elapsed = millis() - start;
+    if (elapsed >= _timeout) break;
+    waitAvailable(_timeout - elapsed);
+  } while (true);
+  return -1;
+}
+
+size_t Stream::readBytes(char* buffer, size_t length)
+{
+  size_t count = 0;
+  while (count < length)
+  {
+    int c = timedRead();
+    if (c < 0) break;
+    *buffer++ = (char)c;
+    count++;
+  }
+  return count;
+}
+
+size_t Stream::readBytesUntil(char terminator, char* buffer, size_t length)
+{
+  size_t index = 0;
+  while (index < length)
+  {
+    int c = timedRead();
+    if (c < 0 || c == terminator) break;
+    *buffer++ = (char)c;
+    index++;
+  }
+  return index;
+}
+
+String Stream::readString()
+{
+  String ret;
+  int c = timedRead();
+  while (c >= 0)
+  {
+    ret += (char)c;
+    c = timedRead();
+  }
+  return ret;
+}
+
+String Stream::readStringUntil(char terminator)
+{
+  String ret;
+  int c = timedRead();
+  while (c >= 0 && c != terminator)
+  {
+    ret += (char)c;
+    c = timedRead();
+  }
+  return ret;
+}
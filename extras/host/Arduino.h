@@ -0,0 +1,167 @@
+/*
+ * Minimal Arduino core API for building the rn2xx3 library on a POSIX host.
+ *
+ * Only the parts of String, Print and Stream that the library and its host
+ * tools use are provided. On a real board the Arduino core is used instead.
+ */
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+class __FlashStringHelper;
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(PSTR(s)))
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define strlen_P strlen
+#define strncmp_P strncmp
+#define memcpy_P memcpy
+
+#define DEC 10
+#define HEX 16
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+
+class String
+{
+  public:
+    String(const char* cstr = "") : _s(cstr ? cstr : "") {}
+    String(const __FlashStringHelper* str) : _s(reinterpret_cast<const char*>(str)) {}
+    String(const std::string& str) : _s(str) {}
+    explicit String(char c) : _s(1, c) {}
+    explicit String(unsigned char value, unsigned char base = 10);
+    explicit String(int value, unsigned char base = 10);
+    explicit String(unsigned int value, unsigned char base = 10);
+    explicit String(long value, unsigned char base = 10);
+    explicit String(unsigned long value, unsigned char base = 10);
+    explicit String(float value, unsigned char decimalPlaces = 2);
+    explicit String(double value, unsigned char decimalPlaces = 2);
+
+    unsigned char reserve(unsigned int size) { _s.reserve(size); return 1; }
+    unsigned int length() const { return _s.length(); }
+    const char* c_str() const { return _s.c_str(); }
+
+    String& operator+=(const String& rhs) { _s += rhs._s; return *this; }
+    String& operator+=(const char* cstr) { _s += cstr; return *this; }
+    String& operator+=(const __FlashStringHelper* str) { _s += reinterpret_cast<const char*>(str); return *this; }
+    String& operator+=(char c) { _s += c; return *this; }
+    String& operator+=(unsigned char num) { return *this += String(num); }
+    String& operator+=(int num) { return *this += String(num); }
+    String& operator+=(unsigned int num) { return *this += String(num); }
+    String& operator+=(long num) { return *this += String(num); }
+    String& operator+=(unsigned long num) { return *this += String(num); }
+    unsigned char concat(const String& str) { _s += str._s; return 1; }
+
+    friend String operator+(const String& lhs, const String& rhs) { return String(lhs._s + rhs._s); }
+    friend String operator+(const String& lhs, const char* rhs) { return String(lhs._s + rhs); }
+    friend String operator+(const char* lhs, const String& rhs) { return String(lhs + rhs._s); }
+
+    unsigned char equals(const String& s) const { return _s == s._s; }
+    unsigned char equals(const char* cstr) const { return _s == cstr; }
+    unsigned char operator==(const String& rhs) const { return equals(rhs); }
+    unsigned char operator==(const char* cstr) const { return equals(cstr); }
+    unsigned char operator!=(const String& rhs) const { return !equals(rhs); }
+    unsigned char operator!=(const char* cstr) const { return !equals(cstr); }
+    unsigned char equalsIgnoreCase(const String& s) const;
+    unsigned char startsWith(const String& prefix) const { return _s.compare(0, prefix._s.length(), prefix._s) == 0; }
+    unsigned char startsWith(const String& prefix, unsigned int offset) const;
+    unsigned char endsWith(const String& suffix) const;
+
+    char charAt(unsigned int index) const { return index < _s.length() ? _s[index] : 0; }
+    void setCharAt(unsigned int index, char c) { if (index < _s.length()) _s[index] = c; }
+    char operator[](unsigned int index) const { return charAt(index); }
+    char& operator[](unsigned int index);
+
+    int indexOf(char ch, unsigned int fromIndex = 0) const;
+    int indexOf(const String& str, unsigned int fromIndex = 0) const;
+    int lastIndexOf(char ch) const;
+    String substring(unsigned int beginIndex) const;
+    String substring(unsigned int beginIndex, unsigned int endIndex) const;
+
+    void remove(unsigned int index) { if (index < _s.length()) _s.erase(index); }
+    void remove(unsigned int index, unsigned int count) { if (index < _s.length()) _s.erase(index, count); }
+    void toUpperCase();
+    void toLowerCase();
+    void trim();
+
+    long toInt() const { return atol(_s.c_str()); }
+    float toFloat() const { return (float)atof(_s.c_str()); }
+
+  private:
+    std::string _s;
+    char _dummy = 0;
+};
+
+class Print
+{
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    size_t write(const char* str) { return str ? write((const uint8_t*)str, strlen(str)) : 0; }
+    size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+
+    size_t print(const __FlashStringHelper* str) { return write(reinterpret_cast<const char*>(str)); }
+    size_t print(const String& s) { return write((const uint8_t*)s.c_str(), s.length()); }
+    size_t print(const char* str) { return write(str); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(double n, int digits = 2);
+
+    size_t println() { return write("\r\n"); }
+    template <typename T> size_t println(const T& value) { size_t n = print(value); return n + println(); }
+    template <typename T> size_t println(const T& value, int format) { size_t n = print(value, format); return n + println(); }
+};
+
+class Stream : public Print
+{
+  public:
+    Stream() : _timeout(1000) {}
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long timeout) { _timeout = timeout; }
+    unsigned long getTimeout() const { return _timeout; }
+
+    size_t readBytes(char* buffer, size_t length);
+    size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+    size_t readBytesUntil(char terminator, char* buffer, size_t length);
+    String readString();
+    String readStringUntil(char terminator);
+
+  protected:
+    int timedRead();
+
+    /*
+     * Wait up to ms milliseconds for data to arrive. Transports with a file
+     * descriptor override this to sleep in poll() instead of spinning.
+     */
+    virtual void waitAvailable(unsigned long ms) { (void)ms; yield(); }
+
+    unsigned long _timeout;
+};
+
+#endif
@@ -0,0 +1,197 @@
+/*
+ * Benchmark of the coded fragments of rn2xx3_fragmenter and
+ * rn2xx3_reassembler.
+ *
+ * Usage: rn2xx3-fec [blob size in bytes] [fragment size] [trials]
+ *
+ * Prints how fast fragments are encoded and decoded, and for a range of
+ * packet loss rates and redundancy settings how often the blob arrives
+ * complete, and the delivery rate: the share of the airtime spent that
+ * carried blob data, counting a failed transfer as all wasted.
+ */
+
+#include <rn2xx3_fragment.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// The fragmenter sends through an rn2xx3, which this benchmark never uses
+class NullStream : public Stream
+{
+  public:
+    int available() { return 0; }
+    int read() { return -1; }
+    int peek() { return -1; }
+    size_t write(uint8_t) { return 1; }
+};
+
+static std::vector<uint8_t> blob;
+static std::vector<uint8_t> received;
+
+static size_t readBlob(uint32_t offset, uint8_t* buf, size_t length)
+{
+  memcpy(buf, &blob[offset], length);
+  return length;
+}
+
+static bool writeReceived(uint32_t offset, const uint8_t* data, size_t length)
+{
+  if (offset + length > received.size())
+  {
+    return false;
+  }
+  memcpy(&received[offset], data, length);
+  return true;
+}
+
+static bool readReceived(uint32_t offset, uint8_t* data, size_t length)
+{
+  if (offset + length > received.size())
+  {
+    return false;
+  }
+  memcpy(data, &received[offset], length);
+  return true;
+}
+
+typedef std::chrono::steady_clock benchmark_clock;
+
+static double seconds(benchmark_clock::time_point start)
+{
+  return std::chrono::duration<double>(benchmark_clock::now() - start).count();
+}
+
+/*
+ * Encode all fragments of the blob with the given redundancy.
+ */
+static std::vector<std::vector<uint8_t> > encode(rn2xx3_fragmenter& fragmenter, uint8_t fragmentSize,
+                                                 uint8_t redundancy)
+{
+  fragmenter.setRedundancy(redundancy);
+  fragmenter.begin(blob.size(), readBlob, fragmentSize);
+
+  std::vector<std::vector<uint8_t> > frames;
+  std::vector<uint8_t> frame(fragmentSize);
+  for (uint16_t i = 0; i < fragmenter.count() + fragmenter.coded(); i++)
+  {
+    frame.resize(fragmentSize);
+    frame.resize(fragmenter.fragment(i, frame.data()));
+    frames.push_back(frame);
+  }
+  return frames;
+}
+
+/*
+ * Feed the frames that survive the loss to a reassembler.
+ * Returns true if the blob came out whole.
+ */
+static bool decode(const std::vector<std::vector<uint8_t> >& frames, double loss, std::mt19937& random)
+{
+  uint16_t count = frames.size();
+  std::vector<uint8_t> bitmap((count + 7) / 8);
+  std::vector<uint8_t> matrix((size_t)count * ((count + 7) / 8));
+  rn2xx3_reassembler reassembler(writeReceived, bitmap.data(), bitmap.size());
+  reassembler.setCoding(matrix.data(), matrix.size(), readReceived);
+
+  received.assign(blob.size() + frames[0].size(), 0);
+  std::bernoulli_distribution lost(loss);
+  bool complete = false;
+  for (size_t i = 0; i < frames.size() && !complete; i++)
+  {
+    if (!lost(random))
+    {
+      complete = reassembler.add(frames[i].data(), frames[i].size()) == REASSEMBLY_COMPLETE;
+    }
+  }
+  return complete && reassembler.size() == blob.size() &&
+         memcmp(received.data(), blob.data(), blob.size()) == 0;
+}
+
+int main(int argc, char* argv[])
+{
+  size_t size = argc > 1 ? atoi(argv[1]) : 10240;
+  uint8_t fragmentSize = argc > 2 ? atoi(argv[2]) : 51;
+  int trials = argc > 3 ? atoi(argv[3]) : 200;
+
+  std::mt19937 random(1);
+  blob.resize(size);
+  for (size_t i = 0; i < size; i++)
+  {
+    blob[i] = random();
+  }
+
+  NullStream serial;
+  rn2xx3 lora(serial);
+  rn2xx3_fragmenter fragmenter(lora, 10);
+
+  std::cout << "Blob of " << size << " bytes in fragments of " << (int)fragmentSize << " bytes" << std::endl;
+
+  // Throughput, at 50% redundancy and without loss
+  const int rounds = 5;
+  std::vector<std::vector<uint8_t> > frames;
+  benchmark_clock::time_point start = benchmark_clock::now();
+  for (int i = 0; i < rounds; i++)
+  {
+    frames = encode(fragmenter, fragmentSize, 50);
+  }
+  double encodeSeconds = seconds(start);
+
+  // Decode from the coded fragments as much as possible, by dropping
+  // every other data fragment
+  std::vector<std::vector<uint8_t> > mixed;
+  for (size_t i = 0; i < frames.size(); i++)
+  {
+    if (i >= fragmenter.count() || i % 2 == 0)
+    {
+      mixed.push_back(frames[i]);
+    }
+  }
+  std::mt19937 noLoss(2);
+  bool decoded = true;
+  start = benchmark_clock::now();
+  for (int i = 0; i < rounds; i++)
+  {
+    decoded &= decode(mixed, 0, noLoss);
+  }
+  double decodeSeconds = seconds(start);
+
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "Encode: " << size * rounds / encodeSeconds / 1e6 << " MB/s, "
+            << fragmenter.count() << " data and " << fragmenter.coded() << " coded fragments" << std::endl;
+  std::cout << "Decode with half the data fragments lost: " << size * rounds / decodeSeconds / 1e6 << " MB/s"
+            << (decoded ? "" : " (FAILED)") << std::endl;
+  std::cout << std::endl;
+
+  const double losses[] = {0, 0.05, 0.1, 0.2, 0.3};
+  const uint8_t redundancies[] = {0, 10, 25, 50, 100};
+
+  std::cout << "| Loss | Redundancy | Complete | Delivery rate |" << std::endl;
+  std::cout << "|---|---|---|---|" << std::endl;
+  for (double loss : losses)
+  {
+    for (uint8_t redundancy : redundancies)
+    {
+      frames = encode(fragmenter, fragmentSize, redundancy);
+      size_t airtime = 0;
+      for (const std::vector<uint8_t>& frame : frames)
+      {
+        airtime += frame.size();
+      }
+
+      int complete = 0;
+      for (int trial = 0; trial < trials; trial++)
+      {
+        complete += decode(frames, loss, random);
+      }
+      double completeRate = (double)complete / trials;
+      std::cout << "| " << loss * 100 << "% | " << (int)redundancy << "% | "
+                << completeRate * 100 << "% | "
+                << completeRate * size / airtime * 100 << "% |" << std::endl;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * Benchmark of rn2xx3_series against sending every reading on its own.
+ *
+ * Usage: rn2xx3-series [sample interval in seconds] [frames]
+ *
+ * Samples a simulated temperature (0.01 degree steps) and humidity (0.1%
+ * steps), and prints for every EU868 data rate how many samples fit in a
+ * frame, how many bytes and how much airtime each sample costs, and the
+ * airtime of one reading per uplink for comparison.
+ */
+
+#include <rn2xx3_series.h>
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+// Answers "ok" to every command, so the data rate can be set
+class OkStream : public Stream
+{
+  public:
+    int available() { return _reply ? _reply - _position : 0; }
+    int read() { return available() ? "ok\r\n"[_position++] : -1; }
+    int peek() { return available() ? "ok\r\n"[_position] : -1; }
+    size_t write(uint8_t c)
+    {
+      if (c == '\n')
+      {
+        _reply = 4;
+        _position = 0;
+      }
+      return 1;
+    }
+
+  private:
+    int _reply = 0;
+    int _position = 0;
+};
+
+int main(int argc, char* argv[])
+{
+  uint32_t interval = argc > 1 ? atoi(argv[1]) : 10;
+  int frames = argc > 2 ? atoi(argv[2]) : 200;
+
+  OkStream serial;
+  rn2xx3 lora(serial);
+  const uint8_t channels = 2;
+  // A reading on its own: two 16 bit values
+  const uint8_t readingSize = 2 * channels;
+
+  std::cout << "Samples every " << interval << " s, " << (int)channels << " channels" << std::endl;
+  std::cout << std::endl;
+  std::cout << "| DR | Frame | Samples/frame | Bytes/sample | Airtime/sample | One per uplink | Saving | Uplink every |"
+            << std::endl;
+  std::cout << "|---|---|---|---|---|---|---|---|" << std::endl;
+
+  for (int dr = 0; dr <= 5; dr++)
+  {
+    lora.setDR(dr);
+
+    uint8_t buffer[242];
+    rn2xx3_series series(lora, 20, channels, buffer, sizeof(buffer));
+
+    std::mt19937 random(1);
+    std::normal_distribution<double> step(0, 3);
+    int32_t values[channels] = {2150, 550};
+    uint32_t time = 1700000000;
+
+    long samples = 0;
+    long bytes = 0;
+    double airtime = 0;
+    for (int frame = 0; frame < frames; frame++)
+    {
+      while (series.add(time, values))
+      {
+        time += interval;
+        values[0] += (int32_t)step(random);
+        values[1] += (int32_t)(step(random) / 3);
+      }
+      samples += series.samples();
+      bytes += series.size();
+      airtime += lora.timeOnAir(series.size());
+      series.clear();
+    }
+
+    double perSample = airtime / samples;
+    double single = lora.timeOnAir(readingSize);
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "| " << dr << " | " << (int)series.frameSize() << " B | "
+              << (double)samples / frames << " | "
+              << (double)bytes / samples << " | "
+              << perSample << " ms | "
+              << single << " ms | "
+              << single / perSample << "x | "
+              << (double)samples / frames * interval / 60 << " min |" << std::endl;
+  }
+  return 0;
+}
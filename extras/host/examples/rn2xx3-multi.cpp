@@ -0,0 +1,58 @@
+/*
+ * Drive several RN2xx3 modules from one thread.
+ *
+ * Usage: rn2xx3-multi /dev/ttyUSB0 [/dev/ttyUSB1 ...]
+ *
+ * Every module joins the network with the keys stored in it, then sends
+ * one uplink. All modules do this at the same time.
+ */
+
+#include <rn2xx3_async.h>
+
+#include <iostream>
+#include <memory>
+#include <vector>
+
+rn2xx3_task<void> run(rn2xx3_async& radio, const char* device)
+{
+  String version = co_await radio.query("sys get ver");
+  std::cout << device << ": " << version.c_str() << std::endl;
+
+  if (!co_await radio.join())
+  {
+    std::cout << device << ": unable to join" << std::endl;
+    co_return;
+  }
+
+  uint8_t payload[] = { 0x01, 0x02, 0x03 };
+  TX_RETURN_TYPE result = co_await radio.txBytes(payload, sizeof(payload));
+  std::cout << device << ": tx " << (result == TX_FAIL ? "failed" : "done") << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    std::cerr << "Usage: " << argv[0] << " <device> [device ...]" << std::endl;
+    return 1;
+  }
+
+  rn2xx3_event_loop loop;
+  std::vector<std::unique_ptr<rn2xx3_posix> > ports;
+  std::vector<std::unique_ptr<rn2xx3_async> > radios;
+
+  for (int i = 1; i < argc; i++)
+  {
+    ports.emplace_back(new rn2xx3_posix());
+    if (!ports.back()->begin(argv[i]))
+    {
+      std::cerr << "Unable to open " << argv[i] << std::endl;
+      return 1;
+    }
+    radios.emplace_back(new rn2xx3_async(loop, *ports.back()));
+    loop.spawn(run(*radios.back(), argv[i]));
+  }
+
+  loop.run();
+  return 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * Talk to an RN2xx3 module connected to a Linux host.
+ *
+ * Usage: rn2xx3-terminal /dev/ttyUSB0 [baud] [trace]
+ *
+ * Prints the module version and hardware EUI, then sends every line typed
+ * on stdin as a raw command and prints the module's reply. If a trace file
+ * is given, the whole session is recorded to it with rn2xx3_trace.
+ */
+
+#include <rn2xx3.h>
+#include <rn2xx3_posix.h>
+#include <rn2xx3_trace.h>
+#include <rn2xx3_file.h>
+
+#include <iostream>
+#include <string>
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    std::cerr << "Usage: " << argv[0] << " <device> [baud] [trace]" << std::endl;
+    return 1;
+  }
+
+  rn2xx3_posix serial;
+  uint32_t baud = argc > 2 ? strtoul(argv[2], NULL, 10) : 57600;
+  if (!serial.begin(argv[1], baud))
+  {
+    std::cerr << "Unable to open " << argv[1] << std::endl;
+    return 1;
+  }
+
+  rn2xx3_file traceFile;
+  if (argc > 3 && !traceFile.open(argv[3], "wb"))
+  {
+    std::cerr << "Unable to create " << argv[3] << std::endl;
+    return 1;
+  }
+  rn2xx3_trace trace(serial, traceFile);
+
+  rn2xx3 myLora(argc > 3 ? (Stream&)trace : (Stream&)serial);
+  std::cout << "RN2xx3 firmware version: " << myLora.sysver().c_str() << std::endl;
+  std::cout << "Hardware EUI: " << myLora.hweui().c_str() << std::endl;
+
+  std::string line;
+  while (std::getline(std::cin, line))
+  {
+    std::cout << myLora.sendRawCommand(line.c_str()).c_str() << std::endl;
+  }
+  return 0;
+}
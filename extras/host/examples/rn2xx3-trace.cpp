@@ -0,0 +1,63 @@
+/*
+ * Print a protocol trace recorded with rn2xx3_trace as text.
+ *
+ * Usage: rn2xx3-trace session.trace
+ *
+ * Every line shows the time since the start of the trace in milliseconds,
+ * the direction (> sent to the module, < received from it) and the line.
+ */
+
+#include <rn2xx3_trace.h>
+#include <rn2xx3_file.h>
+
+#include <iostream>
+#include <string>
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    std::cerr << "Usage: " << argv[0] << " <trace>" << std::endl;
+    return 1;
+  }
+
+  rn2xx3_file file;
+  if (!file.open(argv[1], "rb"))
+  {
+    std::cerr << "Unable to open " << argv[1] << std::endl;
+    return 1;
+  }
+
+  char magic[5];
+  if (file.readBytes(magic, 5) != 5 || std::string(magic, 4) != "RN2T")
+  {
+    std::cerr << argv[1] << " is not an rn2xx3 trace" << std::endl;
+    return 1;
+  }
+
+  unsigned long time = 0;
+  int type;
+  while ((type = file.read()) >= 0)
+  {
+    unsigned long delta = 0;
+    int b;
+    uint8_t shift = 0;
+    do
+    {
+      b = file.read();
+      delta |= (unsigned long)(b & 0x7F) << shift;
+      shift += 7;
+    } while (b >= 0 && (b & 0x80));
+    time += delta;
+
+    std::string line;
+    int c;
+    while ((c = file.read()) >= 0 && c != '\n')
+    {
+      line += (char)c;
+    }
+
+    std::cout << time << (type == RN2XX3_TRACE_SENT ? " > " : " < ") << line << std::endl;
+  }
+  return 0;
+}
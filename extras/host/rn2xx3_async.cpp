@@ -0,0 +1,383 @@
+/*
+ * C++20 coroutine API for RN2xx3 modules on a POSIX host.
+ */
+
+#include "rn2xx3_async.h"
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+namespace
+{
+  // A coroutine that starts right away and cleans up after itself
+  struct detached
+  {
+    struct promise_type
+    {
+      detached get_return_object() { return detached(); }
+      std::suspend_never initial_suspend() noexcept { return {}; }
+      std::suspend_never final_suspend() noexcept { return {}; }
+      void return_void() {}
+      void unhandled_exception() { std::terminate(); }
+    };
+  };
+
+  detached runDetached(rn2xx3_task<void> task, unsigned* running)
+  {
+    (*running)++;
+    co_await task;
+    (*running)--;
+  }
+}
+
+rn2xx3_event_loop::rn2xx3_event_loop():
+_epoll(epoll_create1(EPOLL_CLOEXEC)),
+_stopped(false),
+_tasks(0)
+{
+}
+
+rn2xx3_event_loop::~rn2xx3_event_loop()
+{
+  if (_epoll >= 0)
+  {
+    close(_epoll);
+  }
+}
+
+void rn2xx3_event_loop::spawn(rn2xx3_task<void> task)
+{
+  runDetached(std::move(task), &_tasks);
+}
+
+void rn2xx3_event_loop::run()
+{
+  _stopped = false;
+
+  while (!_stopped && _tasks > 0)
+  {
+    // Sleep until a module sends something or the first timer is due
+    int timeout = -1;
+    if (!_timers.empty())
+    {
+      long due = (long)(_timers.begin()->first - millis());
+      timeout = due < 0 ? 0 : (int)due;
+    }
+
+    struct epoll_event events[16];
+    int count = epoll_wait(_epoll, events, 16, timeout);
+    for (int i = 0; i < count; i++)
+    {
+      static_cast<rn2xx3_async*>(events[i].data.ptr)->onReadable();
+    }
+
+    unsigned long now = millis();
+    while (!_timers.empty() && (long)(_timers.begin()->first - now) <= 0)
+    {
+      std::function<void()> callback = std::move(_timers.begin()->second);
+      _timers.erase(_timers.begin());
+      callback();
+    }
+  }
+}
+
+void rn2xx3_event_loop::stop()
+{
+  _stopped = true;
+}
+
+void rn2xx3_event_loop::post(std::function<void()> callback)
+{
+  addTimer(0, callback);
+}
+
+rn2xx3_event_loop::timer_map::iterator rn2xx3_event_loop::addTimer(unsigned long ms, std::function<void()> callback)
+{
+  return _timers.insert(std::make_pair(millis() + ms, callback));
+}
+
+void rn2xx3_event_loop::cancelTimer(timer_map::iterator timer)
+{
+  _timers.erase(timer);
+}
+
+bool rn2xx3_event_loop::watch(int fd, rn2xx3_async* radio)
+{
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = radio;
+  return epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+void rn2xx3_event_loop::unwatch(int fd)
+{
+  epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, NULL);
+}
+
+/*
+ * Suspends until the module sent a line, or the timeout passed.
+ */
+struct rn2xx3_async::line_awaiter
+{
+  rn2xx3_async& radio;
+  unsigned long timeoutMs;
+
+  bool await_ready() const noexcept
+  {
+    return !radio._lines.empty();
+  }
+
+  void await_suspend(std::coroutine_handle<> handle)
+  {
+    rn2xx3_async* r = &radio;
+    r->_waiter = handle;
+    r->_waiterTimerActive = true;
+    r->_waiterTimer = r->_loop.addTimer(timeoutMs, [r]() {
+      r->_waiterTimerActive = false;
+      std::exchange(r->_waiter, nullptr).resume();
+    });
+  }
+
+  String await_resume()
+  {
+    if (radio._lines.empty())
+    {
+      return String();
+    }
+    String line = radio._lines.front();
+    radio._lines.pop_front();
+    return line;
+  }
+};
+
+rn2xx3_async::rn2xx3_async(rn2xx3_event_loop& loop, rn2xx3_posix& serial):
+_loop(loop),
+_serial(serial),
+_waiterTimerActive(false),
+_lastReply(0),
+_otaa(true),
+_rxPort(0)
+{
+  _loop.watch(_serial.fd(), this);
+}
+
+rn2xx3_async::~rn2xx3_async()
+{
+  _loop.unwatch(_serial.fd());
+  if (_waiterTimerActive)
+  {
+    _loop.cancelTimer(_waiterTimer);
+  }
+}
+
+rn2xx3_event_loop& rn2xx3_async::loop()
+{
+  return _loop;
+}
+
+void rn2xx3_async::setLineHandler(std::function<void(const String&)> handler)
+{
+  _lineHandler = handler;
+}
+
+void rn2xx3_async::onReadable()
+{
+  int c;
+  while ((c = _serial.read()) >= 0)
+  {
+    if (c != '\n')
+    {
+      _partial += (char)c;
+      continue;
+    }
+    String line(_partial);
+    line.trim();
+    _lines.push_back(line);
+    _partial.clear();
+  }
+
+  if (_waiter && !_lines.empty())
+  {
+    if (_waiterTimerActive)
+    {
+      _waiterTimerActive = false;
+      _loop.cancelTimer(_waiterTimer);
+    }
+    std::exchange(_waiter, nullptr).resume();
+  }
+
+  // Nobody is waiting for a reply, so whatever is left was unsolicited
+  if (!_waiter)
+  {
+    flushLines();
+  }
+}
+
+void rn2xx3_async::flushLines()
+{
+  while (!_lines.empty())
+  {
+    String line = _lines.front();
+    _lines.pop_front();
+    if (_lineHandler)
+    {
+      _lineHandler(line);
+    }
+  }
+}
+
+rn2xx3_task<String> rn2xx3_async::nextLine(unsigned long timeoutMs)
+{
+  co_return co_await line_awaiter{*this, timeoutMs};
+}
+
+rn2xx3_task<String> rn2xx3_async::query(const String& command, unsigned long timeoutMs)
+{
+  // Same pacing as sendRawCommand(), but without blocking other modules
+  unsigned long sinceReply = millis() - _lastReply;
+  if (sinceReply < 100)
+  {
+    co_await _loop.sleep(100 - sinceReply);
+  }
+
+  flushLines();
+  _serial.println(command);
+
+  String reply = co_await line_awaiter{*this, timeoutMs};
+  _lastReply = millis();
+  co_return reply;
+}
+
+rn2xx3_task<bool> rn2xx3_async::join(bool otaa)
+{
+  _otaa = otaa;
+
+  // Only try twice to join, then return and let the user handle it.
+  for (int i = 0; i < 2; i++)
+  {
+    String reply = co_await query(otaa ? F("mac join otaa") : F("mac join abp"));
+    if (reply.equals(F("ok")))
+    {
+      reply = co_await line_awaiter{*this, otaa ? 30000UL : 60000UL};
+      _lastReply = millis();
+    }
+    co_await _loop.sleep(1000);
+    if (reply.startsWith(F("accepted")))
+    {
+      co_return true;
+    }
+  }
+  co_return false;
+}
+
+rn2xx3_task<bool> rn2xx3_async::rejoin()
+{
+  co_return co_await join(_otaa);
+}
+
+rn2xx3_task<rn2xx3::received_t> rn2xx3_async::txOnce(const uint8_t* data, uint8_t size, bool confirmed)
+{
+  static const char hex[] = "0123456789ABCDEF";
+  String command = confirmed ? F("mac tx cnf 1 ") : F("mac tx uncnf 1 ");
+  command.reserve(command.length() + size * 2);
+  for (uint8_t i = 0; i < size; i++)
+  {
+    command += hex[data[i] >> 4];
+    command += hex[data[i] & 0x0F];
+  }
+
+  String receivedData = co_await query(command);
+  rn2xx3::received_t type = rn2xx3::determineReceivedDataType(receivedData);
+  if (type != rn2xx3::ok)
+  {
+    co_return type;
+  }
+
+  receivedData = co_await line_awaiter{*this, 30000};
+  _lastReply = millis();
+
+  type = rn2xx3::determineReceivedDataType(receivedData);
+  if (type == rn2xx3::UNKNOWN)
+  {
+    // Accepted by the module, but no known final reply
+    co_return rn2xx3::ok;
+  }
+  if (type == rn2xx3::mac_rx)
+  {
+    //example: mac_rx 1 54657374696E6720313233
+    int space = receivedData.indexOf(' ', 7);
+    _rxPort = receivedData.substring(7, space).toInt();
+    _rx = receivedData.substring(space + 1);
+  }
+  co_return type;
+}
+
+rn2xx3_task<TX_RETURN_TYPE> rn2xx3_async::txBytes(const uint8_t* data, uint8_t size, bool confirmed)
+{
+  uint8_t busy_count = 0;
+
+  //retransmit a maximum of 10 times
+  for (uint8_t retry_count = 0; retry_count < 10; retry_count++)
+  {
+    bool rejoin = false;
+
+    switch (co_await txOnce(data, size, confirmed))
+    {
+      case rn2xx3::mac_tx_ok:
+      case rn2xx3::radio_tx_ok:
+        co_return TX_SUCCESS;
+
+      case rn2xx3::mac_rx:
+        co_return TX_WITH_RX;
+
+      case rn2xx3::invalid_param:
+      case rn2xx3::invalid_data_len:
+        co_return TX_FAIL;
+
+      case rn2xx3::no_free_ch:
+        co_await _loop.sleep(1000);
+        break;
+
+      case rn2xx3::busy:
+        if (++busy_count >= 10)
+        {
+          rejoin = true;
+        }
+        else
+        {
+          co_await _loop.sleep(1000);
+        }
+        break;
+
+      case rn2xx3::mac_paused:
+        co_await query(F("mac resume"));
+        break;
+
+      case rn2xx3::ok:
+        // No known reply after "ok", try again
+        break;
+
+      default:
+        // not_joined, silent, mac_err, radio_err, frame counter errors
+        // and unknown replies
+        rejoin = true;
+        break;
+    }
+
+    if (rejoin)
+    {
+      co_await join(_otaa);
+    }
+  }
+
+  co_return TX_FAIL;
+}
+
+size_t rn2xx3_async::getRxBytes(uint8_t* buf, size_t cap, uint8_t* port)
+{
+  if (port)
+  {
+    *port = _rxPort;
+  }
+  return rn2xx3::decodeHex(_rx.c_str(), buf, cap);
+}
@@ -0,0 +1,281 @@
+/*
+ * C++20 coroutine API for RN2xx3 modules on a POSIX host.
+ *
+ * One rn2xx3_event_loop multiplexes the serial ports of any number of
+ * modules with epoll, so a single thread can drive many radios and sleeps
+ * while all of them are waiting for a reply.
+ *
+ *   rn2xx3_event_loop loop;
+ *   rn2xx3_posix serial;
+ *   serial.begin("/dev/ttyUSB0");
+ *   rn2xx3_async radio(loop, serial);
+ *
+ *   rn2xx3_task<void> app(rn2xx3_async& radio)
+ *   {
+ *     String dr = co_await radio.query("mac get dr");
+ *     if (co_await radio.join())
+ *     {
+ *       co_await radio.txBytes(data, sizeof(data));
+ *     }
+ *   }
+ *
+ *   loop.spawn(app(radio));
+ *   loop.run();
+ *
+ * The blocking rn2xx3 class can still be used on the same serial port for
+ * setup, as long as it is not used while the event loop runs.
+ */
+
+#ifndef rn2xx3_async_h
+#define rn2xx3_async_h
+
+#include "rn2xx3.h"
+#include "rn2xx3_posix.h"
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <optional>
+#include <utility>
+
+template <typename T> class rn2xx3_task;
+
+namespace rn2xx3_detail
+{
+  // Resumes whoever awaited the task once it finished
+  struct final_awaiter
+  {
+    bool await_ready() noexcept { return false; }
+
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+    {
+      std::coroutine_handle<> continuation = handle.promise().continuation;
+      return continuation ? continuation : std::noop_coroutine();
+    }
+
+    void await_resume() noexcept {}
+  };
+
+  struct promise_base
+  {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    final_awaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+  };
+
+  template <typename T>
+  struct promise : promise_base
+  {
+    std::optional<T> value;
+
+    rn2xx3_task<T> get_return_object();
+    void return_value(T v) { value = std::move(v); }
+
+    T result()
+    {
+      if (error) std::rethrow_exception(error);
+      return std::move(*value);
+    }
+  };
+
+  template <>
+  struct promise<void> : promise_base
+  {
+    rn2xx3_task<void> get_return_object();
+    void return_void() {}
+
+    void result()
+    {
+      if (error) std::rethrow_exception(error);
+    }
+  };
+}
+
+/*
+ * A lazily started coroutine returning a T. It runs when it is awaited,
+ * or when it is handed to rn2xx3_event_loop::spawn().
+ */
+template <typename T>
+class rn2xx3_task
+{
+  public:
+    typedef rn2xx3_detail::promise<T> promise_type;
+
+    explicit rn2xx3_task(std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+    rn2xx3_task(rn2xx3_task&& other) noexcept : _handle(std::exchange(other._handle, nullptr)) {}
+    rn2xx3_task(const rn2xx3_task&) = delete;
+    rn2xx3_task& operator=(const rn2xx3_task&) = delete;
+    ~rn2xx3_task() { if (_handle) _handle.destroy(); }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+      _handle.promise().continuation = awaiting;
+      return _handle;
+    }
+
+    T await_resume() { return _handle.promise().result(); }
+
+  private:
+    std::coroutine_handle<promise_type> _handle;
+};
+
+namespace rn2xx3_detail
+{
+  template <typename T>
+  rn2xx3_task<T> promise<T>::get_return_object()
+  {
+    return rn2xx3_task<T>(std::coroutine_handle<promise<T> >::from_promise(*this));
+  }
+
+  inline rn2xx3_task<void> promise<void>::get_return_object()
+  {
+    return rn2xx3_task<void>(std::coroutine_handle<promise<void> >::from_promise(*this));
+  }
+}
+
+class rn2xx3_async;
+
+class rn2xx3_event_loop
+{
+  public:
+    rn2xx3_event_loop();
+    ~rn2xx3_event_loop();
+
+    /*
+     * Start a task. It is owned by the loop and destroyed when it finishes.
+     */
+    void spawn(rn2xx3_task<void> task);
+
+    /*
+     * Run until all spawned tasks finished, or until stop() is called.
+     */
+    void run();
+    void stop();
+
+    /*
+     * Suspend the calling coroutine for ms milliseconds.
+     */
+    struct sleep_awaiter
+    {
+      rn2xx3_event_loop& loop;
+      unsigned long ms;
+      bool await_ready() const noexcept { return ms == 0; }
+      void await_suspend(std::coroutine_handle<> handle) { loop.addTimer(ms, [handle]() { handle.resume(); }); }
+      void await_resume() const noexcept {}
+    };
+    sleep_awaiter sleep(unsigned long ms) { return sleep_awaiter{*this, ms}; }
+
+    /*
+     * Call callback from the loop on its next iteration.
+     */
+    void post(std::function<void()> callback);
+
+  private:
+    friend class rn2xx3_async;
+
+    typedef std::multimap<unsigned long, std::function<void()> > timer_map;
+
+    int _epoll;
+    bool _stopped;
+    unsigned _tasks;
+    timer_map _timers;
+
+    timer_map::iterator addTimer(unsigned long ms, std::function<void()> callback);
+    void cancelTimer(timer_map::iterator timer);
+
+    bool watch(int fd, rn2xx3_async* radio);
+    void unwatch(int fd);
+};
+
+class rn2xx3_async
+{
+  public:
+    rn2xx3_async(rn2xx3_event_loop& loop, rn2xx3_posix& serial);
+    ~rn2xx3_async();
+
+    /*
+     * Send a raw command and return the first line of the reply,
+     * or an empty string if no reply arrived within timeoutMs.
+     */
+    rn2xx3_task<String> query(const String& command, unsigned long timeoutMs = 2000);
+
+    /*
+     * Wait for the next line from the module.
+     * Returns an empty string if no line arrived within timeoutMs.
+     */
+    rn2xx3_task<String> nextLine(unsigned long timeoutMs);
+
+    /*
+     * Join the network with the keys already configured in the module,
+     * trying twice like rn2xx3::initOTAA() does.
+     * otaa: join using over the air activation or personalization.
+     */
+    rn2xx3_task<bool> join(bool otaa = true);
+
+    /*
+     * Join again the same way as the last join().
+     */
+    rn2xx3_task<bool> rejoin();
+
+    /*
+     * Transmit raw bytes, with the same retry logic as rn2xx3::txCommand().
+     */
+    rn2xx3_task<TX_RETURN_TYPE> txBytes(const uint8_t* data, uint8_t size, bool confirmed = false);
+
+    /*
+     * Make a single transmission attempt without any retries. Returns the
+     * final reply: mac_tx_ok or mac_rx on success, or the reason it failed,
+     * like no_free_ch, busy or not_joined. Returns ok if the module accepted
+     * the command but gave no known final reply. Lets a caller decide how to
+     * retry.
+     */
+    rn2xx3_task<rn2xx3::received_t> txOnce(const uint8_t* data, uint8_t size, bool confirmed = false);
+
+    /*
+     * The last downlink, see rn2xx3::getRxBytes().
+     */
+    size_t getRxBytes(uint8_t* buf, size_t cap, uint8_t* port = NULL);
+
+    /*
+     * Called for every line that arrives while no command is waiting for it.
+     */
+    void setLineHandler(std::function<void(const String&)> handler);
+
+    rn2xx3_event_loop& loop();
+
+  private:
+    friend class rn2xx3_event_loop;
+    struct line_awaiter;
+
+    rn2xx3_event_loop& _loop;
+    rn2xx3_posix& _serial;
+
+    std::string _partial;
+    std::deque<String> _lines;
+    std::function<void(const String&)> _lineHandler;
+
+    // The coroutine waiting in nextLine(), if any
+    std::coroutine_handle<> _waiter;
+    rn2xx3_event_loop::timer_map::iterator _waiterTimer;
+    bool _waiterTimerActive;
+
+    // Time the last reply arrived, to pace commands like sendRawCommand()
+    unsigned long _lastReply;
+
+    bool _otaa;
+    uint8_t _rxPort;
+    String _rx;
+
+    void onReadable();
+    void flushLines();
+};
+
+#endif
@@ -0,0 +1,73 @@
+/*
+ * A Stream over a file, for writing and reading protocol traces on a host.
+ */
+
+#include "rn2xx3_file.h"
+
+rn2xx3_file::rn2xx3_file():
+_file(NULL)
+{
+}
+
+rn2xx3_file::~rn2xx3_file()
+{
+  close();
+}
+
+bool rn2xx3_file::open(const char* path, const char* mode)
+{
+  close();
+  _file = fopen(path, mode);
+  return _file != NULL;
+}
+
+void rn2xx3_file::close()
+{
+  if (_file != NULL)
+  {
+    fclose(_file);
+    _file = NULL;
+  }
+}
+
+int rn2xx3_file::available()
+{
+  return peek() < 0 ? 0 : 1;
+}
+
+int rn2xx3_file::read()
+{
+  return _file == NULL ? -1 : getc(_file);
+}
+
+int rn2xx3_file::peek()
+{
+  if (_file == NULL)
+  {
+    return -1;
+  }
+  int c = getc(_file);
+  if (c != EOF)
+  {
+    ungetc(c, _file);
+  }
+  return c;
+}
+
+size_t rn2xx3_file::write(uint8_t c)
+{
+  return _file != NULL && putc(c, _file) != EOF ? 1 : 0;
+}
+
+size_t rn2xx3_file::write(const uint8_t* buffer, size_t size)
+{
+  return _file == NULL ? 0 : fwrite(buffer, 1, size, _file);
+}
+
+void rn2xx3_file::flush()
+{
+  if (_file != NULL)
+  {
+    fflush(_file);
+  }
+}
@@ -0,0 +1,40 @@
+/*
+ * A Stream over a file, for writing and reading protocol traces on a host.
+ *
+ *   rn2xx3_file file;
+ *   file.open("session.trace", "wb");
+ *   rn2xx3_trace trace(serial, file);
+ *
+ */
+
+#ifndef rn2xx3_file_h
+#define rn2xx3_file_h
+
+#include "Arduino.h"
+
+#include <stdio.h>
+
+class rn2xx3_file : public Stream
+{
+  public:
+    rn2xx3_file();
+    ~rn2xx3_file();
+
+    /*
+     * Open path with an fopen() mode. Returns false if that failed.
+     */
+    bool open(const char* path, const char* mode);
+    void close();
+
+    int available();
+    int read();
+    int peek();
+    size_t write(uint8_t c);
+    size_t write(const uint8_t* buffer, size_t size);
+    void flush();
+
+  private:
+    FILE* _file;
+};
+
+#endif
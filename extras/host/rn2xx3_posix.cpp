@@ -0,0 +1,269 @@
+/*
+ * A Stream for talking to an RN2xx3 module through a POSIX serial port.
+ */
+
+#include "rn2xx3_posix.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+rn2xx3_posix::rn2xx3_posix():
+_fd(-1),
+_rxHead(0),
+_rxTail(0),
+_txLength(0)
+{
+}
+
+rn2xx3_posix::~rn2xx3_posix()
+{
+  end();
+}
+
+static speed_t baudToSpeed(uint32_t baud)
+{
+  switch (baud)
+  {
+    case 1200: return B1200;
+    case 2400: return B2400;
+    case 4800: return B4800;
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+#ifdef B460800
+    case 460800: return B460800;
+#endif
+    default: return 0;
+  }
+}
+
+bool rn2xx3_posix::begin(const char* device, uint32_t baud)
+{
+  end();
+
+  int fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0)
+  {
+    return false;
+  }
+  if (!begin(fd) || !setBaudRate(baud))
+  {
+    end();
+    return false;
+  }
+  return true;
+}
+
+bool rn2xx3_posix::begin(int fd)
+{
+  struct termios tty;
+  if (tcgetattr(fd, &tty) != 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  cfmakeraw(&tty);
+  tty.c_cflag |= CLOCAL | CREAD;
+  tty.c_cflag &= ~(CSTOPB | CRTSCTS);
+  tty.c_cc[VMIN] = 0;
+  tty.c_cc[VTIME] = 0;
+
+  if (tcsetattr(fd, TCSANOW, &tty) != 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  _fd = fd;
+  _rxHead = _rxTail = 0;
+  _txLength = 0;
+  return true;
+}
+
+bool rn2xx3_posix::setBaudRate(uint32_t baud)
+{
+  speed_t speed = baudToSpeed(baud);
+  struct termios tty;
+
+  if (_fd < 0 || speed == 0 || tcgetattr(_fd, &tty) != 0)
+  {
+    return false;
+  }
+
+  flush();
+  tcdrain(_fd);
+  cfsetispeed(&tty, speed);
+  cfsetospeed(&tty, speed);
+  return tcsetattr(_fd, TCSANOW, &tty) == 0;
+}
+
+void rn2xx3_posix::end()
+{
+  if (_fd >= 0)
+  {
+    flush();
+    close(_fd);
+    _fd = -1;
+  }
+}
+
+int rn2xx3_posix::fd()
+{
+  return _fd;
+}
+
+void rn2xx3_posix::fill()
+{
+  if (_fd < 0)
+  {
+    return;
+  }
+
+  // Compact the buffer, then read whatever the kernel has for us
+  if (_rxHead == _rxTail)
+  {
+    _rxHead = _rxTail = 0;
+  }
+  else if (_rxTail == sizeof(_rxBuffer) && _rxHead > 0)
+  {
+    memmove(_rxBuffer, &_rxBuffer[_rxHead], _rxTail - _rxHead);
+    _rxTail -= _rxHead;
+    _rxHead = 0;
+  }
+
+  if (_rxTail < sizeof(_rxBuffer))
+  {
+    ssize_t n = ::read(_fd, &_rxBuffer[_rxTail], sizeof(_rxBuffer) - _rxTail);
+    if (n > 0)
+    {
+      _rxTail += n;
+    }
+  }
+}
+
+int rn2xx3_posix::available()
+{
+  fill();
+  return _rxTail - _rxHead;
+}
+
+int rn2xx3_posix::read()
+{
+  if (_rxHead == _rxTail)
+  {
+    fill();
+    if (_rxHead == _rxTail)
+    {
+      return -1;
+    }
+  }
+  return _rxBuffer[_rxHead++];
+}
+
+int rn2xx3_posix::peek()
+{
+  if (_rxHead == _rxTail)
+  {
+    fill();
+    if (_rxHead == _rxTail)
+    {
+      return -1;
+    }
+  }
+  return _rxBuffer[_rxHead];
+}
+
+size_t rn2xx3_posix::write(uint8_t c)
+{
+  if (_fd < 0)
+  {
+    return 0;
+  }
+  if (_txLength == sizeof(_txBuffer))
+  {
+    flush();
+  }
+  _txBuffer[_txLength++] = c;
+
+  // Every command ends with a line feed, send it out as a whole
+  if (c == '\n')
+  {
+    flush();
+  }
+  return 1;
+}
+
+size_t rn2xx3_posix::write(const uint8_t* buffer, size_t size)
+{
+  size_t n = 0;
+  while (n < size && write(buffer[n]))
+  {
+    n++;
+  }
+  return n;
+}
+
+void rn2xx3_posix::flush()
+{
+  size_t sent = 0;
+  while (_fd >= 0 && sent < _txLength)
+  {
+    ssize_t n = ::write(_fd, &_txBuffer[sent], _txLength - sent);
+    if (n > 0)
+    {
+      sent += n;
+    }
+    else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      struct pollfd pfd = { _fd, POLLOUT, 0 };
+      poll(&pfd, 1, 100);
+    }
+    else if (n < 0 && errno != EINTR)
+    {
+      break;
+    }
+  }
+  _txLength = 0;
+}
+
+void rn2xx3_posix::waitAvailable(unsigned long ms)
+{
+  if (_fd < 0)
+  {
+    return;
+  }
+  struct pollfd pfd = { _fd, POLLIN, 0 };
+  poll(&pfd, 1, ms > 1000 ? 1000 : (int)ms);
+}
+
+int rn2xx3_posix::openPseudoTerminal(char* path, size_t size)
+{
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0)
+  {
+    return -1;
+  }
+  if (grantpt(master) != 0 || unlockpt(master) != 0 ||
+      ptsname_r(master, path, size) != 0)
+  {
+    close(master);
+    return -1;
+  }
+
+  // The master side acts as the module, it should not echo or translate
+  struct termios tty;
+  if (tcgetattr(master, &tty) == 0)
+  {
+    cfmakeraw(&tty);
+    tcsetattr(master, TCSANOW, &tty);
+  }
+  return master;
+}
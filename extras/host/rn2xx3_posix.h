@@ -0,0 +1,81 @@
+/*
+ * A Stream for talking to an RN2xx3 module through a POSIX serial port,
+ * like the /dev/ttyUSB0 or /dev/ttyACM0 of an RN2483 USB stick.
+ *
+ * Reads are non-blocking and buffered. Writes are buffered until the end of
+ * a command line, so every command goes to the kernel in one write().
+ *
+ *   rn2xx3_posix serial;
+ *   serial.begin("/dev/ttyUSB0", 57600);
+ *   rn2xx3 myLora(serial);
+ *
+ */
+
+#ifndef rn2xx3_posix_h
+#define rn2xx3_posix_h
+
+#include "Arduino.h"
+
+class rn2xx3_posix : public Stream
+{
+  public:
+    rn2xx3_posix();
+    ~rn2xx3_posix();
+
+    /*
+     * Open and configure the serial device for 8N1 raw communication.
+     * Returns false if the device could not be opened or configured.
+     */
+    bool begin(const char* device, uint32_t baud = 57600);
+
+    /*
+     * Use an already opened file descriptor, for example one side of a
+     * pseudo terminal. The descriptor is closed by end().
+     */
+    bool begin(int fd);
+
+    /*
+     * Change the baud rate of an open serial device.
+     */
+    bool setBaudRate(uint32_t baud);
+
+    void end();
+
+    /*
+     * The file descriptor of the serial device, or -1 if it is not open.
+     */
+    int fd();
+
+    int available();
+    int read();
+    int peek();
+    size_t write(uint8_t c);
+    size_t write(const uint8_t* buffer, size_t size);
+    void flush();
+
+    using Print::write;
+
+    /*
+     * Create a pseudo terminal pair, so a program can stand in for the module.
+     * The slave side path is written to path, which can be opened with
+     * begin(path). Returns the file descriptor of the master side, or -1.
+     */
+    static int openPseudoTerminal(char* path, size_t size);
+
+  protected:
+    void waitAvailable(unsigned long ms);
+
+  private:
+    int _fd;
+
+    uint8_t _rxBuffer[256];
+    size_t _rxHead;
+    size_t _rxTail;
+
+    uint8_t _txBuffer[512];
+    size_t _txLength;
+
+    void fill();
+};
+
+#endif
@@ -0,0 +1,237 @@
+/*
+ * Share one uplink queue between several RN2xx3 modules on a POSIX host.
+ */
+
+#include "rn2xx3_scheduler.h"
+
+/*
+ * Suspends an idle worker until there is work, or the scheduler stops.
+ */
+struct rn2xx3_scheduler::work_awaiter
+{
+  rn2xx3_scheduler& scheduler;
+
+  bool await_ready() const noexcept
+  {
+    return !scheduler._queue.empty() || !scheduler._running;
+  }
+
+  void await_suspend(std::coroutine_handle<> handle)
+  {
+    scheduler._idle.push_back(handle);
+  }
+
+  void await_resume() const noexcept {}
+};
+
+rn2xx3_scheduler::rn2xx3_scheduler(rn2xx3_event_loop& loop):
+_loop(loop),
+_maxAttempts(10),
+_running(false),
+_started(0),
+_stopped(0),
+_failed(0)
+{
+}
+
+void rn2xx3_scheduler::addModule(rn2xx3_async& radio)
+{
+  module m = { &radio, 0, 0, { 0, 0, 0, 0 } };
+  _modules.push_back(m);
+}
+
+void rn2xx3_scheduler::enqueue(const uint8_t* data, uint8_t size, bool confirmed, done_callback done)
+{
+  uplink u = { std::vector<uint8_t>(data, data + size), confirmed, 0, done };
+  _queue.push_back(u);
+  wakeIdle();
+}
+
+void rn2xx3_scheduler::setMaxAttempts(uint8_t attempts)
+{
+  _maxAttempts = attempts > 0 ? attempts : 1;
+}
+
+void rn2xx3_scheduler::start()
+{
+  if (_running)
+  {
+    return;
+  }
+  _running = true;
+  _started = millis();
+  for (size_t i = 0; i < _modules.size(); i++)
+  {
+    _loop.spawn(worker(i));
+  }
+}
+
+void rn2xx3_scheduler::stop()
+{
+  if (_running)
+  {
+    _stopped = millis();
+  }
+  _running = false;
+  while (!_idle.empty())
+  {
+    wakeIdle();
+  }
+}
+
+void rn2xx3_scheduler::wakeIdle()
+{
+  if (_idle.empty())
+  {
+    return;
+  }
+  // Resume from the loop, not from inside whoever called us
+  std::coroutine_handle<> handle = _idle.front();
+  _idle.pop_front();
+  _loop.post([handle]() { handle.resume(); });
+}
+
+rn2xx3_task<void> rn2xx3_scheduler::worker(size_t index)
+{
+  while (true)
+  {
+    co_await work_awaiter{*this};
+    if (!_running)
+    {
+      co_return;
+    }
+
+    // Let free modules take the work while this one waits out its duty cycle
+    long blocked = (long)(_modules[index].blockedUntil - millis());
+    if (blocked > 0)
+    {
+      co_await _loop.sleep(blocked);
+      _modules[index].stats.blockedMs += blocked;
+      continue;
+    }
+
+    if (_queue.empty())
+    {
+      continue;
+    }
+    uplink u = _queue.front();
+    _queue.pop_front();
+
+    // Another worker may be able to take the next one at the same time
+    if (!_queue.empty())
+    {
+      wakeIdle();
+    }
+
+    unsigned long start = millis();
+    rn2xx3_async& radio = *_modules[index].radio;
+    rn2xx3::received_t reply = co_await radio.txOnce(u.payload.data(), u.payload.size(), u.confirmed);
+    TX_RETURN_TYPE result = TX_FAIL;
+    bool retry = true;
+
+    switch (reply)
+    {
+      case rn2xx3::mac_tx_ok:
+      case rn2xx3::radio_tx_ok:
+        result = TX_SUCCESS;
+        retry = false;
+        break;
+
+      case rn2xx3::mac_rx:
+        result = TX_WITH_RX;
+        retry = false;
+        break;
+
+      case rn2xx3::invalid_param:
+      case rn2xx3::invalid_data_len:
+        retry = false;
+        break;
+
+      case rn2xx3::no_free_ch:
+      case rn2xx3::busy:
+      {
+        // Back off this module, doubling up to 32 seconds
+        module& m = _modules[index];
+        m.blockedUntil = millis() + (1000UL << m.backoff);
+        if (m.backoff < 5)
+        {
+          m.backoff++;
+        }
+        break;
+      }
+
+      case rn2xx3::mac_paused:
+        co_await radio.query(F("mac resume"));
+        break;
+
+      case rn2xx3::ok:
+        break;
+
+      default:
+        co_await radio.rejoin();
+        break;
+    }
+
+    module& m = _modules[index];
+    m.stats.busyMs += millis() - start;
+
+    if (!retry)
+    {
+      if (result != TX_FAIL)
+      {
+        m.stats.uplinks++;
+        m.backoff = 0;
+      }
+      else
+      {
+        m.stats.failures++;
+        _failed++;
+      }
+      if (u.done)
+      {
+        u.done(result, index);
+      }
+    }
+    else if (++u.attempts >= _maxAttempts)
+    {
+      m.stats.failures++;
+      _failed++;
+      if (u.done)
+      {
+        u.done(TX_FAIL, index);
+      }
+    }
+    else
+    {
+      // Keep the order: the uplink goes back to the front of the queue
+      m.stats.failures++;
+      _queue.push_front(u);
+      wakeIdle();
+    }
+  }
+}
+
+rn2xx3_scheduler::stats rn2xx3_scheduler::getStats() const
+{
+  stats s;
+  s.uplinks = 0;
+  s.failed = _failed;
+  s.queued = _queue.size();
+  s.elapsedMs = (_running ? millis() : _stopped) - _started;
+  for (size_t i = 0; i < _modules.size(); i++)
+  {
+    s.modules.push_back(_modules[i].stats);
+    s.uplinks += _modules[i].stats.uplinks;
+  }
+  return s;
+}
+
+double rn2xx3_scheduler::stats::uplinksPerSecond() const
+{
+  return elapsedMs ? uplinks * 1000.0 / elapsedMs : 0;
+}
+
+double rn2xx3_scheduler::stats::utilization(size_t i) const
+{
+  return elapsedMs && i < modules.size() ? (double)modules[i].busyMs / elapsedMs : 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * Share one uplink queue between several RN2xx3 modules on a POSIX host.
+ *
+ * Every module gets a worker coroutine on the event loop. A worker takes
+ * the oldest uplink from the queue as soon as its module is free and not
+ * waiting out its duty cycle, so a module that replies no_free_ch hands
+ * its uplink to the next free module instead of holding up the queue.
+ *
+ *   rn2xx3_scheduler scheduler(loop);
+ *   scheduler.addModule(radio1);
+ *   scheduler.addModule(radio2);
+ *   scheduler.start();
+ *   scheduler.enqueue(data, sizeof(data));
+ *   loop.run();
+ *
+ * All calls have to be made from the thread running the event loop.
+ */
+
+#ifndef rn2xx3_scheduler_h
+#define rn2xx3_scheduler_h
+
+#include "rn2xx3_async.h"
+
+#include <vector>
+
+class rn2xx3_scheduler
+{
+  public:
+    /*
+     * Called when an uplink was sent, or given up on after maxAttempts.
+     * module is the index of the module that handled it last.
+     */
+    typedef std::function<void(TX_RETURN_TYPE result, size_t module)> done_callback;
+
+    struct module_stats
+    {
+      unsigned long uplinks;    // Uplinks sent successfully
+      unsigned long failures;   // Attempts that did not result in an uplink
+      unsigned long busyMs;     // Time spent transmitting and joining
+      unsigned long blockedMs;  // Time spent waiting out the duty cycle
+    };
+
+    struct stats
+    {
+      unsigned long uplinks;
+      unsigned long failed;     // Uplinks given up on
+      unsigned long queued;     // Uplinks still waiting in the queue
+      unsigned long elapsedMs;  // Time since start()
+      std::vector<module_stats> modules;
+
+      double uplinksPerSecond() const;
+
+      // Fraction of the elapsed time module i was busy, from 0 to 1
+      double utilization(size_t i) const;
+    };
+
+    explicit rn2xx3_scheduler(rn2xx3_event_loop& loop);
+
+    /*
+     * Add a module. It should already be joined. Add all modules before start().
+     */
+    void addModule(rn2xx3_async& radio);
+
+    /*
+     * Queue an uplink. The payload is copied.
+     */
+    void enqueue(const uint8_t* data, uint8_t size, bool confirmed = false, done_callback done = done_callback());
+
+    /*
+     * The number of attempts, over all modules, before an uplink is given up on.
+     */
+    void setMaxAttempts(uint8_t attempts);
+
+    /*
+     * Start a worker for every module on the event loop.
+     */
+    void start();
+
+    /*
+     * Let the workers finish their current uplink and then exit,
+     * so the event loop can return.
+     */
+    void stop();
+
+    stats getStats() const;
+
+  private:
+    struct uplink
+    {
+      std::vector<uint8_t> payload;
+      bool confirmed;
+      uint8_t attempts;
+      done_callback done;
+    };
+
+    struct module
+    {
+      rn2xx3_async* radio;
+      unsigned long blockedUntil;
+      uint8_t backoff;
+      module_stats stats;
+    };
+
+    rn2xx3_event_loop& _loop;
+    std::vector<module> _modules;
+    std::deque<uplink> _queue;
+    std::deque<std::coroutine_handle<> > _idle;
+    uint8_t _maxAttempts;
+    bool _running;
+    unsigned long _started;
+    unsigned long _stopped;
+    unsigned long _failed;
+
+    struct work_awaiter;
+    rn2xx3_task<void> worker(size_t index);
+    void wakeIdle();
+};
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ * A bounded lock-free queue for exactly one producer and one consumer thread.
+ */
+
+#ifndef rn2xx3_spsc_queue_h
+#define rn2xx3_spsc_queue_h
+
+#include <atomic>
+#include <stddef.h>
+#include <utility>
+
+template <typename T, size_t Size>
+class rn2xx3_spsc_queue
+{
+  public:
+    rn2xx3_spsc_queue() : _head(0), _tail(0) {}
+
+    /*
+     * Called by the producer only. Returns false if the queue is full.
+     */
+    bool push(T&& value)
+    {
+      size_t head = _head.load(std::memory_order_relaxed);
+      size_t next = (head + 1) % Size;
+      if (next == _tail.load(std::memory_order_acquire))
+      {
+        return false;
+      }
+      _items[head] = std::move(value);
+      _head.store(next, std::memory_order_release);
+      return true;
+    }
+
+    /*
+     * Called by the consumer only. Returns false if the queue is empty.
+     */
+    bool pop(T& value)
+    {
+      size_t tail = _tail.load(std::memory_order_relaxed);
+      if (tail == _head.load(std::memory_order_acquire))
+      {
+        return false;
+      }
+      value = std::move(_items[tail]);
+      _tail.store((tail + 1) % Size, std::memory_order_release);
+      return true;
+    }
+
+    bool empty() const
+    {
+      return _tail.load(std::memory_order_acquire) == _head.load(std::memory_order_acquire);
+    }
+
+  private:
+    T _items[Size];
+
+    // Written by the producer and the consumer respectively. Keep them
+    // on separate cache lines so the threads do not contend.
+    alignas(64) std::atomic<size_t> _head;
+    alignas(64) std::atomic<size_t> _tail;
+};
+
+#endif
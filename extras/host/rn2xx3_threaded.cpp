@@ -0,0 +1,234 @@
+/*
+ * Run an rn2xx3 on its own threads on a POSIX host.
+ */
+
+#include "rn2xx3_threaded.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+rn2xx3_threaded::rn2xx3_threaded(rn2xx3_posix& serial):
+_serial(serial),
+_stream(*this),
+_radio(_stream),
+_running(false)
+{
+  _wake[0] = _wake[1] = -1;
+}
+
+rn2xx3_threaded::~rn2xx3_threaded()
+{
+  stop();
+}
+
+bool rn2xx3_threaded::start()
+{
+  if (_running || _serial.fd() < 0 || pipe(_wake) != 0)
+  {
+    return false;
+  }
+  fcntl(_wake[0], F_SETFL, O_NONBLOCK);
+  fcntl(_wake[1], F_SETFL, O_NONBLOCK);
+
+  _running = true;
+  _reader = std::thread(&rn2xx3_threaded::readerLoop, this);
+  _worker = std::thread(&rn2xx3_threaded::workerLoop, this);
+  return true;
+}
+
+void rn2xx3_threaded::stop()
+{
+  if (!_running)
+  {
+    return;
+  }
+  _running = false;
+  wake();
+  _reader.join();
+  _worker.join();
+
+  close(_wake[0]);
+  close(_wake[1]);
+  _wake[0] = _wake[1] = -1;
+
+  std::lock_guard<std::mutex> lock(_jobsMutex);
+  _jobs.clear();
+}
+
+void rn2xx3_threaded::setLineHandler(std::function<void(const String&)> handler)
+{
+  _lineHandler = handler;
+}
+
+std::future<String> rn2xx3_threaded::command(const String& command)
+{
+  return submit([command](rn2xx3& radio) { return radio.sendRawCommand(command); });
+}
+
+std::future<TX_RETURN_TYPE> rn2xx3_threaded::txBytes(const uint8_t* data, uint8_t size)
+{
+  std::vector<uint8_t> copy(data, data + size);
+  return submit([copy](rn2xx3& radio) { return radio.txBytes(copy.data(), copy.size()); });
+}
+
+std::future<TX_RETURN_TYPE> rn2xx3_threaded::txCnf(const String& data)
+{
+  return submit([data](rn2xx3& radio) { return radio.txCnf(data); });
+}
+
+std::future<bool> rn2xx3_threaded::init()
+{
+  return submit([](rn2xx3& radio) { return radio.init(); });
+}
+
+void rn2xx3_threaded::enqueue(std::function<void(rn2xx3&)> job)
+{
+  {
+    std::lock_guard<std::mutex> lock(_jobsMutex);
+    _jobs.push_back(job);
+  }
+  wake();
+}
+
+void rn2xx3_threaded::wake()
+{
+  char c = 0;
+  if (_wake[1] >= 0 && write(_wake[1], &c, 1) < 0)
+  {
+    // The pipe is full, so the worker is going to wake up anyway
+  }
+}
+
+void rn2xx3_threaded::waitForWake(unsigned long ms)
+{
+  struct pollfd pfd = { _wake[0], POLLIN, 0 };
+  if (poll(&pfd, 1, (int)ms) > 0)
+  {
+    char buffer[64];
+    while (read(_wake[0], buffer, sizeof(buffer)) > 0) {}
+  }
+}
+
+void rn2xx3_threaded::readerLoop()
+{
+  std::string line;
+
+  while (_running)
+  {
+    struct pollfd pfd = { _serial.fd(), POLLIN, 0 };
+    poll(&pfd, 1, 100);
+
+    int c;
+    while ((c = _serial.read()) >= 0)
+    {
+      if (c != '\n')
+      {
+        line += (char)c;
+        continue;
+      }
+      if (!line.empty() && line[line.size()-1] == '\r')
+      {
+        line.erase(line.size()-1);
+      }
+      // Never drop a line. The worker is slow only while it writes.
+      while (!_lines.push(std::move(line)) && _running)
+      {
+        wake();
+        usleep(1000);
+      }
+      line.clear();
+      wake();
+    }
+  }
+}
+
+void rn2xx3_threaded::workerLoop()
+{
+  while (_running)
+  {
+    std::function<void(rn2xx3&)> job;
+    {
+      std::lock_guard<std::mutex> lock(_jobsMutex);
+      if (!_jobs.empty())
+      {
+        job = _jobs.front();
+        _jobs.pop_front();
+      }
+    }
+
+    // Whatever arrived before the command was sent is not its reply
+    deliverLines();
+
+    if (job)
+    {
+      job(_radio);
+    }
+    else
+    {
+      waitForWake(100);
+    }
+  }
+}
+
+void rn2xx3_threaded::deliverLines()
+{
+  _stream.discard();
+
+  std::string line;
+  while (_lines.pop(line))
+  {
+    if (_lineHandler)
+    {
+      _lineHandler(String(line));
+    }
+  }
+}
+
+bool rn2xx3_threaded::queue_stream::next()
+{
+  if (_position < _current.size())
+  {
+    return true;
+  }
+  if (!_host._lines.pop(_current))
+  {
+    _current.clear();
+    _position = 0;
+    return false;
+  }
+  _current += "\r\n";
+  _position = 0;
+  return true;
+}
+
+int rn2xx3_threaded::queue_stream::available()
+{
+  return next() ? _current.size() - _position : 0;
+}
+
+int rn2xx3_threaded::queue_stream::read()
+{
+  return next() ? (uint8_t)_current[_position++] : -1;
+}
+
+int rn2xx3_threaded::queue_stream::peek()
+{
+  return next() ? (uint8_t)_current[_position] : -1;
+}
+
+size_t rn2xx3_threaded::queue_stream::write(uint8_t c)
+{
+  return _host._serial.write(c);
+}
+
+void rn2xx3_threaded::queue_stream::discard()
+{
+  _current.clear();
+  _position = 0;
+}
+
+void rn2xx3_threaded::queue_stream::waitAvailable(unsigned long ms)
+{
+  _host.waitForWake(ms > 100 ? 100 : ms);
+}
@@ -0,0 +1,129 @@
+/*
+ * Run an rn2xx3 on its own threads on a POSIX host.
+ *
+ * A reader thread splits everything the module sends into lines and passes
+ * them to a worker thread through a lock-free queue. The worker thread owns
+ * the rn2xx3 instance and runs the commands submitted by the application,
+ * which gets a std::future for the result instead of blocking on the UART.
+ * Lines that arrive while no command is running, like a mac_rx in class C
+ * or a reboot banner, are passed to the line handler instead of being lost.
+ *
+ *   rn2xx3_posix serial;
+ *   serial.begin("/dev/ttyUSB0");
+ *   rn2xx3_threaded host(serial);
+ *   host.start();
+ *   std::future<TX_RETURN_TYPE> result = host.txBytes(data, sizeof(data));
+ *
+ */
+
+#ifndef rn2xx3_threaded_h
+#define rn2xx3_threaded_h
+
+#include "rn2xx3.h"
+#include "rn2xx3_posix.h"
+#include "rn2xx3_spsc_queue.h"
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class rn2xx3_threaded
+{
+  public:
+    explicit rn2xx3_threaded(rn2xx3_posix& serial);
+    ~rn2xx3_threaded();
+
+    /*
+     * Start the reader and worker threads. The serial port should be open.
+     */
+    bool start();
+
+    /*
+     * Stop both threads. Commands that did not run yet are abandoned.
+     */
+    void stop();
+
+    /*
+     * Called on the worker thread for every line that arrives while no
+     * command is running. Set this before calling start().
+     */
+    void setLineHandler(std::function<void(const String&)> handler);
+
+    /*
+     * Run fn(radio) on the worker thread. Commands run one at a time,
+     * in the order they were submitted.
+     */
+    template <typename F>
+    std::future<decltype(std::declval<F>()(std::declval<rn2xx3&>()))> submit(F fn)
+    {
+      typedef decltype(fn(std::declval<rn2xx3&>())) result_t;
+      std::shared_ptr<std::packaged_task<result_t(rn2xx3&)> > task =
+        std::make_shared<std::packaged_task<result_t(rn2xx3&)> >(fn);
+      std::future<result_t> future = task->get_future();
+      enqueue([task](rn2xx3& radio) { (*task)(radio); });
+      return future;
+    }
+
+    std::future<String> command(const String& command);
+    std::future<TX_RETURN_TYPE> txBytes(const uint8_t* data, uint8_t size);
+    std::future<TX_RETURN_TYPE> txCnf(const String& data);
+    std::future<bool> init();
+
+  private:
+    /*
+     * The Stream the rn2xx3 uses. Reads come from the line queue,
+     * writes go straight to the serial port.
+     */
+    class queue_stream : public Stream
+    {
+      public:
+        explicit queue_stream(rn2xx3_threaded& host) : _host(host), _position(0) {}
+        int available();
+        int read();
+        int peek();
+        size_t write(uint8_t c);
+        using Print::write;
+        void discard();
+
+      protected:
+        void waitAvailable(unsigned long ms);
+
+      private:
+        rn2xx3_threaded& _host;
+        std::string _current;
+        size_t _position;
+        bool next();
+    };
+
+    rn2xx3_posix& _serial;
+    queue_stream _stream;
+    rn2xx3 _radio;
+
+    rn2xx3_spsc_queue<std::string, 64> _lines;
+    std::function<void(const String&)> _lineHandler;
+
+    std::mutex _jobsMutex;
+    std::deque<std::function<void(rn2xx3&)> > _jobs;
+
+    std::atomic<bool> _running;
+    std::thread _reader;
+    std::thread _worker;
+
+    // Wakes up the worker for new lines and new jobs
+    int _wake[2];
+
+    void enqueue(std::function<void(rn2xx3&)> job);
+    void wake();
+    void waitForWake(unsigned long ms);
+    void readerLoop();
+    void workerLoop();
+    void deliverLines();
+};
+
+#endif
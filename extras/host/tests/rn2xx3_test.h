@@ -0,0 +1,396 @@
+/*
+ * Support for the host tests: checks, an in-memory Stream and a fake
+ * RN2xx3 module that answers the library like the firmware does.
+ *
+ * Every test is a program that runs its test functions from main() and
+ * returns testResult(), so CTest sees a failure as a non-zero exit code:
+ *
+ *   static void joins()
+ *   {
+ *     fake_module module;
+ *     rn2xx3 lora(module);
+ *     CHECK(lora.initOTAA(APPEUI, APPKEY));
+ *     CHECK_EQUAL(1, module.count("mac join otaa"));
+ *   }
+ *
+ *   int main()
+ *   {
+ *     RUN(joins);
+ *     return testResult();
+ *   }
+ */
+
+#ifndef rn2xx3_test_h
+#define rn2xx3_test_h
+
+#include "Arduino.h"
+#include <rn2xx3_storage.h>
+
+#include <deque>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+static int testFailures = 0;
+
+#define CHECK(condition) testCheck((condition), #condition, __FILE__, __LINE__)
+#define CHECK_EQUAL(expected, actual) \
+  testEqual((expected), (actual), #actual, __FILE__, __LINE__)
+#define RUN(test) testRun(test, #test)
+
+static inline bool testCheck(bool condition, const char* text, const char* file, int line)
+{
+  if (!condition)
+  {
+    std::cerr << file << ":" << line << ": CHECK(" << text << ") failed" << std::endl;
+    testFailures++;
+  }
+  return condition;
+}
+
+// Print small integers as numbers, not as characters
+template <typename T>
+static const T& testValue(const T& value)
+{
+  return value;
+}
+
+static inline int testValue(uint8_t value)
+{
+  return value;
+}
+
+static inline int testValue(int8_t value)
+{
+  return value;
+}
+
+template <typename E, typename A>
+static bool testEqual(const E& expected, const A& actual, const char* text, const char* file, int line)
+{
+  if (!(expected == actual))
+  {
+    std::cerr << file << ":" << line << ": " << text << " is " << testValue(actual)
+              << ", expected " << testValue(expected) << std::endl;
+    testFailures++;
+    return false;
+  }
+  return true;
+}
+
+static inline void testRun(void (*test)(), const char* name)
+{
+  int failures = testFailures;
+  test();
+  std::cout << (testFailures == failures ? "ok   " : "FAIL ") << name << std::endl;
+}
+
+static inline int testResult()
+{
+  return testFailures == 0 ? 0 : 1;
+}
+
+static inline std::ostream& operator<<(std::ostream& out, const String& s)
+{
+  return out << s.c_str();
+}
+
+// Test keys, they are only used against the fake module
+#define TEST_APPEUI "70B3D57ED00001A6"
+#define TEST_APPKEY "A23C96EE13804963F8C2BD6285448198"
+#define TEST_DEVADDR "02017201"
+#define TEST_NWKSKEY "AE17E567AECC8787F749A62F5541D522"
+#define TEST_APPSKEY "8D7FFEF938589D95AAD928C2E2E7E48F"
+
+/*
+ * Bytes written to it can be read back, like a file in memory.
+ */
+class test_buffer : public Stream
+{
+  public:
+    int available() { return (int)_data.size(); }
+    int read()
+    {
+      if (_data.empty())
+      {
+        return -1;
+      }
+      uint8_t c = _data.front();
+      _data.pop_front();
+      return c;
+    }
+    int peek() { return _data.empty() ? -1 : _data.front(); }
+    size_t write(uint8_t c)
+    {
+      _data.push_back(c);
+      return 1;
+    }
+
+    using Print::write;
+
+  private:
+    std::deque<uint8_t> _data;
+};
+
+/*
+ * Storage in memory, starting out erased like a fresh EEPROM.
+ */
+class test_storage : public rn2xx3_storage
+{
+  public:
+    test_storage()
+    {
+      memset(data, 0xFF, sizeof(data));
+    }
+
+    bool read(uint16_t address, uint8_t* buffer, uint16_t length)
+    {
+      if (address + length > sizeof(data))
+      {
+        return false;
+      }
+      memcpy(buffer, &data[address], length);
+      return true;
+    }
+
+    bool write(uint16_t address, const uint8_t* buffer, uint16_t length)
+    {
+      if (address + length > sizeof(data))
+      {
+        return false;
+      }
+      memcpy(&data[address], buffer, length);
+      writes++;
+      return true;
+    }
+
+    uint8_t data[1024];
+    int writes = 0;
+};
+
+/*
+ * A fake RN2483 with firmware 1.0.5, unless a test changes version. It
+ * keeps the mac parameters that are set, joins at once, and answers every
+ * uplink with mac_tx_ok unless a test queued other replies with reply().
+ * The module can be silenced like the network would, until
+ * "mac forceENABLE" or a reset.
+ */
+class fake_module : public Stream
+{
+  public:
+    fake_module()
+    {
+      reset();
+      version = "RN2483 1.0.5 Oct 31 2018 15:06:52";
+      vdd = "3300";
+      joinReply = "accepted";
+    }
+
+    /*
+     * Answer the next "mac tx" with these lines instead of ok and
+     * mac_tx_ok. Several calls queue replies for several uplinks.
+     */
+    void reply(const std::string& first, const std::string& second = "")
+    {
+      std::vector<std::string> lines;
+      lines.push_back(first);
+      if (!second.empty())
+      {
+        lines.push_back(second);
+      }
+      _replies.push_back(lines);
+    }
+
+    /*
+     * Number of commands received that start with prefix.
+     */
+    int count(const std::string& prefix)
+    {
+      int n = 0;
+      for (size_t i = 0; i < commands.size(); i++)
+      {
+        if (commands[i].compare(0, prefix.size(), prefix) == 0)
+        {
+          n++;
+        }
+      }
+      return n;
+    }
+
+    /*
+     * The answer to a command line, one string per line.
+     */
+    std::vector<std::string> answer(const std::string& command)
+    {
+      std::vector<std::string> lines;
+      commands.push_back(command);
+
+      if (starts(command, "sys get ver"))
+      {
+        lines.push_back(version);
+      }
+      else if (starts(command, "sys get hweui"))
+      {
+        lines.push_back("0004A30B001A2B3C");
+      }
+      else if (starts(command, "sys get vdd"))
+      {
+        lines.push_back(vdd);
+      }
+      else if (starts(command, "sys reset"))
+      {
+        reset();
+        lines.push_back(version);
+      }
+      else if (starts(command, "mac reset"))
+      {
+        reset();
+        lines.push_back("ok");
+      }
+      else if (starts(command, "mac forceENABLE"))
+      {
+        silenced = false;
+        lines.push_back("ok");
+      }
+      else if (starts(command, "mac get status"))
+      {
+        char status[9];
+        snprintf(status, sizeof(status), "%08X", (joined ? 0x01 : 0) | (silenced ? 0x40 : 0));
+        lines.push_back(status);
+      }
+      else if (starts(command, "mac get "))
+      {
+        lines.push_back(params[command.substr(8)]);
+      }
+      else if (starts(command, "mac set "))
+      {
+        std::string rest = command.substr(8);
+        size_t space = rest.find(' ');
+        params[rest.substr(0, space)] = space == std::string::npos ? "" : rest.substr(space + 1);
+        lines.push_back("ok");
+      }
+      else if (starts(command, "mac join"))
+      {
+        joined = joinReply == "accepted";
+        lines.push_back("ok");
+        lines.push_back(joinReply);
+      }
+      else if (starts(command, "mac tx"))
+      {
+        if (!_replies.empty())
+        {
+          lines = _replies.front();
+          _replies.pop_front();
+        }
+        else if (silenced)
+        {
+          lines.push_back("silent");
+        }
+        else if (!joined)
+        {
+          lines.push_back("not_joined");
+        }
+        else
+        {
+          lines.push_back("ok");
+          lines.push_back("mac_tx_ok");
+        }
+        if (lines.size() > 1 && (lines[1] == "mac_tx_ok" || starts(lines[1], "mac_rx") || lines[1] == "mac_err"))
+        {
+          params["upctr"] = std::to_string(std::stoul(params["upctr"]) + 1);
+        }
+      }
+      else if (starts(command, "radio get snr"))
+      {
+        lines.push_back("-5");
+      }
+      else
+      {
+        lines.push_back("ok");
+      }
+      return lines;
+    }
+
+    int available() { return (int)_out.size(); }
+    int read()
+    {
+      if (_out.empty())
+      {
+        return -1;
+      }
+      uint8_t c = _out.front();
+      _out.pop_front();
+      return c;
+    }
+    int peek() { return _out.empty() ? -1 : _out.front(); }
+
+    size_t write(uint8_t c)
+    {
+      if (c != '\n')
+      {
+        _line += (char)c;
+        return 1;
+      }
+      if (!_line.empty() && _line[_line.size() - 1] == '\r')
+      {
+        _line.erase(_line.size() - 1);
+      }
+      std::vector<std::string> lines = answer(_line);
+      _line.clear();
+      for (size_t i = 0; i < lines.size(); i++)
+      {
+        send(lines[i]);
+      }
+      return 1;
+    }
+
+    using Print::write;
+
+    /*
+     * Send a line without being asked, like a class C downlink.
+     */
+    void send(const std::string& line)
+    {
+      _out.insert(_out.end(), line.begin(), line.end());
+      _out.push_back('\r');
+      _out.push_back('\n');
+    }
+
+    std::map<std::string, std::string> params;
+    std::vector<std::string> commands;
+    std::string version;
+    std::string vdd;
+    std::string joinReply;
+    bool joined;
+    bool silenced;
+
+  private:
+    std::deque<uint8_t> _out;
+    std::string _line;
+    std::deque<std::vector<std::string> > _replies;
+
+    static bool starts(const std::string& s, const char* prefix)
+    {
+      return s.compare(0, strlen(prefix), prefix) == 0;
+    }
+
+    void reset()
+    {
+      params.clear();
+      params["devaddr"] = "00000000";
+      params["deveui"] = "0000000000000000";
+      params["appeui"] = "0000000000000000";
+      params["upctr"] = "0";
+      params["dnctr"] = "0";
+      params["dr"] = "5";
+      params["pwridx"] = "1";
+      params["adr"] = "off";
+      params["retx"] = "7";
+      params["rxdelay1"] = "1000";
+      joined = false;
+      silenced = false;
+    }
+};
+
+#endif
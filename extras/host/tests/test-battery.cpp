@@ -0,0 +1,240 @@
+/*
+ * The battery policy: it runs on the way to an uplink, undoes what it
+ * changed once the supply recovers, and only holds back expensive uplinks,
+ * which report(), rn2xx3_series and rn2xx3_fragmenter send again later.
+ */
+
+#include <rn2xx3.h>
+#include <rn2xx3_fragment.h>
+#include <rn2xx3_series.h>
+
+#include "rn2xx3_test.h"
+
+static const rn2xx3_battery_policy neutral = {0xFF, 0xFF, false, 0, false, 0};
+static rn2xx3_battery_policy wanted;
+static int policyRuns;
+
+static void fixedPolicy(uint16_t vddMv, rn2xx3_battery_policy& policy)
+{
+  (void)vddMv;
+  policy = wanted;
+  policyRuns++;
+}
+
+static void lowSupplyPolicy(uint16_t vddMv, rn2xx3_battery_policy& policy)
+{
+  if (vddMv < 3000)
+  {
+    policy.dataRate = 0;
+    policy.powerIndex = 4;
+  }
+}
+
+static void usePolicy(rn2xx3& lora, const rn2xx3_battery_policy& policy)
+{
+  wanted = policy;
+  policyRuns = 0;
+  lora.setBatteryPolicy(fixedPolicy);
+}
+
+static size_t readBlob(uint32_t offset, uint8_t* buf, size_t length)
+{
+  for (size_t i = 0; i < length; i++)
+  {
+    buf[i] = (uint8_t)(offset + i);
+  }
+  return length;
+}
+
+static const uint8_t payload[] = {0x42};
+
+static void runsOnlyForUplinks()
+{
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+  rn2xx3_battery_policy policy = neutral;
+  policy.powerIndex = 3;
+  usePolicy(lora, policy);
+
+  // Reading the voltage does not change the radio settings
+  uint16_t vdd;
+  CHECK(lora.getVdd(vdd));
+  CHECK_EQUAL(3300, lora.getVbat());
+  CHECK_EQUAL(0, policyRuns);
+  CHECK_EQUAL(0, module.count("mac set pwridx 3"));
+
+  CHECK_EQUAL(TX_SUCCESS, lora.txBytes(payload, sizeof(payload)));
+  CHECK_EQUAL(1, policyRuns);
+  CHECK_EQUAL(std::string("3"), module.params["pwridx"]);
+
+  // The same reading does not run the policy again
+  CHECK_EQUAL(TX_SUCCESS, lora.txBytes(payload, sizeof(payload)));
+  CHECK_EQUAL(1, policyRuns);
+  CHECK_EQUAL(1, module.count("mac set pwridx 3"));
+}
+
+static void restoresSettingsWhenSupplyRecovers()
+{
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+  lora.setBatteryPolicy(lowSupplyPolicy, 1);
+  std::string dr = module.params["dr"];
+  std::string pwridx = module.params["pwridx"];
+
+  module.vdd = "2800";
+  CHECK_EQUAL(TX_SUCCESS, lora.txBytes(payload, sizeof(payload)));
+  CHECK_EQUAL(std::string("0"), module.params["dr"]);
+  CHECK_EQUAL(std::string("4"), module.params["pwridx"]);
+
+  module.vdd = "3300";
+  delay(1100);
+  CHECK_EQUAL(TX_SUCCESS, lora.txBytes(payload, sizeof(payload)));
+  CHECK_EQUAL(dr, module.params["dr"]);
+  CHECK_EQUAL(pwridx, module.params["pwridx"]);
+}
+
+static void keepsSettingsChangedDuringOverride()
+{
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+  lora.setBatteryPolicy(lowSupplyPolicy, 1);
+
+  module.vdd = "2800";
+  CHECK_EQUAL(TX_SUCCESS, lora.txBytes(payload, sizeof(payload)));
+  CHECK_EQUAL(std::string("0"), module.params["dr"]);
+
+  // Kept for later, the policy still wins
+  lora.setDR(2);
+  CHECK_EQUAL(std::string("0"), module.params["dr"]);
+  lora.sendRawCommand("mac set pwridx 2");
+  CHECK_EQUAL(TX_SUCCESS, lora.txBytes(payload, sizeof(payload)));
+  CHECK_EQUAL(std::string("4"), module.params["pwridx"]);
+
+  module.vdd = "3300";
+  delay(1100);
+  CHECK_EQUAL(TX_SUCCESS, lora.txBytes(payload, sizeof(payload)));
+  CHECK_EQUAL(std::string("2"), module.params["dr"]);
+  CHECK_EQUAL(std::string("2"), module.params["pwridx"]);
+}
+
+static void snapshotRefreshesCachedVdd()
+{
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+  lora.setBatteryPolicy(NULL);
+
+  module.vdd = "3100";
+  rn2xx3_snapshot snapshot;
+  lora.snapshot(snapshot);
+  CHECK_EQUAL(3100, lora.cachedVdd());
+
+  int reads = module.count("sys get vdd");
+  CHECK_EQUAL(3100, lora.getVbat());
+  CHECK_EQUAL(reads, module.count("sys get vdd"));
+}
+
+static void defersOnlyExpensiveUplinks()
+{
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+  rn2xx3_battery_policy policy = neutral;
+  policy.defer = true;
+  policy.maxAirtime = 100;
+  usePolicy(lora, policy);
+
+  uint8_t large[100] = {0};
+  CHECK(lora.timeOnAir(sizeof(payload)) <= 100);
+  CHECK(lora.timeOnAir(sizeof(large)) > 100);
+
+  CHECK_EQUAL(TX_DEFERRED, lora.txBytes(payload, sizeof(payload), 1, true));
+  CHECK_EQUAL(TX_DEFERRED, lora.txBytes(large, sizeof(large)));
+  CHECK_EQUAL(0, module.count("mac tx"));
+  CHECK_EQUAL(TX_SUCCESS, lora.txBytes(payload, sizeof(payload)));
+  CHECK_EQUAL(1, module.count("mac tx uncnf"));
+}
+
+static void reportKeepsDeferredUplinkDue()
+{
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+  rn2xx3_metric metrics[1];
+  rn2xx3_report_filter filter(metrics, 1);
+  filter.set(0, 5);
+
+  rn2xx3_battery_policy policy = neutral;
+  policy.defer = true;
+  usePolicy(lora, policy);
+  CHECK_EQUAL(TX_DEFERRED, lora.report(filter, payload, sizeof(payload), 1, true));
+  CHECK(filter.due());
+
+  // Sent unconfirmed, so the network did not acknowledge it
+  policy.unconfirmed = true;
+  usePolicy(lora, policy);
+  CHECK_EQUAL(TX_SUCCESS, lora.report(filter, payload, sizeof(payload), 1, true));
+  CHECK_EQUAL(1, module.count("mac tx uncnf 1 42"));
+  CHECK(!filter.due());
+  CHECK(!filter.acknowledged());
+}
+
+static void seriesKeepsDeferredSamples()
+{
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+  uint8_t buffer[32];
+  rn2xx3_series series(lora, 2, 1, buffer, sizeof(buffer));
+  int32_t value = 20;
+  CHECK(series.add(0, &value));
+  CHECK(series.add(10, &value));
+
+  rn2xx3_battery_policy policy = neutral;
+  policy.defer = true;
+  policy.maxAirtime = 1;
+  usePolicy(lora, policy);
+  CHECK_EQUAL(TX_DEFERRED, series.send());
+  CHECK_EQUAL(2, series.samples());
+
+  usePolicy(lora, neutral);
+  CHECK_EQUAL(TX_SUCCESS, series.send());
+  CHECK_EQUAL(0, series.samples());
+}
+
+static void fragmenterRetriesDeferredFragment()
+{
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+  rn2xx3_fragmenter fragmenter(lora, 5);
+  CHECK(fragmenter.begin(100, readBlob, 20));
+
+  rn2xx3_battery_policy policy = neutral;
+  policy.defer = true;
+  policy.maxAirtime = 1;
+  usePolicy(lora, policy);
+  CHECK_EQUAL(FRAGMENT_WAITING, fragmenter.poll());
+  CHECK_EQUAL(0, fragmenter.sent());
+
+  usePolicy(lora, neutral);
+  CHECK_EQUAL(FRAGMENT_SENT, fragmenter.poll());
+  CHECK_EQUAL(1, fragmenter.sent());
+  CHECK_EQUAL(1, module.count("mac tx uncnf 5"));
+}
+
+int main()
+{
+  RUN(runsOnlyForUplinks);
+  RUN(restoresSettingsWhenSupplyRecovers);
+  RUN(keepsSettingsChangedDuringOverride);
+  RUN(snapshotRefreshesCachedVdd);
+  RUN(defersOnlyExpensiveUplinks);
+  RUN(reportKeepsDeferredUplinkDue);
+  RUN(seriesKeepsDeferredSamples);
+  RUN(fragmenterRetriesDeferredFragment);
+  return testResult();
+}
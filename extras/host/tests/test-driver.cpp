@@ -0,0 +1,165 @@
+/*
+ * The rn2xx3 driver against a fake module: joining, uplinks and downlinks.
+ */
+
+#include <rn2xx3.h>
+
+#include "rn2xx3_test.h"
+
+static void joinsOtaaWithHardwareEui()
+{
+  fake_module module;
+  rn2xx3 lora(module);
+  CHECK(lora.initOTAA(TEST_APPEUI, TEST_APPKEY));
+  CHECK(module.joined);
+  CHECK_EQUAL(1, module.count("mac join otaa"));
+  CHECK_EQUAL(std::string("0004A30B001A2B3C"), module.params["deveui"]);
+  CHECK_EQUAL(std::string(TEST_APPEUI), module.params["appeui"]);
+}
+
+static void joinsAbp()
+{
+  fake_module module;
+  rn2xx3 lora(module);
+  CHECK(lora.initABP(TEST_DEVADDR, TEST_APPSKEY, TEST_NWKSKEY));
+  CHECK_EQUAL(std::string(TEST_DEVADDR), module.params["devaddr"]);
+  CHECK_EQUAL(1, module.count("mac join abp"));
+}
+
+static void sendsUplinks()
+{
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+
+  const uint8_t payload[] = {0x01, 0x02, 0xAB};
+  CHECK_EQUAL(TX_SUCCESS, lora.txBytes(payload, sizeof(payload), 7));
+  CHECK_EQUAL(1, module.count("mac tx uncnf 7 0102AB"));
+  CHECK_EQUAL(TX_SUCCESS, lora.txBytes(payload, sizeof(payload), 7, true));
+  CHECK_EQUAL(1, module.count("mac tx cnf 7 0102AB"));
+  CHECK_EQUAL(std::string("2"), module.params["upctr"]);
+}
+
+static void receivesBinaryDownlinks()
+{
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+
+  const uint8_t payload[] = {0x01};
+  module.reply("ok", "mac_rx 42 00FF00ab");
+  CHECK_EQUAL(TX_WITH_RX, lora.txBytes(payload, sizeof(payload)));
+
+  uint8_t downlink[8];
+  uint8_t port = 0;
+  CHECK_EQUAL((size_t)4, lora.getRxBytes(downlink, sizeof(downlink), &port));
+  CHECK_EQUAL(42, port);
+  CHECK_EQUAL(0x00, downlink[0]);
+  CHECK_EQUAL(0xFF, downlink[1]);
+  CHECK_EQUAL(0x00, downlink[2]);
+  CHECK_EQUAL(0xAB, downlink[3]);
+  // Built from the bytes, in the case the module uses
+  CHECK_EQUAL(String("00FF00AB"), lora.getRx());
+
+  // A downlink without payload, only the port
+  module.reply("ok", "mac_rx 3");
+  CHECK_EQUAL(TX_WITH_RX, lora.txBytes(payload, sizeof(payload)));
+  CHECK_EQUAL((size_t)0, lora.getRxBytes(downlink, sizeof(downlink), &port));
+  CHECK_EQUAL(3, port);
+}
+
+static void keepsUnsolicitedDownlinks()
+{
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+
+  module.send("mac_rx 7 CAFE");
+  CHECK(lora.poll());
+  uint8_t downlink[8];
+  uint8_t port = 0;
+  CHECK_EQUAL((size_t)2, lora.getRxBytes(downlink, sizeof(downlink), &port));
+  CHECK_EQUAL(7, port);
+  CHECK_EQUAL(0xCA, downlink[0]);
+  CHECK_EQUAL(0xFE, downlink[1]);
+
+  // Only as much as the caller has room for
+  CHECK_EQUAL((size_t)1, lora.getRxBytes(downlink, 1));
+  CHECK(!lora.poll());
+}
+
+static void cutsOffLongDownlinks()
+{
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+
+  std::string hex;
+  for (int i = 0; i < RN2XX3_RX_MAX + 10; i++)
+  {
+    hex += "5A";
+  }
+  module.reply("ok", "mac_rx 1 " + hex);
+  const uint8_t payload[] = {0x01};
+  CHECK_EQUAL(TX_WITH_RX, lora.txBytes(payload, sizeof(payload)));
+
+  uint8_t downlink[RN2XX3_RX_MAX + 10];
+  CHECK_EQUAL((size_t)RN2XX3_RX_MAX, lora.getRxBytes(downlink, sizeof(downlink)));
+  CHECK_EQUAL(0x5A, downlink[RN2XX3_RX_MAX - 1]);
+}
+
+static void initResumesSessionWithCustomDevEui()
+{
+  fake_module module;
+  rn2xx3 lora(module);
+  CHECK(lora.initOTAA(TEST_APPEUI, TEST_APPKEY, "0102030405060708"));
+  CHECK_EQUAL(std::string("0102030405060708"), module.params["deveui"]);
+
+  // The recovery path runs init(), which should find the session intact
+  CHECK(lora.init());
+  CHECK_EQUAL(1, module.count("mac join"));
+  CHECK_EQUAL(1, module.count("mac reset"));
+}
+
+static void keepsIdentityAcrossModuleReboot()
+{
+  test_storage storage;
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.setIdentityStorage(storage, 0);
+  CHECK(lora.initOTAA(TEST_APPEUI, TEST_APPKEY));
+  CHECK_EQUAL(1, module.count("sys get hweui"));
+  int writes = storage.writes;
+
+  // The same module reboots: its version is read again, nothing else
+  module.send("RN2483 1.0.5 Oct 31 2018 15:06:52");
+  lora.poll();
+  CHECK(lora.hasFeature(FEATURE_CLASS_C));
+  CHECK_EQUAL(2, module.count("sys get ver"));
+  CHECK_EQUAL(writes, storage.writes);
+
+  // The session made with the hardware EUI is resumed without reading it
+  CHECK(lora.init());
+  CHECK_EQUAL(1, module.count("sys get hweui"));
+  CHECK_EQUAL(1, module.count("mac join"));
+
+  // Another firmware can be another module
+  module.version = "RN2483 1.0.4 Oct 12 2017 14:59:25";
+  module.send(module.version);
+  lora.poll();
+  CHECK(!lora.hasFeature(FEATURE_CLASS_C));
+  CHECK_EQUAL(writes + 1, storage.writes);
+}
+
+int main()
+{
+  RUN(joinsOtaaWithHardwareEui);
+  RUN(joinsAbp);
+  RUN(sendsUplinks);
+  RUN(receivesBinaryDownlinks);
+  RUN(keepsUnsolicitedDownlinks);
+  RUN(cutsOffLongDownlinks);
+  RUN(initResumesSessionWithCustomDevEui);
+  RUN(keepsIdentityAcrossModuleReboot);
+  return testResult();
+}
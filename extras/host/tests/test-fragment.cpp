@@ -0,0 +1,150 @@
+/*
+ * Fragmented transfers: rn2xx3_fragmenter encodes a blob, and
+ * rn2xx3_reassembler puts it back together from what arrives, with and
+ * without coded fragments.
+ */
+
+#include <rn2xx3_fragment.h>
+
+#include "rn2xx3_test.h"
+
+static std::vector<uint8_t> blob;
+static std::vector<uint8_t> received;
+
+static size_t readBlob(uint32_t offset, uint8_t* buf, size_t length)
+{
+  if (offset >= blob.size())
+  {
+    return 0;
+  }
+  size_t n = blob.size() - offset < length ? blob.size() - offset : length;
+  memcpy(buf, &blob[offset], n);
+  return n;
+}
+
+static bool writeReceived(uint32_t offset, const uint8_t* data, size_t length)
+{
+  if (offset + length > received.size())
+  {
+    return false;
+  }
+  memcpy(&received[offset], data, length);
+  return true;
+}
+
+static bool readReceived(uint32_t offset, uint8_t* data, size_t length)
+{
+  if (offset + length > received.size())
+  {
+    return false;
+  }
+  memcpy(data, &received[offset], length);
+  return true;
+}
+
+// Leave garbage on the stack, where the next call has its buffers
+static void dirtyStack()
+{
+  volatile uint8_t garbage[4096];
+  for (size_t i = 0; i < sizeof(garbage); i++)
+  {
+    garbage[i] = 0xFF;
+  }
+}
+
+static std::vector<std::vector<uint8_t> > encode(uint32_t size, uint8_t fragmentSize, uint8_t redundancy)
+{
+  blob.resize(size);
+  for (uint32_t i = 0; i < size; i++)
+  {
+    blob[i] = (uint8_t)(i * 7 + 3);
+  }
+
+  fake_module module;
+  rn2xx3 lora(module);
+  rn2xx3_fragmenter fragmenter(lora, 10);
+  fragmenter.setRedundancy(redundancy);
+  CHECK(fragmenter.begin(size, readBlob, fragmentSize));
+
+  std::vector<std::vector<uint8_t> > frames;
+  for (uint16_t i = 0; i < fragmenter.count() + fragmenter.coded(); i++)
+  {
+    std::vector<uint8_t> frame(fragmentSize);
+    frame.resize(fragmenter.fragment(i, frame.data()));
+    frames.push_back(frame);
+  }
+  return frames;
+}
+
+static void reassemblesInAnyOrder()
+{
+  std::vector<std::vector<uint8_t> > frames = encode(1000, 51, 0);
+  CHECK_EQUAL((size_t)22, frames.size());
+
+  uint8_t bitmap[4];
+  rn2xx3_reassembler reassembler(writeReceived, bitmap, sizeof(bitmap), 51);
+  received.assign(frames.size() * 51, 0);
+
+  RN2xx3_reassembly_status status = REASSEMBLY_PROGRESS;
+  for (size_t i = frames.size(); i-- > 0;)
+  {
+    status = reassembler.add(frames[i].data(), frames[i].size());
+  }
+  CHECK_EQUAL(REASSEMBLY_COMPLETE, status);
+  CHECK_EQUAL(REASSEMBLY_DUPLICATE, reassembler.add(frames[3].data(), frames[3].size()));
+  CHECK_EQUAL(1000u, reassembler.size());
+  CHECK(memcmp(received.data(), blob.data(), blob.size()) == 0);
+}
+
+static void recoversLostFragmentsFromCodedOnes()
+{
+  std::vector<std::vector<uint8_t> > frames = encode(1000, 51, 50);
+  uint16_t count = 22;
+  CHECK_EQUAL((size_t)count + 11, frames.size());
+
+  uint8_t bitmap[(33 + 7) / 8];
+  uint8_t matrix[33 * ((33 + 7) / 8)];
+  rn2xx3_reassembler reassembler(writeReceived, bitmap, sizeof(bitmap));
+  reassembler.setCoding(matrix, sizeof(matrix), readReceived);
+  received.assign(frames.size() * 51, 0);
+
+  // Lose every third fragment
+  RN2xx3_reassembly_status status = REASSEMBLY_PROGRESS;
+  for (size_t i = 0; i < frames.size() && status != REASSEMBLY_COMPLETE; i++)
+  {
+    if (i % 3 != 1)
+    {
+      dirtyStack();
+      status = reassembler.add(frames[i].data(), frames[i].size());
+      CHECK(status != REASSEMBLY_INVALID);
+
+      // Bits past count in a row of the matrix are never set
+      for (uint16_t row = 0; row < count; row++)
+      {
+        CHECK_EQUAL(0, matrix[row * 3 + 2] & 0xC0);
+      }
+    }
+  }
+  CHECK_EQUAL(REASSEMBLY_COMPLETE, status);
+  CHECK_EQUAL(1000u, reassembler.size());
+  CHECK(memcmp(received.data(), blob.data(), blob.size()) == 0);
+}
+
+static void rejectsCodedFragmentsOfHugeBlobs()
+{
+  uint16_t count = RN2XX3_FRAGMENT_MAX_CODED + 1;
+  uint8_t frame[8] = {1, (uint8_t)(count >> 4), (uint8_t)((count & 0x0F) << 4 | count >> 8), (uint8_t)count};
+  static uint8_t bitmap[(RN2XX3_FRAGMENT_MAX_COUNT + 7) / 8];
+  static uint8_t matrix[1];
+  rn2xx3_reassembler reassembler(writeReceived, bitmap, sizeof(bitmap));
+  reassembler.setCoding(matrix, (size_t)-1, readReceived);
+  CHECK_EQUAL(REASSEMBLY_INVALID, reassembler.add(frame, sizeof(frame)));
+}
+
+int main()
+{
+  RUN(reassemblesInAnyOrder);
+  RUN(recoversLostFragmentsFromCodedOnes);
+  RUN(rejectsCodedFragmentsOfHugeBlobs);
+  return testResult();
+}
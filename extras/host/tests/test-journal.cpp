@@ -0,0 +1,190 @@
+/*
+ * rn2xx3_journal on its own, and uplinks the library keeps in it while
+ * the module can not join.
+ */
+
+#include <rn2xx3.h>
+
+#include "rn2xx3_test.h"
+
+// The first uplink the module got from command number from on
+static std::string firstUplink(fake_module& module, size_t from)
+{
+  for (size_t i = from; i < module.commands.size(); i++)
+  {
+    if (module.commands[i].compare(0, 6, "mac tx") == 0)
+    {
+      return module.commands[i];
+    }
+  }
+  return "";
+}
+
+static void keepsRecordsAcrossRestarts()
+{
+  test_storage storage;
+  {
+    rn2xx3_journal journal(storage, 16, 4, 24);
+    journal.begin();
+    const uint8_t first[] = {1, 2, 3};
+    const uint8_t second[] = {4, 5};
+    CHECK(journal.push(first, sizeof(first), 10));
+    CHECK(journal.push(second, sizeof(second), 11, 2, true));
+    CHECK_EQUAL(2, journal.pending());
+  }
+
+  rn2xx3_journal journal(storage, 16, 4, 24);
+  journal.begin();
+  CHECK_EQUAL(2, journal.pending());
+
+  // The higher priority record comes first
+  rn2xx3_journal_record record;
+  uint8_t payload[24];
+  CHECK(journal.peek(record, payload, sizeof(payload)));
+  CHECK_EQUAL(11, record.port);
+  CHECK_EQUAL(2, record.size);
+  CHECK(record.confirmed);
+  CHECK_EQUAL(4, payload[0]);
+  CHECK(journal.drop(record));
+  CHECK(journal.peek(record, payload, sizeof(payload)));
+  CHECK_EQUAL(10, record.port);
+  CHECK_EQUAL(3, record.size);
+}
+
+static void skipsCorruptRecords()
+{
+  test_storage storage;
+  {
+    rn2xx3_journal journal(storage, 0, 4, 24);
+    journal.begin();
+    const uint8_t data[] = {1, 2, 3};
+    journal.push(data, sizeof(data));
+    journal.push(data, sizeof(data));
+  }
+  // Flip a payload bit of the first slot
+  storage.data[11] ^= 0x01;
+
+  rn2xx3_journal journal(storage, 0, 4, 24);
+  journal.begin();
+  CHECK_EQUAL(1, journal.pending());
+}
+
+static void keepsUplinksWhileNotJoined()
+{
+  test_storage storage;
+  rn2xx3_journal journal(storage, 0, 4, 24);
+  journal.begin();
+
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+  lora.setJournal(journal);
+
+  module.joined = false;
+  module.joinReply = "denied";
+  const uint8_t payload[] = {0xAB, 0xCD};
+  CHECK_EQUAL(TX_FAIL, lora.txBytes(payload, sizeof(payload), 5));
+  CHECK_EQUAL(1, journal.pending());
+
+  // The next uplink that goes through sends the kept one as well
+  module.joinReply = "accepted";
+  CHECK_EQUAL(TX_SUCCESS, lora.txBytes(payload, 1, 6));
+  CHECK_EQUAL(0, journal.pending());
+  CHECK_EQUAL(2, module.count("mac tx uncnf 5 ABCD"));
+}
+
+static void journalsWithCallerPriority()
+{
+  test_storage storage;
+  rn2xx3_journal journal(storage, 0, 4, 24);
+  journal.begin();
+
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+  lora.setJournal(journal, 0);
+  module.joined = false;
+  module.joinReply = "denied";
+
+  const uint8_t routine[] = {0x01};
+  const uint8_t alarm[] = {0xA1};
+  CHECK_EQUAL(TX_FAIL, lora.txBytes(routine, sizeof(routine), 5));
+  CHECK_EQUAL(TX_FAIL, lora.txBytes(alarm, sizeof(alarm), 6, false, 3));
+
+  rn2xx3_journal_record record;
+  uint8_t payload[24];
+  CHECK(journal.peek(record, payload, sizeof(payload)));
+  CHECK_EQUAL(6, record.port);
+  CHECK_EQUAL(3, record.priority);
+
+  // The alarm goes out first, although it was made last
+  module.joinReply = "accepted";
+  lora.init();
+  size_t first = module.commands.size();
+  CHECK_EQUAL(2, lora.drainJournal());
+  CHECK_EQUAL(std::string("mac tx uncnf 6 A1"), firstUplink(module, first));
+}
+
+static void drainsAfterDownlink()
+{
+  test_storage storage;
+  rn2xx3_journal journal(storage, 0, 4, 24);
+  journal.begin();
+
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+  lora.setJournal(journal);
+  module.joined = false;
+  module.joinReply = "denied";
+  const uint8_t kept[] = {0xAB};
+  CHECK_EQUAL(TX_FAIL, lora.txBytes(kept, sizeof(kept), 5));
+  CHECK_EQUAL(1, journal.pending());
+
+  // The downlink shows the link works, and stays readable
+  module.joinReply = "accepted";
+  module.reply("ok", "mac_rx 2 BEEF");
+  const uint8_t payload[] = {0x01};
+  CHECK_EQUAL(TX_WITH_RX, lora.txBytes(payload, sizeof(payload), 6));
+  CHECK_EQUAL(String("BEEF"), lora.getRx());
+
+  // The kept uplink goes out before the next one
+  size_t first = module.commands.size();
+  CHECK_EQUAL(TX_SUCCESS, lora.txBytes(payload, sizeof(payload), 6));
+  CHECK_EQUAL(0, journal.pending());
+  CHECK_EQUAL(std::string("mac tx uncnf 5 AB"), firstUplink(module, first));
+}
+
+static void rejectsOversizedUplinks()
+{
+  test_storage storage;
+  rn2xx3_journal journal(storage, 0, 4, 24);
+  journal.begin();
+
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+  lora.setJournal(journal);
+  module.joined = false;
+  module.joinReply = "denied";
+
+  // 260 bytes would wrap around to 4 as an uint8_t, which fits a slot
+  String data;
+  for (int i = 0; i < 260; i++)
+  {
+    data += "00";
+  }
+  CHECK_EQUAL(TX_FAIL, lora.txCommand("mac tx uncnf 1 ", data, false));
+  CHECK_EQUAL(0, journal.pending());
+}
+
+int main()
+{
+  RUN(keepsRecordsAcrossRestarts);
+  RUN(skipsCorruptRecords);
+  RUN(keepsUplinksWhileNotJoined);
+  RUN(journalsWithCallerPriority);
+  RUN(drainsAfterDownlink);
+  RUN(rejectsOversizedUplinks);
+  return testResult();
+}
@@ -0,0 +1,99 @@
+/*
+ * The rn2xx3 driver over rn2xx3_posix, with the fake module behind a
+ * pseudo terminal in its own thread, like a module on /dev/ttyUSB0.
+ */
+
+#include <rn2xx3.h>
+#include <rn2xx3_posix.h>
+
+#include "rn2xx3_test.h"
+
+#include <atomic>
+#include <fcntl.h>
+#include <poll.h>
+#include <thread>
+#include <unistd.h>
+
+class pty_module
+{
+  public:
+    pty_module():
+    _stop(false)
+    {
+      _master = rn2xx3_posix::openPseudoTerminal(path, sizeof(path));
+      _thread = std::thread(&pty_module::serve, this);
+    }
+
+    ~pty_module()
+    {
+      _stop = true;
+      _thread.join();
+      close(_master);
+    }
+
+    char path[64];
+    fake_module module;
+
+  private:
+    int _master;
+    std::atomic<bool> _stop;
+    std::thread _thread;
+
+    void serve()
+    {
+      std::string line;
+      while (!_stop)
+      {
+        struct pollfd fd = {_master, POLLIN, 0};
+        char c;
+        if (poll(&fd, 1, 10) <= 0 || ::read(_master, &c, 1) != 1)
+        {
+          continue;
+        }
+        if (c != '\n')
+        {
+          line += c;
+          continue;
+        }
+        if (!line.empty() && line[line.size() - 1] == '\r')
+        {
+          line.erase(line.size() - 1);
+        }
+        std::vector<std::string> lines = module.answer(line);
+        line.clear();
+        for (size_t i = 0; i < lines.size(); i++)
+        {
+          std::string reply = lines[i] + "\r\n";
+          if (::write(_master, reply.data(), reply.size()) != (ssize_t)reply.size())
+          {
+            return;
+          }
+        }
+      }
+    }
+};
+
+static void talksOverPseudoTerminal()
+{
+  pty_module pty;
+  rn2xx3_posix serial;
+  if (!CHECK(serial.begin(pty.path)))
+  {
+    return;
+  }
+
+  rn2xx3 lora(serial);
+  CHECK_EQUAL(String("0004A30B001A2B3C"), lora.hweui());
+  CHECK(lora.initOTAA(TEST_APPEUI, TEST_APPKEY));
+
+  const uint8_t payload[] = {0xCA, 0xFE};
+  CHECK_EQUAL(TX_SUCCESS, lora.txBytes(payload, sizeof(payload)));
+  serial.end();
+  CHECK_EQUAL(1, pty.module.count("mac tx uncnf 1 CAFE"));
+}
+
+int main()
+{
+  RUN(talksOverPseudoTerminal);
+  return testResult();
+}
@@ -0,0 +1,157 @@
+/*
+ * The recovery ladder of txCommand(): every fault is resolved by the
+ * cheapest step that works, and a fault that comes back escalates.
+ */
+
+#include <rn2xx3.h>
+
+#include "rn2xx3_test.h"
+
+static const uint8_t payload[] = {0x42};
+
+static void resumesPausedMac()
+{
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+
+  module.reply("mac_paused");
+  CHECK_EQUAL(TX_SUCCESS, lora.txBytes(payload, sizeof(payload)));
+  CHECK_EQUAL(1, module.count("mac resume"));
+  CHECK_EQUAL(RECOVERY_RESUME, lora.lastRecovery());
+  CHECK_EQUAL(1, module.count("mac reset"));
+}
+
+static void resyncsAfterUnknownReply()
+{
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+
+  module.reply("ok", "garbage");
+  CHECK_EQUAL(TX_SUCCESS, lora.txBytes(payload, sizeof(payload)));
+  CHECK_EQUAL(RECOVERY_RESYNC, lora.lastRecovery());
+  CHECK_EQUAL(1, module.count("mac join"));
+}
+
+static void rejoinsWhenNotJoined()
+{
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+
+  module.joined = false;
+  CHECK_EQUAL(TX_SUCCESS, lora.txBytes(payload, sizeof(payload)));
+  CHECK_EQUAL(RECOVERY_REJOIN, lora.lastRecovery());
+  CHECK_EQUAL(2, module.count("mac join otaa"));
+  CHECK_EQUAL(1, module.count("mac reset"));
+}
+
+static void enablesSilencedModule()
+{
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+
+  // Waiting does not end the silent state, "mac forceENABLE" does
+  module.silenced = true;
+  CHECK_EQUAL(TX_SUCCESS, lora.txBytes(payload, sizeof(payload)));
+  CHECK_EQUAL(RECOVERY_ENABLE, lora.lastRecovery());
+  CHECK_EQUAL(1, module.count("mac forceENABLE"));
+  CHECK_EQUAL(3, module.count("mac tx"));
+  CHECK_EQUAL(1, module.count("mac reset"));
+}
+
+static void reinitsStaySilentModule()
+{
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+
+  module.reply("silent");
+  module.reply("silent");
+  module.reply("silent");
+  CHECK_EQUAL(TX_SUCCESS, lora.txBytes(payload, sizeof(payload)));
+  CHECK_EQUAL(RECOVERY_REINIT, lora.lastRecovery());
+  CHECK_EQUAL(4, module.count("mac tx"));
+  CHECK_EQUAL(2, module.count("mac reset"));
+
+  const rn2xx3_recovery_stats& stats = lora.getRecoveryStats();
+  CHECK_EQUAL(1, stats.resolved[RECOVERY_REINIT]);
+  CHECK_EQUAL(0, stats.unresolved);
+}
+
+static void resetsAfterRadioError()
+{
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+
+  module.reply("ok", "radio_err");
+  CHECK_EQUAL(TX_SUCCESS, lora.txBytes(payload, sizeof(payload)));
+  CHECK_EQUAL(RECOVERY_REINIT, lora.lastRecovery());
+  CHECK_EQUAL(2, module.count("mac reset"));
+  CHECK_EQUAL(2, module.count("mac join otaa"));
+}
+
+static void failsWhenResetDoesNotHelp()
+{
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+
+  for (int i = 0; i < 10; i++)
+  {
+    module.reply("mac_paused");
+  }
+  CHECK_EQUAL(TX_FAIL, lora.txBytes(payload, sizeof(payload)));
+
+  // Resume, then reset, then give up instead of retrying blindly
+  CHECK_EQUAL(1, module.count("mac resume"));
+  CHECK_EQUAL(2, module.count("mac reset"));
+  CHECK_EQUAL(3, module.count("mac tx"));
+  CHECK_EQUAL(RECOVERY_REINIT, lora.lastRecovery());
+
+  const rn2xx3_recovery_stats& stats = lora.getRecoveryStats();
+  CHECK_EQUAL(0, stats.resolved[RECOVERY_REINIT]);
+  CHECK_EQUAL(1, stats.unresolved);
+}
+
+static void resetsAbpSessionAfterFrameCounterError()
+{
+  test_storage storage;
+  fake_module module;
+  rn2xx3 lora(module);
+  lora.setFrameCounterStorage(storage, 0);
+  lora.initABP(TEST_DEVADDR, TEST_APPSKEY, TEST_NWKSKEY);
+  module.params["upctr"] = "4294967295";
+  CHECK_EQUAL(1, module.count("mac reset"));
+
+  // Joining again would keep the exhausted counter, and resuming the
+  // stored counters would bring it back
+  module.reply("frame_counter_err_rejoin_needed");
+  CHECK_EQUAL(TX_SUCCESS, lora.txBytes(payload, sizeof(payload)));
+  CHECK_EQUAL(RECOVERY_REINIT, lora.lastRecovery());
+  CHECK_EQUAL(2, module.count("mac reset"));
+  CHECK_EQUAL(std::string("1"), module.params["upctr"]);
+
+  // The new counters were stored, a restart continues with them
+  fake_module restarted;
+  rn2xx3 again(restarted);
+  again.setFrameCounterStorage(storage, 0);
+  again.initABP(TEST_DEVADDR, TEST_APPSKEY, TEST_NWKSKEY);
+  CHECK_EQUAL(std::string("16"), restarted.params["upctr"]);
+}
+
+int main()
+{
+  RUN(resumesPausedMac);
+  RUN(resyncsAfterUnknownReply);
+  RUN(rejoinsWhenNotJoined);
+  RUN(enablesSilencedModule);
+  RUN(reinitsStaySilentModule);
+  RUN(resetsAfterRadioError);
+  RUN(failsWhenResetDoesNotHelp);
+  RUN(resetsAbpSessionAfterFrameCounterError);
+  return testResult();
+}
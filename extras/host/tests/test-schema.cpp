@@ -0,0 +1,92 @@
+/*
+ * rn2xx3_schema: field sizes, exact integer steps, rounding and clamping
+ * of floating point values, and the generated decoder.
+ */
+
+#include <rn2xx3_schema.h>
+
+#include "rn2xx3_test.h"
+
+#include <math.h>
+
+typedef rn2xx3_field<-90, 90, 50000> Latitude;
+typedef rn2xx3_field<-180, 180, 50000> Longitude;
+typedef rn2xx3_field<-500, 9000> Altitude;
+typedef rn2xx3_field<0, 25, 10> Hdop;
+typedef rn2xx3_schema<Latitude, Longitude, Altitude, Hdop> MapperPayload;
+
+static void packsFieldsInFewestBits()
+{
+  // Constants by value, they have no definition to bind a reference to
+  CHECK_EQUAL(24, (int)Latitude::bits);
+  CHECK_EQUAL(25, (int)Longitude::bits);
+  CHECK_EQUAL(14, (int)Altitude::bits);
+  CHECK_EQUAL(8, (int)Hdop::bits);
+  CHECK_EQUAL(71, (int)MapperPayload::bits);
+  CHECK_EQUAL(9, (int)MapperPayload::size);
+}
+
+static void encodesStepsExactly()
+{
+  const int32_t longitudes[] = {-180 * 50000, -8956789, -1, 0, 1, 8956789, 180 * 50000};
+  uint8_t payload[MapperPayload::size];
+  for (size_t i = 0; i < sizeof(longitudes) / sizeof(longitudes[0]); i++)
+  {
+    MapperPayload::encodeSteps(payload, 2598765, longitudes[i], 123, 17);
+    CHECK_EQUAL(2598765, MapperPayload::getSteps<0>(payload));
+    CHECK_EQUAL(longitudes[i], MapperPayload::getSteps<1>(payload));
+    CHECK_EQUAL(123, MapperPayload::getSteps<2>(payload));
+    CHECK_EQUAL(17, MapperPayload::getSteps<3>(payload));
+  }
+
+  // Out of range steps are clamped
+  MapperPayload::encodeSteps(payload, -5000000, 9000001, -501, 300);
+  CHECK_EQUAL(-90 * 50000, MapperPayload::getSteps<0>(payload));
+  CHECK_EQUAL(180 * 50000, MapperPayload::getSteps<1>(payload));
+  CHECK_EQUAL(-500, MapperPayload::getSteps<2>(payload));
+  CHECK_EQUAL(250, MapperPayload::getSteps<3>(payload));
+}
+
+static void roundsValuesToNearestStep()
+{
+  uint8_t payload[MapperPayload::size];
+  MapperPayload::encode(payload, 51.987654, -179.123457, 8848.4, 1.26);
+  CHECK_EQUAL(2599383, MapperPayload::getSteps<0>(payload));
+  CHECK_EQUAL(-8956173, MapperPayload::getSteps<1>(payload));
+  CHECK_EQUAL(8848, MapperPayload::getSteps<2>(payload));
+  CHECK_EQUAL(13, MapperPayload::getSteps<3>(payload));
+  CHECK(fabs(MapperPayload::get<1>(payload) - -179.12346) < 1e-9);
+
+  // Scaling the whole value as a float would lose steps up here
+  for (int32_t steps = 8999000; steps <= 9000000; steps += 37)
+  {
+    MapperPayload::set<1>(payload, steps / 50000.0);
+    CHECK_EQUAL(steps, MapperPayload::getSteps<1>(payload));
+  }
+
+  MapperPayload::encode(payload, -91.0, 181.0, 10000.0, -1.0);
+  CHECK_EQUAL(-90.0, MapperPayload::get<0>(payload));
+  CHECK_EQUAL(180.0, MapperPayload::get<1>(payload));
+  CHECK_EQUAL(9000.0, MapperPayload::get<2>(payload));
+  CHECK_EQUAL(0.0, MapperPayload::get<3>(payload));
+}
+
+static void printsMatchingDecoder()
+{
+  const char* const names[] = {"latitude", "longitude", "altitude", "hdop"};
+  test_buffer out;
+  MapperPayload::printDecoder(out, names);
+  String decoder = out.readString();
+  CHECK(decoder.indexOf("if (b.length < 9)") >= 0);
+  CHECK(decoder.indexOf("longitude: bits(24, 25) / 50000 + (-180),") >= 0);
+  CHECK(decoder.indexOf("hdop: bits(63, 8) / 10 + (0)\r\n") >= 0);
+}
+
+int main()
+{
+  RUN(packsFieldsInFewestBits);
+  RUN(encodesStepsExactly);
+  RUN(roundsValuesToNearestStep);
+  RUN(printsMatchingDecoder);
+  return testResult();
+}
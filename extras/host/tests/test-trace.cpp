@@ -0,0 +1,54 @@
+/*
+ * A session with the fake module is recorded with rn2xx3_trace and played
+ * back with rn2xx3_replay, which should give the library the same answers.
+ */
+
+#include <rn2xx3.h>
+#include <rn2xx3_trace.h>
+
+#include "rn2xx3_test.h"
+
+static void session(rn2xx3& lora, TX_RETURN_TYPE results[2])
+{
+  const uint8_t payload[] = {0x10, 0x20};
+  lora.initOTAA(TEST_APPEUI, TEST_APPKEY);
+  results[0] = lora.txBytes(payload, sizeof(payload));
+  results[1] = lora.txBytes(payload, sizeof(payload), 2, true);
+}
+
+static void replaysRecordedSession()
+{
+  fake_module module;
+  module.reply("ok", "mac_rx 1 BEEF");
+  module.reply("ok", "mac_err");
+  module.reply("ok", "mac_tx_ok");
+
+  test_buffer recording;
+  rn2xx3_trace trace(module, recording);
+  TX_RETURN_TYPE recorded[2];
+  {
+    rn2xx3 lora(trace);
+    session(lora, recorded);
+  }
+  CHECK_EQUAL(TX_WITH_RX, recorded[0]);
+  CHECK_EQUAL(TX_SUCCESS, recorded[1]);
+  CHECK(trace.linesSent() > 0);
+
+  rn2xx3_replay replay(recording);
+  replay.setTimeScale(0);
+  TX_RETURN_TYPE replayed[2];
+  rn2xx3 lora(replay);
+  session(lora, replayed);
+  CHECK_EQUAL(recorded[0], replayed[0]);
+  CHECK_EQUAL(recorded[1], replayed[1]);
+  CHECK_EQUAL(String("BEEF"), lora.getRx());
+  CHECK(replay.finished());
+  CHECK_EQUAL(trace.linesSent(), replay.commands());
+  CHECK_EQUAL(0UL, replay.mismatches());
+}
+
+int main()
+{
+  RUN(replaysRecordedSession);
+  return testResult();
+}
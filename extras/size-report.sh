@@ -0,0 +1,71 @@
+#!/bin/sh
+#
+# Show what each optional part of the library (see src/rn2xx3_config.h)
+# costs in flash and RAM, on the example boards the CI builds.
+#
+# Usage: extras/size-report.sh [example ...]
+#
+# Run it from the root of the repository. It needs PlatformIO, and the
+# extra libraries of the examples installed with "pio lib install".
+# Without arguments all examples of .github/workflows/platformio.yml are
+# built. A part the example needs can not be disabled, and shows as "-".
+# Optional parts are disabled by default, they show what enabling costs.
+
+FEATURES="RN2XX3_OTAA RN2XX3_ABP RN2XX3_DOWNLINK RN2XX3_STRING_HELPERS
+RN2XX3_PLAN_SINGLE_CHANNEL_EU RN2XX3_PLAN_TTN_EU RN2XX3_PLAN_TTN_US RN2XX3_PLAN_DEFAULT_EU"
+OPTIONAL="RN2XX3_LINK_CHECK RN2XX3_JOURNAL RN2XX3_REPORT_FILTER RN2XX3_ENERGY RN2XX3_BATTERY RN2XX3_DIAGNOSTICS"
+
+# Print "<flash> <ram>" in bytes used by example $1 on board $2 with build flags $3
+build()
+{
+  output=$(PLATFORMIO_BUILD_FLAGS="$3" PLATFORMIO_CI_SRC="$1" pio ci --lib=./src --board="$2" 2>&1) || return 1
+  flash=$(echo "$output" | sed -n 's/^Flash:.*(used \([0-9]*\) bytes.*/\1/p')
+  ram=$(echo "$output" | sed -n 's/^RAM:.*(used \([0-9]*\) bytes.*/\1/p')
+  [ -n "$flash" ] && echo "$flash ${ram:-0}"
+}
+
+# The example and board pairs of the CI matrix
+boards=$(awk -F'"' '/- example:/ { example = $2 } /board:/ { print example " " $2 }' .github/workflows/platformio.yml)
+
+echo "| Example | Board | Part | Flash | RAM |"
+echo "|---|---|---|---|---|"
+
+echo "$boards" | while read -r example board
+do
+  if [ $# -gt 0 ]
+  then
+    case " $* " in
+      *" $example "*) ;;
+      *) continue ;;
+    esac
+  fi
+
+  if ! base=$(build "$example" "$board" "")
+  then
+    echo "| $example | $board | (does not build) | | |"
+    continue
+  fi
+  baseFlash=${base% *}
+  baseRam=${base#* }
+  echo "| $example | $board | default | $baseFlash | $baseRam |"
+
+  for feature in $FEATURES
+  do
+    if size=$(build "$example" "$board" "-D$feature=0")
+    then
+      echo "| $example | $board | $feature | $((baseFlash - ${size% *})) | $((baseRam - ${size#* })) |"
+    else
+      echo "| $example | $board | $feature | - | - |"
+    fi
+  done
+
+  for feature in $OPTIONAL
+  do
+    if size=$(build "$example" "$board" "-D$feature=1")
+    then
+      echo "| $example | $board | +$feature | $((${size% *} - baseFlash)) | $((${size#* } - baseRam)) |"
+    else
+      echo "| $example | $board | +$feature | - | - |"
+    fi
+  done
+done
@@ -9,19 +9,157 @@
 
 #include "Arduino.h"
 #include "rn2xx3.h"
+#include "rn2xx3_log.h"
 
 extern "C" {
+#include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
 }
 
+#if RN2XX3_ABP
+static void putUint32(uint8_t* data, uint32_t value)
+{
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    data[i] = value >> (8 * i);
+  }
+}
+
+static uint32_t getUint32(const uint8_t* data)
+{
+  uint32_t value = 0;
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    value |= (uint32_t)data[i] << (8 * i);
+  }
+  return value;
+}
+#endif
+
+// Deadlines in milliseconds
+#define REPLY_TIMEOUT 2000      // Direct reply to a command
+#define SAVE_TIMEOUT 5000       // "mac save" writes to the EEPROM of the module
+#define DEADLINE_MARGIN 1000    // Processing and UART time on top of the airtime
+#define RX2_DELAY 1000          // RX2 opens one second after RX1
+#define JOIN_ACCEPT_DELAY2 6000 // RX2 of a join request
+#define ACK_TIMEOUT 3000        // Longest wait before retransmitting a confirmed uplink
+
+// LoRaWAN overhead on top of the application payload: MHDR, FHDR, FPort and MIC
+#define LORAWAN_OVERHEAD 13
+#define JOIN_REQUEST_SIZE 23
+#define JOIN_ACCEPT_SIZE 33
+#define MAX_DOWNLINK_SIZE 64
+
+// Symbols a receive window stays open without a preamble
+#define RX_WINDOW_SYMBOLS 8
+
+// Link check margins (dB) to step the data rate down below, and up from
+#define LINK_MARGIN_LOW 5
+#define LINK_MARGIN_HIGH 15
+
+/*
+ * Time on air in microseconds of a LoRa packet with an explicit header,
+ * coding rate 4/5 and CRC, or of an FSK packet at 50 kbps if sf is 0.
+ */
+static uint32_t packetAirtime(uint8_t size, uint8_t sf, uint16_t bandwidth)
+{
+  if (sf == 0)
+  {
+    // preamble (5), sync word (3), length (1), payload and CRC (2)
+    return (uint32_t)(size + 11) * 8 * 20;
+  }
+
+  uint32_t symbol = ((uint32_t)1 << sf) * 1000 / bandwidth;
+  uint8_t lowDataRate = (sf >= 11 && bandwidth == 125) ? 1 : 0;
+  int32_t bits = 8L * size - 4L * sf + 44;
+  uint32_t symbols = 8;
+  if (bits > 0)
+  {
+    uint8_t bitsPerBlock = 4 * (sf - 2 * lowDataRate);
+    symbols += (bits + bitsPerBlock - 1) / bitsPerBlock * 5;
+  }
+
+  // 8 preamble symbols and 4.25 symbols of sync word
+  return symbol * 49 / 4 + symbols * symbol;
+}
+
+#if RN2XX3_ENERGY
+// RN2483 datasheet: 2.8 mA idle, 14.2 mA RX and 38.9 mA TX at 14 dBm.
+// Power index 1 to 5 is 14 to 2 dBm on 868 MHz.
+const rn2xx3_energy_profile rn2xx3_energy_rn2483 = {
+  3300, 28, 142, 5,
+  {389, 389, 324, 270, 240, 220, 220, 220, 220, 220, 220}
+};
+
+// RN2903 datasheet: 2.7 mA idle, 13.5 mA RX and 124.4 mA TX at 18.5 dBm.
+// Power index 5 to 10 is 20 to 10 dBm.
+const rn2xx3_energy_profile rn2xx3_energy_rn2903 = {
+  3300, 27, 135, 5,
+  {1244, 1244, 1244, 1244, 1244, 1244, 1120, 950, 800, 680, 580}
+};
+
+#define ENERGY_SCOPE(kind) energy_scope energyScope(*this, kind)
+#else
+#define ENERGY_SCOPE(kind)
+#endif
+
+static unsigned long commandTimeout(const String& command)
+{
+  return command.startsWith(F("mac save")) ? SAVE_TIMEOUT : REPLY_TIMEOUT;
+}
+
+#if RN2XX3_LOG_LEVEL > RN2XX3_LOG_NONE
+static const __FlashStringHelper* replyName(rn2xx3::received_t reply)
+{
+  switch (reply)
+  {
+    case rn2xx3::busy: return F("busy");
+    case rn2xx3::frame_counter_err_rejoin_needed: return F("frame_counter_err_rejoin_needed");
+    case rn2xx3::invalid_data_len: return F("invalid_data_len");
+    case rn2xx3::invalid_param: return F("invalid_param");
+    case rn2xx3::mac_err: return F("mac_err");
+    case rn2xx3::mac_paused: return F("mac_paused");
+    case rn2xx3::mac_rx: return F("mac_rx");
+    case rn2xx3::mac_tx_ok: return F("mac_tx_ok");
+    case rn2xx3::no_free_ch: return F("no_free_ch");
+    case rn2xx3::not_joined: return F("not_joined");
+    case rn2xx3::ok: return F("ok");
+    case rn2xx3::radio_err: return F("radio_err");
+    case rn2xx3::radio_tx_ok: return F("radio_tx_ok");
+    case rn2xx3::silent: return F("silent");
+    default: return F("unknown");
+  }
+}
+
+static const __FlashStringHelper* recoveryName(RN2xx3_recovery step)
+{
+  switch (step)
+  {
+    case RECOVERY_RETRY: return F("retry");
+    case RECOVERY_RESUME: return F("resume");
+    case RECOVERY_WAIT: return F("wait");
+    case RECOVERY_ENABLE: return F("enable");
+    case RECOVERY_RESYNC: return F("resync");
+    case RECOVERY_REJOIN: return F("rejoin");
+    case RECOVERY_REINIT: return F("reinit");
+    default: return F("none");
+  }
+}
+#endif
+
+static RN2xx3_recovery atLeast(RN2xx3_recovery step, RN2xx3_recovery minimum)
+{
+  return step > minimum ? step : minimum;
+}
+
 /*
   @param serial Needs to be an already opened Stream ({Software/Hardware}Serial) to write to and read from.
 */
 rn2xx3::rn2xx3(Stream& serial):
 _serial(serial)
 {
-  _serial.setTimeout(2000);
+  _serial.setTimeout(REPLY_TIMEOUT);
 }
 
 //TODO: change to a boolean
@@ -38,8 +176,83 @@ void rn2xx3::autobaud()
     _serial.println();
     // we could use sendRawCommand(F("sys get ver")); here
     _serial.println(F("sys get ver"));
-    response = _serial.readStringUntil('\n');
+    RN2XX3_LOG_D(F("> sys get ver"));
+    response = readLine(REPLY_TIMEOUT);
+  }
+
+  if (response.startsWith(F("RN2")))
+  {
+    parseVersion(response);
+  }
+}
+
+void rn2xx3::setHostBaudRate(void (*setter)(uint32_t baud), uint32_t current)
+{
+  _setHostBaud = setter;
+  _baud = current > 0 ? current : 57600;
+}
+
+bool rn2xx3::switchBaudRate(uint32_t baud, uint32_t slowest)
+{
+  // A zero byte sent at a quarter to half of the slowest rate keeps the
+  // line low for longer than a whole character: a break to the module.
+  uint32_t breakBaud = 1200;
+  while (breakBaud * 4 <= slowest)
+  {
+    breakBaud *= 2;
+  }
+
+  _serial.flush();
+  _setHostBaud(breakBaud);
+  _serial.write((byte)0x00);
+  _serial.flush();
+
+  // The module measures the new rate from the 0x55 that follows
+  _setHostBaud(baud);
+  _serial.write(0x55);
+  _serial.println();
+
+  return sendRawCommand(F("sys get ver")).startsWith(F("RN2"));
+}
+
+bool rn2xx3::setBaudRate(uint32_t baud)
+{
+  if (_setHostBaud == NULL || baud == 0)
+  {
+    return false;
+  }
+
+  uint32_t slowest = baud < _baud ? baud : _baud;
+  if (switchBaudRate(baud, slowest))
+  {
+    RN2XX3_LOG_I(F("baud rate "), baud);
+    _baud = baud;
+    return true;
+  }
+  RN2XX3_LOG_E(F("no reply at "), baud, F(" baud, back to "), _baud);
+
+  // The module may be at either rate now, or at neither
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    if (switchBaudRate(_baud, slowest))
+    {
+      break;
+    }
   }
+  return false;
+}
+
+uint32_t rn2xx3::baudRate()
+{
+  return _baud;
+}
+
+uint32_t rn2xx3::uartTime(uint8_t payloadSize)
+{
+  // "mac tx uncnf 1 " and the payload in HEX, "ok" and "mac_tx_ok",
+  // all lines ending in CR LF, at 10 bits per character
+  uint32_t characters = 15 + 2 * (uint32_t)payloadSize + 2 + 4 + 11;
+  return characters * 100000UL / (_baud / 100);
 }
 
 
@@ -52,25 +265,106 @@ String rn2xx3::sysver()
 
 RN2xx3_t rn2xx3::configureModuleType()
 {
-  String version = sysver();
+  if (!_identityValid)
+  {
+    parseVersion(sysver());
+  }
+  return _moduleType;
+}
+
+void rn2xx3::parseVersion(const String& version)
+{
+  //example: RN2483 1.0.4 Oct 12 2017 14:59:25
   String model = version.substring(2,6);
+  RN2xx3_t moduleType;
   switch (model.toInt()) {
     case 2903:
-      _moduleType = RN2903;
+      moduleType = RN2903;
       break;
     case 2483:
-      _moduleType = RN2483;
+      moduleType = RN2483;
       break;
     default:
-      _moduleType = RN_NA;
+      moduleType = RN_NA;
       break;
   }
-  return _moduleType;
+
+  const char* p = version.c_str() + (version.length() > 7 ? 7 : version.length());
+  char* end;
+  uint16_t firmware = 0;
+  for (uint8_t shift = 8; ; shift -= 4)
+  {
+    firmware |= (strtoul(p, &end, 10) & 0x0F) << shift;
+    if (shift == 0 || *end != '.')
+    {
+      break;
+    }
+    p = end + 1;
+  }
+
+  // A rebooted module lost its settings, but kept its hardware EUI. Only
+  // read that again if this looks like another module.
+  forgetSettings();
+  if (moduleType != _moduleType || firmware != _firmware)
+  {
+    _hweuiValid = false;
+  }
+  _moduleType = moduleType;
+  _firmware = firmware;
+  _identityValid = (_moduleType != RN_NA);
+  saveIdentity();
+}
+
+uint16_t rn2xx3::firmwareVersion()
+{
+  return _identityValid ? _firmware : 0;
+}
+
+bool rn2xx3::hasFeature(RN2xx3_feature feature)
+{
+  configureModuleType();
+  switch (feature)
+  {
+    case FEATURE_CLASS_C:
+    case FEATURE_RADIO_RSSI:
+      return _identityValid && _firmware >= RN2XX3_FIRMWARE(1, 0, 5);
+  }
+  return false;
 }
 
 String rn2xx3::hweui()
 {
-  return (sendRawCommand(F("sys get hweui")));
+  String addr = sendRawCommand(F("sys get hweui"));
+  if (addr.length() == 16)
+  {
+    uint8_t eui[8];
+    if (decodeHex(addr.c_str(), eui, sizeof(eui)) == sizeof(eui) &&
+        (!_hweuiValid || memcmp(eui, _hweui, sizeof(eui)) != 0))
+    {
+      memcpy(_hweui, eui, sizeof(eui));
+      _hweuiValid = true;
+      saveIdentity();
+    }
+  }
+  return addr;
+}
+
+String rn2xx3::cachedHweui()
+{
+  if (!_hweuiValid)
+  {
+    return hweui();
+  }
+
+  String addr;
+  addr.reserve(16);
+  char buffer[3];
+  for (uint8_t i = 0; i < sizeof(_hweui); i++)
+  {
+    sprintf(buffer, "%02X", _hweui[i]);
+    addr += buffer;
+  }
+  return addr;
 }
 
 String rn2xx3::appeui()
@@ -96,30 +390,49 @@ bool rn2xx3::init()
   {
     return false;
   }
-  else if(_otaa==true)
+#if RN2XX3_OTAA
+  if(_otaa==true)
   {
-    return initOTAA(_appeui, _appskey);
+    // Pass the DevEUI in use, which can differ from the hardware EUI, so
+    // a session made with it is resumed instead of joined again
+    return initOTAA(_appeui, _appskey, _deveui);
   }
-  else
+#endif
+#if RN2XX3_ABP
+  if(_otaa==false)
   {
     return initABP(_devAddr, _appskey, _nwkskey);
   }
+#endif
+  return false;
 }
 
 
+#if RN2XX3_OTAA
 bool rn2xx3::initOTAA(const String& AppEUI, const String& AppKey, const String& DevEUI)
 {
+  ENERGY_SCOPE(ENERGY_REINIT);
   _otaa = true;
   _nwkskey = "0";
-  String receivedData;
 
   //clear serial buffer
-  while(_serial.available())
-    _serial.read();
+  clearSerial();
 
   // detect which model radio we are using
   configureModuleType();
 
+  // A module that is still joined does not need a new join, which would
+  // take seconds and use airtime.
+  if (_moduleType != RN_NA && !_forceReset && resumeOTAA(AppEUI, DevEUI))
+  {
+    RN2XX3_LOG_I(F("otaa session resumed"));
+    if (AppKey.length() == 32)
+    {
+      _appskey = AppKey;
+    }
+    return true;
+  }
+
   // reset the module - this will clear all keys set previously
   switch (_moduleType)
   {
@@ -142,7 +455,7 @@ bool rn2xx3::initOTAA(const String& AppEUI, const String& AppKey, const String&
   }
   else
   {
-    String addr = sendRawCommand(F("sys get hweui"));
+    String addr = cachedHweui();
     if( addr.length() == 16 )
     {
       _deveui = addr;
@@ -196,21 +509,38 @@ bool rn2xx3::initOTAA(const String& AppEUI, const String& AppKey, const String&
   // }
   // Disabled for now because an OTAA join seems to work fine without.
 
-  _serial.setTimeout(30000);
   sendRawCommand(F("mac save"));
 
+  return joinOTAA();
+}
+
+bool rn2xx3::joinOTAA()
+{
+  ENERGY_SCOPE(ENERGY_JOIN);
   bool joined = false;
+  unsigned long deadline = joinDeadline();
+
+  sessionSettings();
 
   // Only try twice to join, then return and let the user handle it.
   for(int i=0; i<2 && !joined; i++)
   {
     sendRawCommand(F("mac join otaa"));
     // Parse 2nd response
-    receivedData = _serial.readStringUntil('\n');
+    String receivedData = readLine(deadline, WAIT_JOIN);
 
+    RN2XX3_LOG_I(F("join otaa: "), receivedData);
+#if RN2XX3_ENERGY
+    if (receivedData.startsWith(F("accepted")) || receivedData.startsWith(F("denied")))
+    {
+      energyJoin(receivedData.startsWith(F("accepted")));
+    }
+#endif
     if(receivedData.startsWith(F("accepted")))
     {
       joined=true;
+      // The join accept can change the RX1 delay
+      _rxDelay1 = 0;
       delay(1000);
     }
     else
@@ -218,7 +548,6 @@ bool rn2xx3::initOTAA(const String& AppEUI, const String& AppKey, const String&
       delay(1000);
     }
   }
-  _serial.setTimeout(2000);
   return joined;
 }
 
@@ -257,21 +586,30 @@ bool rn2xx3::initOTAA(uint8_t * AppEUI, uint8_t * AppKey, uint8_t * DevEUI)
 
   return initOTAA(app_eui, app_key, dev_eui);
 }
+#endif
 
+#if RN2XX3_ABP
 bool rn2xx3::initABP(const String& devAddr, const String& AppSKey, const String& NwkSKey)
 {
+  ENERGY_SCOPE(ENERGY_REINIT);
   _otaa = false;
   _devAddr = devAddr;
   _appskey = AppSKey;
   _nwkskey = NwkSKey;
-  String receivedData;
 
   //clear serial buffer
-  while(_serial.available())
-    _serial.read();
+  clearSerial();
 
   configureModuleType();
 
+  // If the module still has a session for this address there is no need
+  // to reset it. Resetting would also restart the frame counters at 0.
+  if (_moduleType != RN_NA && !_forceReset && !_resetSession && resumeABP())
+  {
+    RN2XX3_LOG_I(F("abp session resumed"));
+    return true;
+  }
+
   switch (_moduleType) {
     case RN2903:
       sendRawCommand(F("mac reset"));
@@ -307,12 +645,90 @@ bool rn2xx3::initABP(const String& devAddr, const String& AppSKey, const String&
   }
   sendMacSet(F("dr"), String(5)); //0= min, 7=max
 
-  _serial.setTimeout(60000);
+  // Continue where the previous session left off, unless its frame
+  // counters ran out
+  if (_resetSession)
+  {
+    saveFrameCounters();
+  }
+  else
+  {
+    restoreFrameCounters();
+  }
+
   sendRawCommand(F("mac save"));
+  return joinABP();
+}
+#endif
+
+bool rn2xx3::isJoined()
+{
+  // Bit 0 of the status is set while the module is joined
+  uint32_t status;
+  return queryUnsigned(F("mac get status"), status, 16) && (status & 0x01);
+}
+
+#if RN2XX3_OTAA
+bool rn2xx3::resumeOTAA(const String& AppEUI, const String& DevEUI)
+{
+  if (!isJoined())
+  {
+    return false;
+  }
+
+  // Only keep the session if it was made with the identity we expect
+  String deveui = sendRawCommand(F("mac get deveui"));
+  if (DevEUI.length() == 16 ? !deveui.equalsIgnoreCase(DevEUI)
+                            : !deveui.equalsIgnoreCase(cachedHweui()))
+  {
+    return false;
+  }
+
+  String appeui = sendRawCommand(F("mac get appeui"));
+  if (AppEUI.length() == 16 && !appeui.equalsIgnoreCase(AppEUI))
+  {
+    return false;
+  }
+
+  _deveui = deveui;
+  _appeui = appeui;
+  return true;
+}
+#endif
+
+#if RN2XX3_ABP
+bool rn2xx3::resumeABP()
+{
+  // After a host reset the module can still be joined. After a module
+  // reset the session can be restored from what "mac save" stored.
+  if (!sendRawCommand(F("mac get devaddr")).equalsIgnoreCase(_devAddr))
+  {
+    return false;
+  }
+
+  // The keys can not be read back, so set them in case they changed
+  sendMacSet(F("nwkskey"), _nwkskey);
+  sendMacSet(F("appskey"), _appskey);
+  restoreFrameCounters();
+
+  if (isJoined())
+  {
+    return true;
+  }
+
+  return joinABP();
+}
+
+bool rn2xx3::joinABP()
+{
+  ENERGY_SCOPE(ENERGY_JOIN);
+  sessionSettings();
+
+  // No airtime is involved, the module accepts right away
   sendRawCommand(F("mac join abp"));
-  receivedData = _serial.readStringUntil('\n');
+  String receivedData = readLine(REPLY_TIMEOUT);
+  RN2XX3_LOG_I(F("join abp: "), receivedData);
 
-  _serial.setTimeout(2000);
   delay(1000);
 
   if(receivedData.startsWith(F("accepted")))
@@ -326,160 +742,710 @@ bool rn2xx3::initABP(const String& devAddr, const String& AppSKey, const String&
   }
 }
 
-TX_RETURN_TYPE rn2xx3::tx(const String& data)
+void rn2xx3::setFrameCounterStorage(rn2xx3_storage& storage, uint16_t address, uint16_t stride)
 {
-  return txUncnf(data); //we are unsure which mode we're in. Better not to wait for acks.
+  _counterStorage = &storage;
+  _counterAddress = address;
+  _counterStride = stride > 0 ? stride : 1;
 }
 
-TX_RETURN_TYPE rn2xx3::txBytes(const byte* data, uint8_t size)
+/*
+ * Frame counter record layout in storage, all values little endian:
+ * magic (1), devaddr (4), reserved upctr (4), dnctr (4), checksum (1)
+ */
+#define FRAME_COUNTER_MAGIC 0xFC
+#define FRAME_COUNTER_RECORD_SIZE 14
+#endif
+
+/*
+ * Identity record layout in storage:
+ * magic (1), model (2), firmware (2), hweui valid (1), hweui (8), checksum (1)
+ */
+#define IDENTITY_MAGIC 0x1D
+#define IDENTITY_RECORD_SIZE 15
+
+void rn2xx3::setIdentityStorage(rn2xx3_storage& storage, uint16_t address)
 {
-  char msgBuffer[size*2 + 1];
+  _identityStorage = &storage;
+  _identityAddress = address;
+  loadIdentity();
+}
 
-  char buffer[3];
-  for (unsigned i=0; i<size; i++)
+void rn2xx3::loadIdentity()
+{
+  uint8_t record[IDENTITY_RECORD_SIZE];
+  if (_identityValid || _identityStorage == NULL ||
+      !_identityStorage->read(_identityAddress, record, sizeof(record)) ||
+      record[0] != IDENTITY_MAGIC ||
+      record[sizeof(record)-1] != rn2xx3_checksum(record, sizeof(record)-1))
   {
-    sprintf(buffer, "%02X", data[i]);
-    memcpy(&msgBuffer[i*2], &buffer, sizeof(buffer));
+    return;
   }
-  String dataToTx(msgBuffer);
-  return txCommand("mac tx uncnf 1 ", dataToTx, false);
-}
 
-TX_RETURN_TYPE rn2xx3::txCnf(const String& data)
-{
-  return txCommand("mac tx cnf 1 ", data, true);
+  uint16_t model = record[1] | record[2] << 8;
+  if (model != RN2903 && model != RN2483)
+  {
+    return;
+  }
+  _moduleType = (RN2xx3_t)model;
+  _firmware = record[3] | record[4] << 8;
+  _hweuiValid = record[5];
+  memcpy(_hweui, &record[6], sizeof(_hweui));
+  _identityValid = true;
 }
 
-TX_RETURN_TYPE rn2xx3::txUncnf(const String& data)
+void rn2xx3::saveIdentity()
 {
-  return txCommand("mac tx uncnf 1 ", data, true);
+  if (!_identityValid || _identityStorage == NULL)
+  {
+    return;
+  }
+
+  uint8_t record[IDENTITY_RECORD_SIZE];
+  record[0] = IDENTITY_MAGIC;
+  record[1] = _moduleType;
+  record[2] = _moduleType >> 8;
+  record[3] = _firmware;
+  record[4] = _firmware >> 8;
+  record[5] = _hweuiValid;
+  memcpy(&record[6], _hweui, sizeof(_hweui));
+  record[sizeof(record)-1] = rn2xx3_checksum(record, sizeof(record)-1);
+
+  // Every module reboot gets here, only wear the storage for a change
+  uint8_t stored[IDENTITY_RECORD_SIZE];
+  if (_identityStorage->read(_identityAddress, stored, sizeof(stored)) &&
+      memcmp(stored, record, sizeof(record)) == 0)
+  {
+    return;
+  }
+  _identityStorage->write(_identityAddress, record, sizeof(record));
 }
 
-TX_RETURN_TYPE rn2xx3::txCommand(const String& command, const String& data, bool shouldEncode)
+void rn2xx3::clearSerial()
 {
-  bool send_success = false;
-  uint8_t busy_count = 0;
-  uint8_t retry_count = 0;
+  // Number of characters of "RN2" and "mac_rx " matched at the start
+  // of the current line
+  uint8_t matched = 0;
+#if RN2XX3_DOWNLINK
+  uint8_t rxMatched = 0;
+#endif
 
-  //clear serial buffer
   while(_serial.available())
-    _serial.read();
-
-  while(!send_success)
   {
-    //retransmit a maximum of 10 times
-    retry_count++;
-    if(retry_count>10)
+    char c = _serial.read();
+    countUart(1);
+    if (c == '\n')
     {
-      return TX_FAIL;
+      matched = 0;
+#if RN2XX3_DOWNLINK
+      rxMatched = 0;
+#endif
+      continue;
     }
 
-    _serial.print(command);
-    if(shouldEncode)
+    if (matched < 3)
     {
-      sendEncoded(data);
-    }
-    else
-    {
-      _serial.print(data);
+      matched = (c == "RN2"[matched]) ? matched + 1 : 0xFF;
+      if (matched == 3)
+      {
+        // Version banner of a reboot. Detect the module again when needed.
+        _identityValid = false;
+        forgetSettings();
+      }
     }
-    _serial.println();
-
-    String receivedData = _serial.readStringUntil('\n');
-    //TODO: Debug print on receivedData
 
-    switch (determineReceivedDataType(receivedData))
+#if RN2XX3_DOWNLINK
+    if (rxMatched < 7)
     {
-      case rn2xx3::ok:
+      rxMatched = (c == "mac_rx "[rxMatched]) ? rxMatched + 1 : 0xFF;
+      if (rxMatched == 7)
       {
-        _serial.setTimeout(30000);
-        receivedData = _serial.readStringUntil('\n');
-        _serial.setTimeout(2000);
+        // A downlink that arrived on its own. Never throw it away, read
+        // the rest of the line even if it is still on its way.
+        unsigned long start = millis();
+        bool complete = readRx(start, REPLY_TIMEOUT);
+        endWait(complete, start, REPLY_TIMEOUT, WAIT_KINDS);
+        deliverRx();
+        matched = 0;
+        rxMatched = 0;
+      }
+    }
+#endif
+  }
+}
 
-        //TODO: Debug print on receivedData
+#if RN2XX3_ABP
+void rn2xx3::restoreFrameCounters()
+{
+  uint8_t record[FRAME_COUNTER_RECORD_SIZE];
 
-        switch (determineReceivedDataType(receivedData))
-        {
-          case rn2xx3::mac_tx_ok:
-          {
-            //SUCCESS!!
-            send_success = true;
-            return TX_SUCCESS;
-          }
+  if (_counterStorage == NULL || _otaa ||
+      !_counterStorage->read(_counterAddress, record, sizeof(record)))
+  {
+    return;
+  }
 
-          case rn2xx3::mac_rx:
-          {
-            //example: mac_rx 1 54657374696E6720313233
-            _rxMessenge = receivedData.substring(receivedData.indexOf(' ', 7)+1);
-            send_success = true;
-            return TX_WITH_RX;
-          }
+  if (record[0] == FRAME_COUNTER_MAGIC &&
+      record[sizeof(record)-1] == rn2xx3_checksum(record, sizeof(record)-1) &&
+      getUint32(&record[1]) == strtoul(_devAddr.c_str(), NULL, 16))
+  {
+    uint32_t upctr = getUint32(&record[5]);
+    uint32_t dnctr = getUint32(&record[9]);
 
-          case rn2xx3::mac_err:
-          {
-            init();
-            break;
-          }
+    // Never move a counter backwards, that would make the network drop frames
+    uint32_t current;
+    if (getUpctr(current) && upctr > current)
+    {
+      sendMacSet(F("upctr"), String(upctr));
+    }
+    if (getDnctr(current) && dnctr > current)
+    {
+      sendMacSet(F("dnctr"), String(dnctr));
+    }
+  }
 
-          case rn2xx3::invalid_data_len:
-          {
-            //this should never happen if the prototype worked
-            send_success = true;
-            return TX_FAIL;
-          }
+  // Reserve the next stride of uplink counters before using them
+  saveFrameCounters();
+}
 
-          case rn2xx3::radio_tx_ok:
-          {
-            //SUCCESS!!
-            send_success = true;
-            return TX_SUCCESS;
-          }
+void rn2xx3::saveFrameCounters()
+{
+  if (_counterStorage == NULL || _otaa)
+  {
+    return;
+  }
 
-          case rn2xx3::radio_err:
-          {
-            //This should never happen. If it does, something major is wrong.
-            init();
-            break;
-          }
+  uint32_t upctr;
+  uint32_t dnctr;
+  if (!getUpctr(upctr) || !getDnctr(dnctr))
+  {
+    // Better to save at the next checkpoint than to save wrong counters
+    return;
+  }
 
-          default:
-          {
-            //unknown response
-            //init();
-          }
-        } // End while after "ok"
-        break;
-      }
+  uint8_t record[FRAME_COUNTER_RECORD_SIZE];
+  record[0] = FRAME_COUNTER_MAGIC;
+  putUint32(&record[1], strtoul(_devAddr.c_str(), NULL, 16));
+  putUint32(&record[5], upctr + _counterStride);
+  putUint32(&record[9], dnctr);
+  record[sizeof(record)-1] = rn2xx3_checksum(record, sizeof(record)-1);
+
+  if (_counterStorage->write(_counterAddress, record, sizeof(record)))
+  {
+    _uplinksBeforeCheckpoint = _counterStride;
+  }
+}
+#endif
+
+void rn2xx3::frameCounterCheckpoint()
+{
+#if RN2XX3_ABP
+  // Called after every uplink that used up a frame counter
+  if (_uplinksBeforeCheckpoint > 0)
+  {
+    _uplinksBeforeCheckpoint--;
+  }
+  if (_uplinksBeforeCheckpoint == 0)
+  {
+    saveFrameCounters();
+  }
+#endif
+}
+
+#if RN2XX3_JOURNAL
+void rn2xx3::setJournal(rn2xx3_journal& journal, uint8_t drainPerUplink)
+{
+  _journal = &journal;
+  _drainPerUplink = drainPerUplink;
+}
+
+TX_RETURN_TYPE rn2xx3::journalFailed(const String& command, const String& data, bool shouldEncode)
+{
+  // "mac tx <cnf|uncnf> <port> "
+  if (_journal == NULL || _draining || !command.startsWith(F("mac tx ")))
+  {
+    return TX_FAIL;
+  }
+  bool confirmed = command.startsWith(F("mac tx cnf "));
+  uint8_t port = atoi(command.c_str() + (confirmed ? 11 : 13));
+
+  unsigned int length = shouldEncode ? data.length() : data.length() / 2;
+  if (length > 255)
+  {
+    RN2XX3_LOG_E(F("uplink too large for the journal"));
+    return TX_FAIL;
+  }
+  uint8_t size = length;
+  uint8_t payload[size + 1];
+  if (shouldEncode)
+  {
+    memcpy(payload, data.c_str(), size);
+  }
+  else
+  {
+    size = decodeHex(data.c_str(), payload, size);
+  }
+
+  if (_journal->push(payload, size, port, _journalPriority, confirmed))
+  {
+    RN2XX3_LOG_I(F("uplink kept in journal, "), _journal->pending(), F(" pending"));
+  }
+  else
+  {
+    RN2XX3_LOG_E(F("uplink does not fit in journal"));
+  }
+  return TX_FAIL;
+}
+
+rn2xx3::received_t rn2xx3::txJournaled(const rn2xx3_journal_record& record, const uint8_t* payload)
+{
+  ENERGY_SCOPE(ENERGY_UPLINK);
+  unsigned long deadline = txDeadline(record.size, record.confirmed);
+
+  clearSerial();
+  countUart(_serial.print(record.confirmed ? F("mac tx cnf ") : F("mac tx uncnf ")));
+  countUart(_serial.print(record.port));
+  countUart(_serial.print(' '));
+  char buffer[3];
+  for (uint8_t i = 0; i < record.size; i++)
+  {
+    sprintf(buffer, "%02X", payload[i]);
+    countUart(_serial.print(buffer));
+  }
+  countUart(_serial.println());
+  RN2XX3_LOG_D(F("> journaled uplink "), record.seq);
+
+  String receivedData = readLine(REPLY_TIMEOUT);
+  received_t reply = determineReceivedDataType(receivedData);
+  if (reply != rn2xx3::ok)
+  {
+    return reply;
+  }
+
+  receivedData = readLine(deadline, WAIT_TX);
+  reply = determineReceivedDataType(receivedData);
+  if (reply == rn2xx3::mac_tx_ok || reply == rn2xx3::mac_rx || reply == rn2xx3::mac_err)
+  {
+    frameCounterCheckpoint();
+#if RN2XX3_ENERGY
+    energyUplink(record.size, record.confirmed, reply, receivedData);
+#endif
+  }
+#if RN2XX3_DOWNLINK
+  if (reply == rn2xx3::mac_rx)
+  {
+    // Nobody waits for this reply, hand it over like a class C downlink
+    deliverRx();
+  }
+#endif
+  return reply;
+}
+
+uint8_t rn2xx3::drainJournal(uint8_t max)
+{
+  if (_journal == NULL || _draining)
+  {
+    return 0;
+  }
+#if RN2XX3_BATTERY
+  // Journaled uplinks are sent as they were made, maybe confirmed
+  if (_policy.defer)
+  {
+    return 0;
+  }
+#endif
+
+  uint8_t sent = 0;
+  rn2xx3_journal_record record;
+  uint8_t payload[_journal->maxPayload() + 1];
+  _drainDue = false;
+
+  _draining = true;
+  while (sent < max && _journal->peek(record, payload, sizeof(payload)))
+  {
+    received_t reply = txJournaled(record, payload);
+    if (reply != rn2xx3::mac_tx_ok && reply != rn2xx3::mac_rx)
+    {
+      // Most likely no_free_ch: the duty cycle does not allow more now.
+      // A mac_err was not acknowledged, keep it for the next attempt.
+      RN2XX3_LOG_I(F("journal drain stopped: "), replyName(reply));
+      break;
+    }
+    _journal->drop(record);
+    sent++;
+  }
+  _draining = false;
+  return sent;
+}
+#endif
+
+void rn2xx3::sessionSettings()
+{
+#if RN2XX3_DOWNLINK
+  if (_classC)
+  {
+    sendMacSet(F("class"), F("c"));
+  }
+#endif
+#if RN2XX3_LINK_CHECK
+  if (_linkCheckPeriod > 0)
+  {
+    sendMacSet(F("linkchk"), String(_linkCheckPeriod));
+    _linkCheckDue = millis() + _linkCheckPeriod * 1000UL;
+  }
+#endif
+}
+
+#if RN2XX3_LINK_CHECK
+bool rn2xx3::setLinkCheck(uint16_t period, bool adaptDataRate)
+{
+  _linkCheckPeriod = period;
+  _linkCheckAdapt = adaptDataRate;
+  _linkCheckDue = millis() + period * 1000UL;
+  getDnctr(_linkCheckDnctr);
+  return sendMacSet(F("linkchk"), String(period));
+}
+
+void rn2xx3::setLinkCheckHandler(void (*handler)(const rn2xx3_link_check& result))
+{
+  _linkCheckHandler = handler;
+}
+
+const rn2xx3_link_check& rn2xx3::getLinkCheck()
+{
+  return _linkCheck;
+}
+
+void rn2xx3::linkCheckCheckpoint()
+{
+  // Called after every uplink. Only the first one after the period
+  // carried a request.
+  if (_linkCheckPeriod == 0 || (long)(millis() - _linkCheckDue) < 0)
+  {
+    return;
+  }
+  _linkCheckDue = millis() + _linkCheckPeriod * 1000UL;
+
+  // The answer is a downlink, so it moves the downlink frame counter.
+  // mrgn and gwnb keep the values of the previous answer otherwise.
+  uint32_t dnctr;
+  uint32_t margin = 0;
+  uint32_t gateways = 0;
+  if (!getDnctr(dnctr))
+  {
+    return;
+  }
+  if (dnctr != _linkCheckDnctr &&
+      (!queryUnsigned(F("mac get mrgn"), margin, 10, false) ||
+       !queryUnsigned(F("mac get gwnb"), gateways, 10, false)))
+  {
+    return;
+  }
+  _linkCheckDnctr = dnctr;
+
+  _linkCheck.margin = margin;
+  _linkCheck.gateways = gateways;
+  _linkCheck.atMs = millis();
+  RN2XX3_LOG_I(F("link check: margin "), margin, F(" dB, gateways "), gateways);
+
+  if (_linkCheckAdapt && !_adr)
+  {
+    adaptDataRate();
+  }
+  if (_linkCheckHandler != NULL)
+  {
+    _linkCheckHandler(_linkCheck);
+  }
+}
+
+void rn2xx3::adaptDataRate()
+{
+  // Every step in spreading factor needs about 2.5 dB more SNR. Only step
+  // up with margin to spare and more than one gateway to fall back on.
+  uint8_t dr = currentDataRate();
+  uint8_t highest = _moduleType == RN2903 ? 4 : 5;
+
+  if (_linkCheck.gateways == 0 || _linkCheck.margin < LINK_MARGIN_LOW)
+  {
+    if (dr > 0)
+    {
+      setDR(dr - 1);
+    }
+  }
+  else if (_linkCheck.margin >= LINK_MARGIN_HIGH && _linkCheck.gateways >= 2 && dr < highest)
+  {
+    setDR(dr + 1);
+  }
+}
+#endif
+
+TX_RETURN_TYPE rn2xx3::tx(const String& data)
+{
+  return txUncnf(data); //we are unsure which mode we're in. Better not to wait for acks.
+}
+
+TX_RETURN_TYPE rn2xx3::txBytes(const byte* data, uint8_t size)
+{
+  return txBytes(data, size, 1);
+}
+
+TX_RETURN_TYPE rn2xx3::txBytes(const byte* data, uint8_t size, uint8_t port, bool confirmed)
+{
+  char msgBuffer[size*2 + 1];
+
+  char buffer[3];
+  for (unsigned i=0; i<size; i++)
+  {
+    sprintf(buffer, "%02X", data[i]);
+    memcpy(&msgBuffer[i*2], &buffer, sizeof(buffer));
+  }
+  String dataToTx(msgBuffer);
+  String command = confirmed ? F("mac tx cnf ") : F("mac tx uncnf ");
+  command += port;
+  command += ' ';
+  return txCommand(command, dataToTx, false);
+}
+
+#if RN2XX3_JOURNAL
+TX_RETURN_TYPE rn2xx3::txBytes(const byte* data, uint8_t size, uint8_t port, bool confirmed, uint8_t priority)
+{
+  _journalPriority = priority;
+  TX_RETURN_TYPE result = txBytes(data, size, port, confirmed);
+  _journalPriority = 0;
+  return result;
+}
+#endif
+
+#if RN2XX3_REPORT_FILTER
+TX_RETURN_TYPE rn2xx3::report(rn2xx3_report_filter& filter, const byte* data, uint8_t size,
+                              uint8_t port, bool confirmed)
+{
+  if (!filter.due())
+  {
+    filter.suppress();
+    _suppressedUplinks++;
+    RN2XX3_LOG_I(F("uplink suppressed, no value changed"));
+    return TX_SUPPRESSED;
+  }
+
+  TX_RETURN_TYPE result = txBytes(data, size, port, confirmed);
+  if (result == TX_SUCCESS || result == TX_WITH_RX)
+  {
+#if RN2XX3_BATTERY
+    // The battery policy may have sent it unconfirmed
+    confirmed = confirmed && !_policy.unconfirmed;
+#endif
+    // A downlink in the receive windows also shows the network heard it
+    filter.reported(confirmed || result == TX_WITH_RX);
+  }
+  return result;
+}
+
+uint32_t rn2xx3::suppressedUplinks()
+{
+  return _suppressedUplinks;
+}
+#endif
+
+TX_RETURN_TYPE rn2xx3::txCnf(const String& data)
+{
+  return txCommand("mac tx cnf 1 ", data, true);
+}
+
+TX_RETURN_TYPE rn2xx3::txUncnf(const String& data)
+{
+  return txCommand("mac tx uncnf 1 ", data, true);
+}
+
+TX_RETURN_TYPE rn2xx3::txCommand(const String& command, const String& data, bool shouldEncode)
+{
+#if RN2XX3_BATTERY
+  if (command.startsWith(F("mac tx ")))
+  {
+    // The module is awake for the uplink anyway
+    sampleVdd();
+    bool confirmed = command.startsWith(F("mac tx cnf "));
+    if (confirmed && _policy.unconfirmed)
+    {
+      String unconfirmed = F("mac tx uncnf ");
+      unconfirmed += command.substring(11);
+      return txCommand(unconfirmed, data, shouldEncode);
+    }
+    if (_policy.defer &&
+        (confirmed || (_policy.maxAirtime > 0 &&
+                       timeOnAir(shouldEncode ? data.length() : data.length() / 2) > _policy.maxAirtime)))
+    {
+      RN2XX3_LOG_I(F("uplink deferred at "), _vdd, F(" mV"));
+      return TX_DEFERRED;
+    }
+  }
+#endif
+
+#if RN2XX3_JOURNAL
+  if (_drainDue && command.startsWith(F("mac tx ")))
+  {
+    // The last uplink showed the link works, but got a downlink the
+    // application had to be able to read first
+    drainJournal(_drainPerUplink);
+  }
+#endif
+
+  ENERGY_SCOPE(ENERGY_UPLINK);
+  uint8_t busy_count = 0;
+  uint8_t retry_count = 0;
+
+  // The most expensive recovery step taken so far, and when the first
+  // fault happened. A fault that comes back after its step was taken
+  // escalates to the next step instead of repeating it.
+  RN2xx3_recovery step = RECOVERY_NONE;
+  unsigned long faultStart = 0;
+#if RN2XX3_DIAGNOSTICS
+  _lastRecovery = RECOVERY_NONE;
+#endif
+
+  // Work out the deadline before sending, it may need to query the module
+  uint8_t payloadSize = shouldEncode ? data.length() : data.length() / 2;
+  bool confirmed = command.startsWith(F("mac tx cnf"));
+  unsigned long deadline = txDeadline(payloadSize, confirmed);
+
+  //clear serial buffer
+  clearSerial();
+
+  while(true)
+  {
+    //retransmit a maximum of 10 times
+    retry_count++;
+    if(retry_count>10)
+    {
+      RN2XX3_LOG_E(F("tx failed after 10 attempts"));
+      return txFailed(step, command, data, shouldEncode);
+    }
+
+    countUart(_serial.print(command));
+    if(shouldEncode)
+    {
+      sendEncoded(data);
+    }
+    else
+    {
+      countUart(_serial.print(data));
+    }
+    countUart(_serial.println());
+    RN2XX3_LOG_D(F("> "), command, data, shouldEncode ? F(" (as HEX)") : F(""));
+
+    String receivedData = readLine(REPLY_TIMEOUT);
+    received_t reply = determineReceivedDataType(receivedData);
+    RN2XX3_LOG_I(F("tx: "), replyName(reply));
 
-      case rn2xx3::invalid_param:
+    if (reply == rn2xx3::ok)
+    {
+      receivedData = readLine(deadline, WAIT_TX);
+      reply = determineReceivedDataType(receivedData);
+      RN2XX3_LOG_I(F("tx: "), replyName(reply));
+#if RN2XX3_ENERGY
+      if (reply == rn2xx3::mac_tx_ok || reply == rn2xx3::mac_rx || reply == rn2xx3::mac_err ||
+          reply == rn2xx3::radio_tx_ok)
       {
-        //should not happen if we typed the commands correctly
-        send_success = true;
-        return TX_FAIL;
+        energyUplink(payloadSize, confirmed, reply, receivedData);
       }
+#endif
 
-      case rn2xx3::not_joined:
+      switch (reply)
       {
-        init();
-        break;
+        case rn2xx3::mac_tx_ok:
+        {
+          //SUCCESS!!
+          frameCounterCheckpoint();
+#if RN2XX3_LINK_CHECK
+          linkCheckCheckpoint();
+#endif
+          recovered(step, faultStart);
+#if RN2XX3_JOURNAL
+          // The link works, send what was kept while it did not
+          if (_drainPerUplink > 0)
+          {
+            drainJournal(_drainPerUplink);
+          }
+#endif
+          return TX_SUCCESS;
+        }
+
+        case rn2xx3::mac_rx:
+        {
+          //example: mac_rx 1 54657374696E6720313233
+          //readLine() already kept the port and payload
+          frameCounterCheckpoint();
+#if RN2XX3_LINK_CHECK
+          linkCheckCheckpoint();
+#endif
+          recovered(step, faultStart);
+#if RN2XX3_JOURNAL
+          // The link works as well. Downlinks to journaled uplinks would
+          // replace this one, so send those before the next uplink.
+          _drainDue = _drainPerUplink > 0 && _journal != NULL && _journal->pending() > 0;
+#endif
+          return TX_WITH_RX;
+        }
+
+        case rn2xx3::radio_tx_ok:
+        {
+          //SUCCESS!!
+          recovered(step, faultStart);
+          return TX_SUCCESS;
+        }
+
+        case rn2xx3::invalid_data_len:
+        {
+          //this should never happen if the prototype worked
+          return TX_FAIL;
+        }
+
+        case rn2xx3::mac_err:
+        {
+          // The uplink went out, but a confirmed one was not acknowledged
+          frameCounterCheckpoint();
+#if RN2XX3_LINK_CHECK
+          linkCheckCheckpoint();
+#endif
+          break;
+        }
+
+        case rn2xx3::radio_err:
+        case rn2xx3::UNKNOWN:
+        {
+          break;
+        }
+
+        default:
+        {
+          // A reply that only makes sense as the first one
+          reply = rn2xx3::UNKNOWN;
+          break;
+        }
       }
+    }
+
+    if (reply == rn2xx3::invalid_param || reply == rn2xx3::invalid_data_len)
+    {
+      //should not happen if we typed the commands correctly
+      return TX_FAIL;
+    }
+
+    if (step == RECOVERY_NONE)
+    {
+      faultStart = millis();
+    }
 
+    // Set by the steps that need a full reset
+    bool reset = false;
+    switch (reply)
+    {
       case rn2xx3::no_free_ch:
+      case rn2xx3::mac_err:
       {
         //retry
         delay(1000);
-        break;
-      }
-
-      case rn2xx3::silent:
-      {
-        init();
-        break;
-      }
-
-      case rn2xx3::frame_counter_err_rejoin_needed:
-      {
-        init();
+        step = atLeast(step, RECOVERY_RETRY);
         break;
       }
 
@@ -487,57 +1453,766 @@ TX_RETURN_TYPE rn2xx3::txCommand(const String& command, const String& data, bool
       {
         busy_count++;
 
-        // Not sure if this is wise. At low data rates with large packets
-        // this can perhaps cause transmissions at more than 1% duty cycle.
-        // Need to calculate the correct constant value.
-        // But it is wise to have this check and re-init in case the
-        // lorawan stack in the RN2xx3 hangs.
-        if(busy_count>=10)
+        // Ten busy replies in a row can mean the lorawan stack in the
+        // RN2xx3 hangs. Resynchronise first, and only reset it if that
+        // did not help.
+        if (busy_count < 10)
         {
-          init();
+          delay(1000);
+          step = atLeast(step, RECOVERY_RETRY);
+        }
+        else if (step < RECOVERY_RESYNC && resync())
+        {
+          busy_count = 0;
+          step = RECOVERY_RESYNC;
         }
         else
         {
-          delay(1000);
+          reset = true;
         }
         break;
       }
 
       case rn2xx3::mac_paused:
       {
-        init();
+        if (step < RECOVERY_RESUME)
+        {
+          sendRawCommand(F("mac resume"));
+          step = RECOVERY_RESUME;
+        }
+        else
+        {
+          reset = true;
+        }
         break;
       }
 
-      case rn2xx3::invalid_data_len:
+      case rn2xx3::silent:
       {
-        //should not happen if the prototype worked
-        send_success = true;
-        return TX_FAIL;
+        // The network silenced the module. It stays silent until it is
+        // enabled again or reset, so waiting only helps once.
+        if (step < RECOVERY_WAIT)
+        {
+          delay(1000);
+          step = RECOVERY_WAIT;
+        }
+        else if (step < RECOVERY_ENABLE)
+        {
+          sendRawCommand(F("mac forceENABLE"));
+          step = RECOVERY_ENABLE;
+        }
+        else
+        {
+          reset = true;
+        }
+        break;
       }
 
-      default:
+      case rn2xx3::not_joined:
+      case rn2xx3::frame_counter_err_rejoin_needed:
       {
-        //unknown response after mac tx command
-        init();
-        break;
+#if RN2XX3_ABP
+        if (reply == rn2xx3::frame_counter_err_rejoin_needed && !_otaa)
+        {
+          // Joining again keeps an ABP session and its frame counters,
+          // only a reset starts over
+          _resetSession = true;
+          reset = true;
+          break;
+        }
+#endif
+        if (step < RECOVERY_REJOIN && rejoin())
+        {
+          step = RECOVERY_REJOIN;
+        }
+#if RN2XX3_JOURNAL
+        else if (_journal != NULL && command.startsWith(F("mac tx")))
+        {
+          // Joining failed, and more joins would only cost airtime. Keep
+          // the uplink until the link is back.
+          return txFailed(step, command, data, shouldEncode);
+        }
+#endif
+        else
+        {
+          reset = true;
+        }
+        break;
+      }
+
+      case rn2xx3::radio_err:
+      {
+        //This should never happen. If it does, something major is wrong.
+        reset = true;
+        break;
+      }
+
+      default:
+      {
+        //unknown response after mac tx command
+        if (step >= RECOVERY_RESYNC)
+        {
+          reset = true;
+        }
+        else if (resync())
+        {
+          step = RECOVERY_RESYNC;
+        }
+        else if (rejoin())
+        {
+          step = RECOVERY_REJOIN;
+        }
+        else
+        {
+          reset = true;
+        }
+        break;
+      }
+    }
+
+    if (reset)
+    {
+      if (step == RECOVERY_REINIT)
+      {
+        // The module was reset already, more attempts would only be blind
+        RN2XX3_LOG_E(replyName(reply), F(" after a reset"));
+        return txFailed(step, command, data, shouldEncode);
+      }
+      reinit();
+      step = RECOVERY_REINIT;
+    }
+    RN2XX3_LOG_E(replyName(reply), F(", recovery: "), recoveryName(step));
+  }
+}
+
+bool rn2xx3::rejoin()
+{
+  // The keys are still in the module, there is no need to reset it
+  if (_appskey == "0")
+  {
+    return false;
+  }
+#if RN2XX3_OTAA
+  if (_otaa)
+  {
+    return joinOTAA();
+  }
+#endif
+#if RN2XX3_ABP
+  if (!_otaa)
+  {
+    return joinABP();
+  }
+#endif
+  return false;
+}
+
+bool rn2xx3::resync()
+{
+  // Let the module finish whatever it is saying and throw it away
+  while (readLine(200, WAIT_KINDS).length() > 0)
+  {
+  }
+  clearSerial();
+
+  return isJoined();
+}
+
+bool rn2xx3::reinit()
+{
+  // init() alone resumes a session the module still reports as joined
+  _forceReset = true;
+  bool done = init();
+  _forceReset = false;
+#if RN2XX3_ABP
+  _resetSession = false;
+#endif
+  return done;
+}
+
+TX_RETURN_TYPE rn2xx3::txFailed(RN2xx3_recovery step, const String& command, const String& data,
+                                bool shouldEncode)
+{
+#if RN2XX3_DIAGNOSTICS
+  _lastRecovery = step;
+  if (step != RECOVERY_NONE)
+  {
+    _recoveryStats.unresolved++;
+  }
+#else
+  (void)step;
+#endif
+#if RN2XX3_JOURNAL
+  return journalFailed(command, data, shouldEncode);
+#else
+  (void)command;
+  (void)data;
+  (void)shouldEncode;
+  return TX_FAIL;
+#endif
+}
+
+void rn2xx3::recovered(RN2xx3_recovery step, unsigned long faultStart)
+{
+  if (step != RECOVERY_NONE)
+  {
+    RN2XX3_LOG_I(F("recovered by "), recoveryName(step), F(" in "), millis() - faultStart, F(" ms"));
+  }
+
+#if RN2XX3_DIAGNOSTICS
+  _lastRecovery = step;
+  if (step != RECOVERY_NONE)
+  {
+    _recoveryStats.resolved[step]++;
+    _recoveryStats.recoveryMs[step] += millis() - faultStart;
+  }
+#else
+  (void)step;
+  (void)faultStart;
+#endif
+}
+
+#if RN2XX3_DIAGNOSTICS
+RN2xx3_recovery rn2xx3::lastRecovery()
+{
+  return _lastRecovery;
+}
+
+const rn2xx3_recovery_stats& rn2xx3::getRecoveryStats()
+{
+  return _recoveryStats;
+}
+
+void rn2xx3::resetRecoveryStats()
+{
+  memset(&_recoveryStats, 0, sizeof(_recoveryStats));
+}
+#endif
+
+String rn2xx3::readLine(unsigned long timeout, RN2xx3_wait kind)
+{
+  String line;
+  unsigned long start = millis();
+  int c;
+
+  while ((c = readChar(start, timeout)) >= 0)
+  {
+    if (c != '\n')
+    {
+      if (c != '\r')
+      {
+        line += (char)c;
+      }
+#if RN2XX3_DOWNLINK
+      if (line.length() == 7 && line.startsWith(F("mac_rx ")))
+      {
+        // Decode the payload as it arrives, the line keeps only "mac_rx"
+        c = readRx(start, timeout) ? '\n' : -1;
+        line.trim();
+        if (kind != WAIT_TX && c == '\n')
+        {
+          deliverRx();
+          line = "";
+          continue;
+        }
+        break;
+      }
+#endif
+      continue;
+    }
+
+    RN2XX3_LOG_D(F("< "), line, F(" ("), millis() - start, F(" ms)"));
+    break;
+  }
+
+  endWait(c == '\n', start, timeout, kind);
+  return line;
+}
+
+bool rn2xx3::readLine(char* buf, size_t cap, unsigned long timeout, RN2xx3_wait kind)
+{
+  size_t length = 0;
+  unsigned long start = millis();
+  int c;
+
+  while ((c = readChar(start, timeout)) >= 0 && c != '\n')
+  {
+    if (c != '\r' && length + 1 < cap)
+    {
+      buf[length++] = c;
+    }
+
+#if RN2XX3_DOWNLINK
+    if (length == 7 && strncmp(buf, "mac_rx ", 7) == 0)
+    {
+      // Decode the payload as it arrives, buf keeps only "mac_rx"
+      c = readRx(start, timeout) ? '\n' : -1;
+      if (kind != WAIT_TX && c == '\n')
+      {
+        deliverRx();
+        length = 0;
+        continue;
       }
+      length = 6;
+      break;
+    }
+#endif
+  }
+  buf[length] = '\0';
+
+  if (c == '\n')
+  {
+    RN2XX3_LOG_D(F("< "), buf, F(" ("), millis() - start, F(" ms)"));
+  }
+  endWait(c == '\n', start, timeout, kind);
+  return c == '\n';
+}
+
+int rn2xx3::readChar(unsigned long start, unsigned long timeout)
+{
+  unsigned long elapsed = millis() - start;
+  if (elapsed >= timeout)
+  {
+    return -1;
+  }
+
+  // Never wait past the deadline, whatever the Stream timeout was
+  _serial.setTimeout(timeout - elapsed);
+  char c;
+  if (_serial.readBytes(&c, 1) != 1)
+  {
+    return -1;
+  }
+  countUart(1);
+  return (uint8_t)c;
+}
+
+void rn2xx3::endWait(bool complete, unsigned long start, unsigned long timeout, RN2xx3_wait kind)
+{
+  _serial.setTimeout(REPLY_TIMEOUT);
+
+  if (!complete && kind < WAIT_KINDS)
+  {
+    RN2XX3_LOG_I(F("no reply within "), timeout, F(" ms"));
+  }
+
+#if RN2XX3_DIAGNOSTICS
+  if (kind < WAIT_KINDS)
+  {
+    rn2xx3_deadline_stats& stats = _deadlineStats[kind];
+    unsigned long elapsed = millis() - start;
+    if (complete)
+    {
+      uint8_t bucket = elapsed * RN2XX3_DEADLINE_BUCKETS / timeout;
+      stats.buckets[bucket < RN2XX3_DEADLINE_BUCKETS ? bucket : RN2XX3_DEADLINE_BUCKETS - 1]++;
+      if (elapsed > stats.longestMs)
+      {
+        stats.longestMs = elapsed;
+      }
+    }
+    else
+    {
+      stats.expired++;
+    }
+  }
+#else
+  (void)start;
+  (void)kind;
+  (void)timeout;
+#endif
+}
+
+bool rn2xx3::dataRate(uint8_t dr, uint8_t& sf, uint16_t& bandwidth)
+{
+  bandwidth = 125;
+  if (_moduleType == RN2903)
+  {
+    if (dr <= 3)
+    {
+      sf = 10 - dr;
+      return true;
+    }
+    if (dr == 4)
+    {
+      sf = 8;
+      bandwidth = 500;
+      return true;
+    }
+    if (dr >= 8 && dr <= 13)
+    {
+      sf = 20 - dr;
+      bandwidth = 500;
+      return true;
+    }
+    return false;
+  }
+
+  // RN2483
+  if (dr <= 5)
+  {
+    sf = 12 - dr;
+    return true;
+  }
+  if (dr == 6)
+  {
+    sf = 7;
+    bandwidth = 250;
+    return true;
+  }
+  if (dr == 7)
+  {
+    sf = 0;
+    return true;
+  }
+  return false;
+}
+
+uint8_t rn2xx3::currentDataRate()
+{
+  if (_adr)
+  {
+    // The network can lower the data rate at any time, assume the slowest
+    return 0;
+  }
+  uint8_t dr;
+  if (_dr == 0xFF && !getDataRate(dr))
+  {
+    return 0;
+  }
+  return _dr;
+}
+
+uint32_t rn2xx3::timeOnAir(uint8_t payloadSize)
+{
+  uint8_t sf;
+  uint16_t bandwidth;
+  if (!dataRate(currentDataRate(), sf, bandwidth))
+  {
+    sf = 12;
+  }
+  return (packetAirtime(payloadSize + LORAWAN_OVERHEAD, sf, bandwidth) + 999) / 1000;
+}
+
+uint8_t rn2xx3::maxPayload()
+{
+  // Maximum MACPayload size N of the regional parameters, without FOpts
+  static const uint8_t eu868[] = {51, 51, 51, 115, 242, 242, 242, 242};
+  static const uint8_t us915[] = {11, 53, 125, 242, 242};
+
+  uint8_t dr = currentDataRate();
+  if (_moduleType == RN2903)
+  {
+    return dr < sizeof(us915) ? us915[dr] : 0;
+  }
+  return dr < sizeof(eu868) ? eu868[dr] : 0;
+}
+
+unsigned long rn2xx3::txDeadline(uint8_t payloadSize, bool confirmed)
+{
+  // The longest downlink RX2 can hold at its default data rate
+  uint32_t downlink = packetAirtime(MAX_DOWNLINK_SIZE, 12, _moduleType == RN2903 ? 500 : 125);
+
+  uint16_t rxDelay1 = 1000;
+  if (_rxDelay1 > 0)
+  {
+    rxDelay1 = _rxDelay1;
+  }
+  else
+  {
+    getRxDelay1(rxDelay1);
+  }
+
+  unsigned long deadline = timeOnAir(payloadSize) + rxDelay1 + RX2_DELAY +
+                           (downlink + 999) / 1000 + DEADLINE_MARGIN;
+
+  if (confirmed)
+  {
+    // Every retransmission waits for its own receive windows
+    uint32_t retx;
+    if (_retx == 0xFF && queryUnsigned(F("mac get retx"), retx))
+    {
+      _retx = retx;
     }
+    deadline = (deadline + ACK_TIMEOUT) * ((_retx != 0xFF ? _retx : 7) + 1);
+  }
+  return deadline;
+}
+
+#if RN2XX3_OTAA
+unsigned long rn2xx3::joinDeadline()
+{
+  uint8_t sf;
+  uint16_t bandwidth;
+  if (!dataRate(currentDataRate(), sf, bandwidth))
+  {
+    sf = 12;
+  }
+  uint32_t request = packetAirtime(JOIN_REQUEST_SIZE, sf, bandwidth);
+  uint32_t accept = packetAirtime(JOIN_ACCEPT_SIZE, 12, _moduleType == RN2903 ? 500 : 125);
+
+  return (request + accept + 999) / 1000 + JOIN_ACCEPT_DELAY2 + DEADLINE_MARGIN;
+}
+#endif
+
+void rn2xx3::trackSetting(const String& command)
+{
+  if (command.startsWith(F("mac reset")))
+  {
+    forgetSettings();
+    _adr = false;
+  }
+  else if (command.startsWith(F("mac set dr ")))
+  {
+    _dr = command.substring(11).toInt();
+#if RN2XX3_BATTERY
+    policyOverridden(_configuredDr, _dr);
+#endif
+  }
+  else if (command.startsWith(F("mac set pwridx ")))
+  {
+    _pwridx = command.substring(15).toInt();
+#if RN2XX3_BATTERY
+    policyOverridden(_configuredPwridx, _pwridx);
+#endif
+  }
+  else if (command.startsWith(F("mac set retx ")))
+  {
+    _retx = command.substring(13).toInt();
+  }
+  else if (command.startsWith(F("mac set rxdelay1 ")))
+  {
+    _rxDelay1 = command.substring(17).toInt();
+  }
+  else if (command.startsWith(F("mac set adr ")))
+  {
+    _adr = command.endsWith(F("on"));
+  }
+}
+
+void rn2xx3::forgetSettings()
+{
+  _dr = 0xFF;
+  _retx = 0xFF;
+  _rxDelay1 = 0;
+  _pwridx = 0xFF;
+}
+
+#if RN2XX3_DIAGNOSTICS
+const rn2xx3_deadline_stats& rn2xx3::getDeadlineStats(RN2xx3_wait kind)
+{
+  return _deadlineStats[kind < WAIT_KINDS ? kind : WAIT_REPLY];
+}
+
+void rn2xx3::resetDeadlineStats()
+{
+  memset(_deadlineStats, 0, sizeof(_deadlineStats));
+}
+#endif
+
+void rn2xx3::sendEncoded(const String& input)
+{
+  char buffer[3];
+  for (unsigned i=0; i<input.length(); i++)
+  {
+    sprintf(buffer, "%02x", static_cast<int>(input.charAt(i)));
+    countUart(_serial.print(buffer));
+  }
+}
+
+void rn2xx3::countUart(size_t chars)
+{
+#if RN2XX3_ENERGY
+  if (_energyKind < ENERGY_KINDS)
+  {
+    _uartChars += chars;
+  }
+#else
+  (void)chars;
+#endif
+}
+
+#if RN2XX3_ENERGY
+const rn2xx3_energy_stats& rn2xx3::getEnergyStats(RN2xx3_energy kind)
+{
+  return _energyStats[kind < ENERGY_KINDS ? kind : ENERGY_UPLINK];
+}
+
+void rn2xx3::resetEnergyStats()
+{
+  memset(_energyStats, 0, sizeof(_energyStats));
+}
+
+void rn2xx3::setEnergyProfile(const rn2xx3_energy_profile& profile)
+{
+  _energyProfile = &profile;
+}
+
+const rn2xx3_energy_profile& rn2xx3::energyProfile()
+{
+  if (_energyProfile != NULL)
+  {
+    return *_energyProfile;
+  }
+  return _moduleType == RN2903 ? rn2xx3_energy_rn2903 : rn2xx3_energy_rn2483;
+}
+
+uint32_t rn2xx3::energy(uint16_t current, uint32_t ms)
+{
+  // 0.1 mA for 1 ms is 0.1 uC, and 1 uC at 1 mV is 1 nJ
+  uint32_t charge = (uint32_t)current * ms / 10;
+  uint16_t millivolts = energyProfile().supplyMv;
+#if RN2XX3_BATTERY
+  if (_vdd > 0)
+  {
+    // The measured supply voltage is better than the nominal one
+    millivolts = _vdd;
+  }
+#endif
+  return charge / 1000 * millivolts + charge % 1000 * millivolts / 1000;
+}
+
+static void addMeter(rn2xx3_energy_meter& to, const rn2xx3_energy_meter& end, const rn2xx3_energy_meter& start)
+{
+  to.microjoules += end.microjoules - start.microjoules;
+  to.awakeMs += end.awakeMs - start.awakeMs;
+  to.airtimeMs += end.airtimeMs - start.airtimeMs;
+  to.rxMs += end.rxMs - start.rxMs;
+}
+
+void rn2xx3::energyFlush()
+{
+  unsigned long now = millis();
+  if (_energyKind < ENERGY_KINDS)
+  {
+    const rn2xx3_energy_profile& profile = energyProfile();
+    uint32_t awake = now - _energyMark;
+    _energyMeter.awakeMs += awake;
+    _energyMeter.microjoules += energy(profile.idle, awake);
+
+    // Ten bits per character, keep the characters of less than a millisecond
+    uint32_t uartMs = _uartChars * 10000UL / _baud;
+    _energyMeter.microjoules += energy(profile.uart, uartMs);
+    _uartChars -= uartMs * _baud / 10000UL;
+  }
+  _energyMark = now;
+}
+
+void rn2xx3::energyRadio(uint32_t airtimeMs, uint32_t rxMs)
+{
+  if (_energyKind >= ENERGY_KINDS)
+  {
+    return;
+  }
+  const rn2xx3_energy_profile& profile = energyProfile();
+  uint8_t pwridx = _pwridx;
+  if (pwridx >= sizeof(profile.tx) / sizeof(profile.tx[0]))
+  {
+    // What the init functions set
+    pwridx = _moduleType == RN2903 ? 5 : 1;
+  }
+  uint16_t tx = profile.tx[pwridx];
+
+  // The idle current already flows the whole time
+  _energyMeter.airtimeMs += airtimeMs;
+  _energyMeter.microjoules += energy(tx > profile.idle ? tx - profile.idle : 0, airtimeMs);
+  _energyMeter.rxMs += rxMs;
+  _energyMeter.microjoules += energy(profile.rx > profile.idle ? profile.rx - profile.idle : 0, rxMs);
+}
+
+void rn2xx3::energyUplink(uint8_t payloadSize, bool confirmed, received_t reply, const String& receivedData)
+{
+  uint8_t sf;
+  uint16_t bandwidth;
+  if (!dataRate(currentDataRate(), sf, bandwidth))
+  {
+    sf = 12;
+  }
+  uint32_t window = ((uint32_t)RX_WINDOW_SYMBOLS << sf) / bandwidth;
+  uint32_t airtime = timeOnAir(payloadSize);
+  uint32_t rx = 2 * window;
+  uint8_t attempts = 1;
+
+  if (reply == rn2xx3::mac_rx)
+  {
+    // The downlink came in one window: "mac_rx <port> <data>"
+#if RN2XX3_DOWNLINK
+    (void)receivedData;
+    uint8_t size = _rxLength;
+#else
+    int data = receivedData.indexOf(' ', 7);
+    uint8_t size = data > 0 ? (receivedData.length() - data - 1) / 2 : 0;
+#endif
+    rx = window + (packetAirtime(size + LORAWAN_OVERHEAD, sf, bandwidth) + 999) / 1000;
+  }
+  else if (reply == rn2xx3::mac_err && confirmed)
+  {
+    // No acknowledgement came, after all retransmissions
+    attempts = (_retx != 0xFF ? _retx : 7) + 1;
+  }
+  else if (reply == rn2xx3::radio_tx_ok)
+  {
+    rx = 0;
   }
+  energyRadio(attempts * airtime, attempts * rx);
+}
 
-  return TX_FAIL; //should never reach this
+void rn2xx3::energyJoin(bool accepted)
+{
+  uint8_t sf;
+  uint16_t bandwidth;
+  if (!dataRate(currentDataRate(), sf, bandwidth))
+  {
+    sf = 12;
+  }
+  uint32_t window = ((uint32_t)RX_WINDOW_SYMBOLS << sf) / bandwidth;
+  uint32_t airtime = (packetAirtime(JOIN_REQUEST_SIZE, sf, bandwidth) + 999) / 1000;
+  uint32_t rx = 2 * window;
+  if (accepted)
+  {
+    rx = window + (packetAirtime(JOIN_ACCEPT_SIZE, sf, bandwidth) + 999) / 1000;
+  }
+  energyRadio(airtime, rx);
 }
 
-void rn2xx3::sendEncoded(const String& input)
+rn2xx3::energy_scope::energy_scope(rn2xx3& lora, RN2xx3_energy kind):
+_lora(lora),
+_parentKind(lora._energyKind),
+_parentSpent(lora._energySpent)
 {
-  char buffer[3];
-  for (unsigned i=0; i<input.length(); i++)
+  _lora.energyFlush();
+  addMeter(_parentSpent, _lora._energyMeter, _lora._energyStart);
+  _lora._energyKind = kind;
+  _lora._energySpent = rn2xx3_energy_meter();
+  _lora._energyStart = _lora._energyMeter;
+}
+
+rn2xx3::energy_scope::~energy_scope()
+{
+  _lora.energyFlush();
+  rn2xx3_energy_meter spent = _lora._energySpent;
+  addMeter(spent, _lora._energyMeter, _lora._energyStart);
+
+  rn2xx3_energy_stats& stats = _lora._energyStats[_lora._energyKind];
+  stats.operations++;
+  stats.lastMicrojoules = spent.microjoules;
+  uint32_t microjoules = stats.microjoules + spent.microjoules;
+  stats.millijoules += microjoules / 1000;
+  stats.microjoules = microjoules % 1000;
+  stats.awakeMs += spent.awakeMs;
+  stats.airtimeMs += spent.airtimeMs;
+  stats.rxMs += spent.rxMs;
+
+  _lora._energyKind = _parentKind;
+  _lora._energySpent = _parentSpent;
+  _lora._energyStart = _lora._energyMeter;
+  if (_parentKind >= ENERGY_KINDS)
   {
-    sprintf(buffer, "%02x", static_cast<int>(input.charAt(i)));
-    _serial.print(buffer);
+    _lora._uartChars = 0;
   }
 }
+#endif
 
+#if RN2XX3_STRING_HELPERS
 String rn2xx3::base16encode(const String& input_c)
 {
   String input(input_c); // Make a deep copy to be able to do trim()
@@ -557,21 +2232,458 @@ String rn2xx3::base16encode(const String& input_c)
   }
   return output;
 }
+#endif
+
+static int8_t hexNibble(char c)
+{
+  // Valid for 0-9, A-F and a-f. Everything else is rejected below.
+  if (c >= '0' && c <= '9') return c - '0';
+  c |= 0x20; // to lower case
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+#if RN2XX3_DOWNLINK
+bool rn2xx3::readRx(unsigned long start, unsigned long timeout)
+{
+  _rxPort = 0;
+  _rxLength = 0;
+  bool inPort = true;
+  bool truncated = false;
+  int8_t high = -1;
+  int c;
+
+  while ((c = readChar(start, timeout)) >= 0 && c != '\n')
+  {
+    if (inPort)
+    {
+      if (c >= '0' && c <= '9')
+      {
+        _rxPort = _rxPort * 10 + (c - '0');
+      }
+      else
+      {
+        inPort = false;
+      }
+      continue;
+    }
+
+    // Skips the space and the '\r' at the end
+    int8_t nibble = hexNibble(c);
+    if (nibble < 0)
+    {
+      continue;
+    }
+    if (high < 0)
+    {
+      high = nibble;
+      continue;
+    }
+    if (_rxLength < sizeof(_rx))
+    {
+      _rx[_rxLength++] = (high << 4) | nibble;
+    }
+    else
+    {
+      truncated = true;
+    }
+    high = -1;
+  }
+
+  RN2XX3_LOG_D(F("< mac_rx "), _rxPort, F(", "), _rxLength, F(" bytes ("), millis() - start, F(" ms)"));
+  if (truncated)
+  {
+    RN2XX3_LOG_E(F("downlink cut off at "), sizeof(_rx), F(" bytes"));
+  }
+  return c == '\n';
+}
+
+void rn2xx3::deliverRx()
+{
+  _rxPending = true;
+  RN2XX3_LOG_I(F("downlink on port "), _rxPort);
+
+  if (_rxHandler != NULL)
+  {
+    _rxHandler(_rxPort);
+  }
+}
+
+bool rn2xx3::setClassC(bool enabled)
+{
+  if (enabled && !hasFeature(FEATURE_CLASS_C))
+  {
+    return false;
+  }
+  _classC = enabled;
+  return sendMacSet(F("class"), enabled ? F("c") : F("a"));
+}
+
+void rn2xx3::setRxHandler(void (*handler)(uint8_t port))
+{
+  _rxHandler = handler;
+}
+
+bool rn2xx3::poll()
+{
+  clearSerial();
+  bool pending = _rxPending;
+  _rxPending = false;
+  return pending;
+}
 
 String rn2xx3::getRx() {
-  return _rxMessenge;
+  String hex;
+  hex.reserve(_rxLength * 2);
+  char buffer[3];
+  for (uint8_t i = 0; i < _rxLength; i++)
+  {
+    sprintf(buffer, "%02X", _rx[i]);
+    hex += buffer;
+  }
+  return hex;
+}
+
+size_t rn2xx3::getRxBytes(uint8_t* buf, size_t cap, uint8_t* port)
+{
+  if (port)
+  {
+    *port = _rxPort;
+  }
+  size_t length = _rxLength < cap ? _rxLength : cap;
+  memcpy(buf, _rx, length);
+  return length;
+}
+#endif
+
+size_t rn2xx3::decodeHex(const char* hex, uint8_t* out, size_t cap)
+{
+  size_t count = 0;
+  while (count < cap)
+  {
+    int8_t high = hexNibble(hex[0]);
+    if (high < 0) break;
+    int8_t low = hexNibble(hex[1]);
+    if (low < 0) break;
+    out[count++] = (high << 4) | low;
+    hex += 2;
+  }
+  return count;
 }
 
 int rn2xx3::getSNR()
 {
-  return readIntValue(F("radio get snr"));
+  int8_t snr = 0;
+  getSNR(snr);
+  return snr;
 }
 
 int rn2xx3::getVbat()
 {
-  return readIntValue(F("sys get vdd"));
+#if RN2XX3_BATTERY
+  if (_vdd > 0 && _vddPeriod > 0 && millis() - _vddAt < _vddPeriod * 1000UL)
+  {
+    return _vdd;
+  }
+#endif
+  uint16_t vdd = 0;
+  getVdd(vdd);
+  return vdd;
+}
+
+#if RN2XX3_BATTERY
+void rn2xx3::setBatteryPolicy(void (*policy)(uint16_t vddMv, rn2xx3_battery_policy& policy), uint16_t period)
+{
+  _batteryPolicy = policy;
+  _vddPeriod = period;
+  // Run the new policy at the next uplink
+  _policyDue = _vdd > 0;
+}
+
+uint16_t rn2xx3::cachedVdd()
+{
+  return _vdd;
+}
+
+const rn2xx3_battery_policy& rn2xx3::getBatteryPolicy()
+{
+  return _policy;
+}
+
+void rn2xx3::cacheVdd(uint16_t vdd)
+{
+  _vdd = vdd;
+  _vddAt = millis();
+  _policyDue = true;
+}
+
+void rn2xx3::sampleVdd()
+{
+  if (_vddPeriod == 0)
+  {
+    return;
+  }
+  if (_vdd == 0 || millis() - _vddAt >= _vddPeriod * 1000UL)
+  {
+    uint16_t vdd;
+    getVdd(vdd);
+  }
+  if (_policyDue)
+  {
+    applyBatteryPolicy();
+  }
+}
+
+void rn2xx3::policyOverridden(uint8_t& configured, uint8_t value)
+{
+  if (configured != 0xFF && !_applyingPolicy)
+  {
+    configured = value;
+    _policyDue = true;
+  }
+}
+
+void rn2xx3::applyBatteryPolicy()
+{
+  _policyDue = false;
+  rn2xx3_battery_policy policy = {0xFF, 0xFF, false, 0, false, 0};
+  if (_batteryPolicy != NULL)
+  {
+    _batteryPolicy(_vdd, policy);
+  }
+
+  // Remember what the application set before overriding it, and go back
+  // to that when the policy no longer overrides it
+  _applyingPolicy = true;
+  uint8_t value;
+  if (!_adr)
+  {
+    if (policy.dataRate != 0xFF && _configuredDr == 0xFF)
+    {
+      _configuredDr = _dr != 0xFF ? _dr : (getDataRate(value) ? value : 0xFF);
+    }
+    uint8_t dr = policy.dataRate != 0xFF ? policy.dataRate : _configuredDr;
+    if (dr != 0xFF && dr != _dr)
+    {
+      sendMacSet(F("dr"), String(dr));
+    }
+    if (policy.dataRate == 0xFF)
+    {
+      _configuredDr = 0xFF;
+    }
+  }
+
+  if (policy.powerIndex != 0xFF && _configuredPwridx == 0xFF)
+  {
+    _configuredPwridx = _pwridx != 0xFF ? _pwridx : (getPowerIndex(value) ? value : 0xFF);
+  }
+  uint8_t pwridx = policy.powerIndex != 0xFF ? policy.powerIndex : _configuredPwridx;
+  if (pwridx != 0xFF && pwridx != _pwridx)
+  {
+    setTXoutputPower(pwridx);
+  }
+  if (policy.powerIndex == 0xFF)
+  {
+    _configuredPwridx = 0xFF;
+  }
+  _applyingPolicy = false;
+
+  if (policy.defer != _policy.defer)
+  {
+    RN2XX3_LOG_I(policy.defer ? F("deferring uplinks at ") : F("uplinks resumed at "), _vdd, F(" mV"));
+  }
+  _policy = policy;
+}
+#endif
+
+bool rn2xx3::getSNR(int8_t& snr)
+{
+  int32_t value;
+  if (!querySigned(F("radio get snr"), value))
+  {
+    return false;
+  }
+  snr = value;
+  return true;
+}
+
+bool rn2xx3::getRSSI(int16_t& rssi)
+{
+  int32_t value;
+  if (!querySigned(F("radio get rssi"), value))
+  {
+    return false;
+  }
+  rssi = value;
+  return true;
+}
+
+bool rn2xx3::getVdd(uint16_t& millivolts)
+{
+  uint32_t value;
+  if (!queryUnsigned(F("sys get vdd"), value))
+  {
+    return false;
+  }
+  millivolts = value;
+#if RN2XX3_BATTERY
+  cacheVdd(millivolts);
+#endif
+  return true;
+}
+
+bool rn2xx3::getHweui(uint8_t eui[8])
+{
+  char reply[20];
+  if (!query(F("sys get hweui"), reply, sizeof(reply)) || strlen(reply) != 16 ||
+      decodeHex(reply, eui, 8) != 8)
+  {
+    return false;
+  }
+
+  if (!_hweuiValid || memcmp(eui, _hweui, sizeof(_hweui)) != 0)
+  {
+    memcpy(_hweui, eui, sizeof(_hweui));
+    _hweuiValid = true;
+    saveIdentity();
+  }
+  return true;
+}
+
+bool rn2xx3::getUpctr(uint32_t& upctr)
+{
+  return queryUnsigned(F("mac get upctr"), upctr);
+}
+
+bool rn2xx3::getDnctr(uint32_t& dnctr)
+{
+  return queryUnsigned(F("mac get dnctr"), dnctr);
+}
+
+bool rn2xx3::getDataRate(uint8_t& dr)
+{
+  uint32_t value;
+  if (!queryUnsigned(F("mac get dr"), value))
+  {
+    return false;
+  }
+  dr = _dr = value;
+  return true;
+}
+
+bool rn2xx3::getPowerIndex(uint8_t& pwridx)
+{
+  uint32_t value;
+  if (!queryUnsigned(F("mac get pwridx"), value))
+  {
+    return false;
+  }
+  pwridx = value;
+  return true;
+}
+
+bool rn2xx3::getRxDelay1(uint16_t& ms)
+{
+  uint32_t value;
+  if (!queryUnsigned(F("mac get rxdelay1"), value))
+  {
+    return false;
+  }
+  ms = _rxDelay1 = value;
+  return true;
+}
+
+bool rn2xx3::getStatus(rn2xx3_status& status)
+{
+  uint32_t raw;
+  if (!queryUnsigned(F("mac get status"), raw, 16))
+  {
+    return false;
+  }
+
+  status.raw = raw;
+  status.joined = raw & 0x0001;
+  status.macState = (raw >> 1) & 0x07;
+  status.automaticReply = raw & 0x0010;
+  status.adr = raw & 0x0020;
+  status.silent = raw & 0x0040;
+  status.paused = raw & 0x0080;
+  status.rxDone = raw & 0x0100;
+  status.linkCheck = raw & 0x0200;
+  status.channelsUpdated = raw & 0x0400;
+  status.outputPowerUpdated = raw & 0x0800;
+  status.nbRepUpdated = raw & 0x1000;
+  status.prescalerUpdated = raw & 0x2000;
+  status.rx2Updated = raw & 0x4000;
+  status.rxTimingUpdated = raw & 0x8000;
+  status.rejoinNeeded = raw & 0x10000UL;
+  status.multicast = raw & 0x20000UL;
+  return true;
+}
+
+bool rn2xx3::snapshot(rn2xx3_snapshot& snapshot)
+{
+  // Every command waits for the reply to the previous one, so no
+  // extra pause is needed between them
+  uint32_t value;
+  int32_t signedValue;
+  bool complete = getStatus(snapshot.status);
+
+  complete &= queryUnsigned(F("mac get upctr"), snapshot.upctr, 10, false);
+  complete &= queryUnsigned(F("mac get dnctr"), snapshot.dnctr, 10, false);
+
+  if (queryUnsigned(F("sys get vdd"), value, 10, false))
+  {
+    snapshot.vdd = value;
+#if RN2XX3_BATTERY
+    cacheVdd(value);
+#endif
+  }
+  else
+  {
+    complete = false;
+  }
+
+  if (queryUnsigned(F("mac get rxdelay1"), value, 10, false))
+  {
+    snapshot.rxDelay1 = _rxDelay1 = value;
+  }
+  else
+  {
+    complete = false;
+  }
+
+  if (queryUnsigned(F("mac get dr"), value, 10, false))
+  {
+    snapshot.dr = _dr = value;
+  }
+  else
+  {
+    complete = false;
+  }
+
+  if (queryUnsigned(F("mac get pwridx"), value, 10, false))
+  {
+    snapshot.pwridx = value;
+  }
+  else
+  {
+    complete = false;
+  }
+
+  if (querySigned(F("radio get snr"), signedValue, false))
+  {
+    snapshot.snr = signedValue;
+  }
+  else
+  {
+    complete = false;
+  }
+
+  return complete;
 }
 
+#if RN2XX3_STRING_HELPERS
 String rn2xx3::base16decode(const String& input_c)
 {
   String input(input_c); // Make a deep copy to be able to do trim()
@@ -581,25 +2693,31 @@ String rn2xx3::base16decode(const String& input_c)
   String output;
   output.reserve(outputLength);
 
+  const char* hex = input.c_str();
   for(size_t i = 0; i < outputLength; ++i)
   {
-    char toDo[3];
-    toDo[0] = input[i*2];
-    toDo[1] = input[i*2+1];
-    toDo[2] = '\0';
-    int out = strtoul(toDo, 0, 16);
-    if((out & 0xFF) == 0)
+    uint8_t out;
+    if (decodeHex(&hex[i*2], &out, 1) != 1)
     {
-      output += char(out);
+      break;
     }
+    output += char(out);
   }
   return output;
 }
+#endif
 
 void rn2xx3::setDR(int dr)
 {
   if(dr>=0 && dr<=5)
   {
+#if RN2XX3_BATTERY
+    if (_configuredDr != 0xFF)
+    {
+      _configuredDr = dr;
+      return;
+    }
+#endif
     sendMacSet(F("dr"), String(dr));
   }
 }
@@ -613,19 +2731,31 @@ void rn2xx3::sleep(long msec)
 String rn2xx3::sendRawCommand(const String& command)
 {
   delay(100);
-  while(_serial.available())
-    _serial.read();
-  _serial.println(command);
+  clearSerial();
+  countUart(_serial.println(command));
+  RN2XX3_LOG_D(F("> "), command);
 
-  String ret = _serial.readStringUntil('\n');
+  unsigned long timeout = commandTimeout(command);
+  String ret = readLine(timeout);
   ret.trim();
 
+  if (ret.startsWith(F("RN2")) && !command.startsWith(F("sys get ver")))
+  {
+    // The module rebooted and printed its version. The reply follows.
+    parseVersion(ret);
+    ret = readLine(timeout);
+    ret.trim();
+  }
+
   if (ret.equals(F("invalid_param")))
   {
     _lastErrorInvalidParam = command;
+    RN2XX3_LOG_E(F("invalid_param: "), command);
+  }
+  else if (ret.equals(F("ok")))
+  {
+    trackSetting(command);
   }
-
-  //TODO: Add debug print
 
   return ret;
 }
@@ -641,6 +2771,7 @@ bool rn2xx3::setFrequencyPlan(FREQ_PLAN fp)
 
   switch (fp)
   {
+#if RN2XX3_PLAN_SINGLE_CHANNEL_EU
     case SINGLE_CHANNEL_EU:
     {
       if(_moduleType == RN2483)
@@ -663,7 +2794,9 @@ bool rn2xx3::setFrequencyPlan(FREQ_PLAN fp)
       }
       break;
     }
+#endif
 
+#if RN2XX3_PLAN_TTN_EU
     case TTN_EU:
     {
       if(_moduleType == RN2483)
@@ -712,7 +2845,9 @@ bool rn2xx3::setFrequencyPlan(FREQ_PLAN fp)
 
       break;
     }
+#endif
 
+#if RN2XX3_PLAN_TTN_US
     case TTN_US:
     {
     /*
@@ -734,7 +2869,9 @@ bool rn2xx3::setFrequencyPlan(FREQ_PLAN fp)
       }
       break;
     }
+#endif
 
+#if RN2XX3_PLAN_DEFAULT_EU
     case DEFAULT_EU:
     {
       if(_moduleType == RN2483)
@@ -759,6 +2896,8 @@ bool rn2xx3::setFrequencyPlan(FREQ_PLAN fp)
 
       break;
     }
+#endif
+
     default:
     {
       //set default channels 868.1, 868.3 and 868.5?
@@ -814,11 +2953,63 @@ rn2xx3::received_t rn2xx3::determineReceivedDataType(const String& receivedData)
 }
 
 
-int rn2xx3::readIntValue(const String& command)
+bool rn2xx3::query(const __FlashStringHelper* command, char* buf, size_t cap, bool paced)
+{
+  if (paced)
+  {
+    delay(100);
+  }
+  clearSerial();
+  countUart(_serial.println(command));
+  RN2XX3_LOG_D(F("> "), command);
+
+  if (!readLine(buf, cap, REPLY_TIMEOUT))
+  {
+    return false;
+  }
+
+  if (strncmp(buf, "RN2", 3) == 0)
+  {
+    // The module rebooted and printed its version. The reply follows.
+    _identityValid = false;
+    forgetSettings();
+    return readLine(buf, cap, REPLY_TIMEOUT);
+  }
+  return true;
+}
+
+bool rn2xx3::queryUnsigned(const __FlashStringHelper* command, uint32_t& value, int base, bool paced)
+{
+  char reply[24];
+  char* end;
+  if (!query(command, reply, sizeof(reply), paced) || !isxdigit(reply[0]))
+  {
+    return false;
+  }
+  uint32_t parsed = strtoul(reply, &end, base);
+  if (*end != '\0')
+  {
+    return false;
+  }
+  value = parsed;
+  return true;
+}
+
+bool rn2xx3::querySigned(const __FlashStringHelper* command, int32_t& value, bool paced)
 {
-  String value = sendRawCommand(command);
-  value.trim();
-  return value.toInt();
+  char reply[24];
+  char* end;
+  if (!query(command, reply, sizeof(reply), paced) || reply[0] == '\0')
+  {
+    return false;
+  }
+  int32_t parsed = strtol(reply, &end, 10);
+  if (*end != '\0')
+  {
+    return false;
+  }
+  value = parsed;
+  return true;
 }
 
 String rn2xx3::getLastErrorInvalidParam() 
@@ -11,6 +11,14 @@
 #define rn2xx3_h
 
 #include "Arduino.h"
+#include "rn2xx3_config.h"
+#include "rn2xx3_storage.h"
+#if RN2XX3_JOURNAL
+#include "rn2xx3_journal.h"
+#endif
+#if RN2XX3_REPORT_FILTER
+#include "rn2xx3_report.h"
+#endif
 
 enum RN2xx3_t {
   RN_NA = 0, // Not set
@@ -18,6 +26,18 @@ enum RN2xx3_t {
   RN2483 = 2483
 };
 
+/*
+ * Optional commands that depend on the firmware version of the module.
+ * Use hasFeature() to check if the connected module supports them.
+ */
+enum RN2xx3_feature {
+  FEATURE_CLASS_C = 0x01,   // "mac set class c", firmware 1.0.5 and newer
+  FEATURE_RADIO_RSSI = 0x02 // "radio get rssi", firmware 1.0.5 and newer
+};
+
+// Firmware version as returned by firmwareVersion(), 1.0.4 is 0x0104
+#define RN2XX3_FIRMWARE(major, minor, patch) (((major) << 8) | ((minor) << 4) | (patch))
+
 enum FREQ_PLAN {
   SINGLE_CHANNEL_EU,
   TTN_EU,
@@ -33,8 +53,184 @@ enum TX_RETURN_TYPE {
   TX_SUCCESS = 1, // The transmission was successful.
                   // Also the case when a confirmed message was acked.
 
-  TX_WITH_RX = 2  // A downlink message was received after the transmission.
+  TX_WITH_RX = 2, // A downlink message was received after the transmission.
                   // This also implies that a confirmed message is acked.
+
+  TX_SUPPRESSED = 3, // Nothing was sent, because the values did not change.
+                     // Only returned by report().
+
+  TX_DEFERRED = 4    // Nothing was sent, the battery policy holds uplinks
+                     // like this one back. Send it again later.
+};
+
+// Room to leave in an uplink, below maxPayload(), for MAC commands the
+// module piggybacks, like link check requests and ADR acknowledgements.
+// FOpts holds 15 bytes at most.
+#define RN2XX3_FOPTS_RESERVE 15
+
+/*
+ * How txCommand() recovered from a fault, from the cheapest to the most
+ * expensive step. A fault that returns after its step was taken is handled
+ * by the next, more expensive step, and one that returns after a reset
+ * fails the transmission.
+ */
+enum RN2xx3_recovery {
+  RECOVERY_NONE = 0,  // No fault
+  RECOVERY_RETRY,     // Retried after a short wait: no_free_ch, busy or mac_err
+  RECOVERY_RESUME,    // "mac resume" after mac_paused
+  RECOVERY_WAIT,      // Waited out the silent state
+  RECOVERY_ENABLE,    // "mac forceENABLE" when the module stayed silent
+  RECOVERY_RESYNC,    // Drained the serial line after an unknown reply
+  RECOVERY_REJOIN,    // Joined again after not_joined or a frame counter error
+  RECOVERY_REINIT,    // Full init(): reset, configuration and join
+  RECOVERY_STEPS
+};
+
+struct rn2xx3_recovery_stats {
+  uint16_t resolved[RECOVERY_STEPS];   // Transmissions that succeeded after each step
+  uint32_t recoveryMs[RECOVERY_STEPS]; // Time from the first fault to success, summed
+  uint16_t unresolved;                 // Transmissions that failed despite recovery
+};
+
+/*
+ * The replies the library waits for. Each has its own deadline: a few
+ * seconds for the direct reply to a command, and the airtime plus receive
+ * windows at the current data rate for the end of a transmission or join.
+ */
+enum RN2xx3_wait {
+  WAIT_REPLY = 0, // The direct reply to a command
+  WAIT_TX,        // The final reply to "mac tx"
+  WAIT_JOIN,      // The final reply to "mac join otaa"
+  WAIT_KINDS
+};
+
+#define RN2XX3_DEADLINE_BUCKETS 8
+
+struct rn2xx3_deadline_stats {
+  uint16_t buckets[RN2XX3_DEADLINE_BUCKETS]; // Replies by the part of their deadline used, in eighths
+  uint16_t expired;                          // Waits that reached the deadline without a reply
+  uint32_t longestMs;                        // The slowest reply
+};
+
+/*
+ * How to transmit at the supply voltage of the last reading, filled in by
+ * the policy of setBatteryPolicy().
+ */
+struct rn2xx3_battery_policy {
+  uint8_t dataRate;    // Data rate to switch to, 0xFF for the one the application set.
+                       // Ignored while ADR is on.
+  uint8_t powerIndex;  // Power index to switch to, 0xFF for the one the application set
+  bool unconfirmed;    // Send confirmed uplinks unconfirmed, without retransmissions
+  uint16_t interval;   // Seconds the application should wait between uplinks, 0 for no advice
+  bool defer;          // Hold back the expensive uplinks: confirmed ones, and ones on
+                       // air for longer than maxAirtime
+  uint16_t maxAirtime; // Milliseconds on air above which defer holds an uplink back,
+                       // 0 for no limit
+};
+
+/*
+ * The operations getEnergyStats() keeps apart. The energy of a join or
+ * re-init that an uplink needed is counted there, and not for the uplink.
+ */
+enum RN2xx3_energy {
+  ENERGY_UPLINK = 0, // A transmission, with its retries and recovery steps
+  ENERGY_JOIN,       // "mac join", with its retry
+  ENERGY_REINIT,     // Reset and configuration of init(), initOTAA() or initABP()
+  ENERGY_KINDS
+};
+
+/*
+ * Current draw of a module, in 0.1 mA. The defaults for the RN2483 and
+ * RN2903 come from their datasheets. Measure your own board for better
+ * estimates.
+ */
+struct rn2xx3_energy_profile {
+  uint16_t supplyMv; // Supply voltage
+  uint16_t idle;     // Awake, waiting for commands or a receive window
+  uint16_t rx;       // Listening in a receive window
+  uint16_t uart;     // On top of idle while characters go over the UART
+  uint16_t tx[11];   // On the air, by power index
+};
+
+extern const rn2xx3_energy_profile rn2xx3_energy_rn2483;
+extern const rn2xx3_energy_profile rn2xx3_energy_rn2903;
+
+struct rn2xx3_energy_stats {
+  uint32_t operations;
+  uint32_t millijoules;     // All operations together
+  uint16_t microjoules;     // Below a millijoule, so small operations add up
+  uint32_t lastMicrojoules; // The last operation
+  uint32_t awakeMs;         // Time the operations took
+  uint32_t airtimeMs;       // Of that, time on the air
+  uint32_t rxMs;            // And time listening in receive windows
+};
+
+// Running totals of the energy meter
+struct rn2xx3_energy_meter {
+  uint32_t microjoules;
+  uint32_t awakeMs;
+  uint32_t airtimeMs;
+  uint32_t rxMs;
+};
+
+/*
+ * The state of the LoRaWAN stack, bits 1 to 3 of "mac get status".
+ */
+enum RN2xx3_mac_state {
+  MAC_IDLE = 0,
+  MAC_TRANSMITTING = 1,
+  MAC_BEFORE_RX1 = 2,
+  MAC_RX1_OPEN = 3,
+  MAC_BETWEEN_RX1_RX2 = 4,
+  MAC_RX2_OPEN = 5,
+  MAC_RETRANSMISSION_DELAY = 6,
+  MAC_ABP_DELAY = 7
+};
+
+/*
+ * The reply of "mac get status", decoded.
+ */
+struct rn2xx3_status {
+  uint32_t raw;
+  uint8_t macState;           // An RN2xx3_mac_state
+  bool joined : 1;
+  bool automaticReply : 1;
+  bool adr : 1;
+  bool silent : 1;
+  bool paused : 1;
+  bool rxDone : 1;
+  bool linkCheck : 1;
+  bool channelsUpdated : 1;
+  bool outputPowerUpdated : 1;
+  bool nbRepUpdated : 1;
+  bool prescalerUpdated : 1;
+  bool rx2Updated : 1;
+  bool rxTimingUpdated : 1;
+  bool rejoinNeeded : 1;      // Firmware 1.0.5 and newer
+  bool multicast : 1;         // Firmware 1.0.5 and newer
+};
+
+/*
+ * A set of diagnostic values, read by snapshot() in one go.
+ */
+struct rn2xx3_snapshot {
+  rn2xx3_status status;
+  uint32_t upctr;     // Next uplink frame counter
+  uint32_t dnctr;     // Next expected downlink frame counter
+  uint16_t vdd;       // Supply voltage in mV
+  uint16_t rxDelay1;  // ms
+  uint8_t dr;
+  uint8_t pwridx;
+  int8_t snr;         // dB, of the last received packet
+};
+
+/*
+ * The answer to the last link check, see setLinkCheck().
+ */
+struct rn2xx3_link_check {
+  uint8_t margin;     // dB above the demodulation floor, at the best gateway
+  uint8_t gateways;   // Gateways that heard the uplink, 0 if no answer came
+  unsigned long atMs; // millis() when the answer was read
 };
 
 class rn2xx3
@@ -53,11 +249,38 @@ class rn2xx3
      */
     void autobaud();
 
+    /*
+     * Tell the library how to change the baud rate of the serial port
+     * to the module, and at which rate it is open now. Needed by setBaudRate().
+     *
+     *   void setLoraBaud(uint32_t baud) { Serial1.begin(baud); }
+     *   myLora.setHostBaudRate(setLoraBaud, 57600);
+     */
+    void setHostBaudRate(void (*setter)(uint32_t baud), uint32_t current);
+
+    /*
+     * Move the module and the host to another baud rate with the autobaud
+     * sequence of the module, and check the link with "sys get ver".
+     * If the module does not answer at the new rate, both sides go back to
+     * the previous rate and false is returned.
+     * The module returns to 57600 baud after a reset.
+     */
+    bool setBaudRate(uint32_t baud);
+    uint32_t baudRate();
+
+    /*
+     * Time in microseconds the UART needs for the command and the replies
+     * of an uplink with the given payload size, at the current baud rate.
+     * Payloads are sent as HEX, so every byte takes two characters.
+     */
+    uint32_t uartTime(uint8_t payloadSize);
+
     /*
      * Get the hardware EUI of the radio, so that we can register it on The Things Network
      * and obtain the correct AppKey.
      * You have to have a working serial connection to the radio before calling this function.
      * In other words you have to at least call autobaud() some time before this function.
+     * This always asks the module, so it can be used to check the connection.
      */
     String hweui();
 
@@ -92,9 +315,12 @@ class rn2xx3
      * This function can only be called after calling initABP() or initOTAA().
      * The sole purpose of this function is to re-initialise the radio if it
      * is in an unknown state.
+     * If the module is still joined with the same DevEUI (OTAA) or DevAddr
+     * (ABP), the session is resumed without a reset or a new join.
      */
     bool init();
 
+#if RN2XX3_ABP
     /*
      * Initialise the RN2xx3 and join a network using personalization.
      *
@@ -109,6 +335,22 @@ class rn2xx3
 
     //TODO: initABP(uint8_t * addr, uint8_t * AppSKey, uint8_t * NwkSKey)
 
+    /*
+     * Keep the LoRaWAN frame counters in persistent storage, so that an ABP
+     * session can be resumed after a reset without reusing frame counters.
+     * Call this before initABP().
+     *
+     * storage: The non-volatile memory to keep the counters in.
+     * address: The first of the 14 bytes used in the storage.
+     * stride: The number of uplinks between two writes to the storage.
+     *         After a reset the uplink counter continues at most stride
+     *         frames ahead of the last one used. A larger stride means
+     *         less wear on the storage.
+     */
+    void setFrameCounterStorage(rn2xx3_storage& storage, uint16_t address, uint16_t stride = 16);
+#endif
+
+#if RN2XX3_OTAA
     /*
      * Initialise the RN2xx3 and join a network using over the air activation.
      *
@@ -123,6 +365,8 @@ class rn2xx3
      * will be configured. If the module is already configured with some keys
      * they will be used. Otherwise the join will fail and this function
      * will return false.
+     * If the module is still joined using the same DevEUI and AppEUI, for
+     * example after only the host was reset, no new join is done.
      */
     bool initOTAA(const String& AppEUI="", const String& AppKey="", const String& DevEUI="");
 
@@ -136,6 +380,7 @@ class rn2xx3
      * DevEui: Device EUI as a uint8_t buffer (optional - set to 0 to use Hardware EUI)
      */
      bool initOTAA(uint8_t * AppEUI, uint8_t * AppKey, uint8_t * DevEui);
+#endif
 
     /*
      * Transmit the provided data. The data is hex-encoded by this library,
@@ -153,6 +398,11 @@ class rn2xx3
      */
     TX_RETURN_TYPE txBytes(const byte*, uint8_t);
 
+    /*
+     * Transmit raw bytes on the given LoRaWAN port (1 to 223).
+     */
+    TX_RETURN_TYPE txBytes(const byte* data, uint8_t size, uint8_t port, bool confirmed = false);
+
     /*
      * Do a confirmed transmission via LoRa WAN.
      *
@@ -177,15 +427,141 @@ class rn2xx3
      */
     TX_RETURN_TYPE txCommand(const String&, const String&, bool);
 
+#if RN2XX3_JOURNAL
+    /*
+     * Keep LoRaWAN uplinks that still fail after all recovery steps, or
+     * that are made while the module can not join, in a journal, and send
+     * them later. The journal survives resets of the host.
+     *
+     * drainPerUplink: journaled uplinks to send after every successful
+     *                 uplink, 0 to only send them from drainJournal().
+     *                 After an uplink that received a downlink they are
+     *                 sent before the next uplink, so the downlink can
+     *                 still be read.
+     */
+    void setJournal(rn2xx3_journal& journal, uint8_t drainPerUplink = 1);
+
+    /*
+     * Transmit raw bytes like txBytes(). If the uplink fails it is kept in
+     * the journal with this priority, 0 to 3, and higher priorities are
+     * sent first. txBytes() journals with priority 0.
+     */
+    TX_RETURN_TYPE txBytes(const byte* data, uint8_t size, uint8_t port, bool confirmed, uint8_t priority);
+
+    /*
+     * Send up to max journaled uplinks now, highest priority and oldest
+     * first, with a single attempt each. Stops at the first one that can
+     * not be sent, like when the duty cycle does not allow it yet.
+     * Returns the number sent.
+     */
+    uint8_t drainJournal(uint8_t max = 255);
+#endif
+
+#if RN2XX3_REPORT_FILTER
+    /*
+     * Transmit raw bytes only if the filter says an uplink is due: a value
+     * changed beyond its deadband, or the heartbeat interval passed. The
+     * filter learns what the network received from the result.
+     * Returns TX_SUPPRESSED if nothing was sent.
+     */
+    TX_RETURN_TYPE report(rn2xx3_report_filter& filter, const byte* data, uint8_t size,
+                          uint8_t port, bool confirmed = false);
+
+    /*
+     * Uplinks report() did not send, over all filters.
+     */
+    uint32_t suppressedUplinks();
+#endif
+
+#if RN2XX3_DIAGNOSTICS
+    /*
+     * The most expensive recovery step the last transmission needed,
+     * RECOVERY_NONE if it went through at the first attempt.
+     */
+    RN2xx3_recovery lastRecovery();
+
+    /*
+     * How often each recovery step resolved a fault, and how long that took.
+     * The mean time to recover with a step is recoveryMs / resolved.
+     */
+    const rn2xx3_recovery_stats& getRecoveryStats();
+    void resetRecoveryStats();
+#endif
+
+#if RN2XX3_ENERGY
+    /*
+     * Estimated energy of uplinks, joins and re-inits. The estimate adds
+     * the idle current for the time an operation takes, including its
+     * delays and waits for replies, and on top of that the transmit
+     * current for the airtime at the current data rate and power index,
+     * the receive current for the receive windows, and the UART current
+     * for the characters sent and received.
+     */
+    const rn2xx3_energy_stats& getEnergyStats(RN2xx3_energy kind);
+    void resetEnergyStats();
+
+    /*
+     * Use other currents than the default of the detected module.
+     * profile must stay valid while the library uses it.
+     */
+    void setEnergyProfile(const rn2xx3_energy_profile& profile);
+#endif
+
+    /*
+     * Time on air in milliseconds of an uplink with the given application
+     * payload size, at the data rate the module currently uses.
+     */
+    uint32_t timeOnAir(uint8_t payloadSize);
+
+    /*
+     * The largest application payload an uplink can carry at the data
+     * rate the module currently uses, or 0 if it is not known.
+     */
+    uint8_t maxPayload();
+
+#if RN2XX3_DIAGNOSTICS
+    /*
+     * How long replies took compared to their deadline, for each kind of wait.
+     */
+    const rn2xx3_deadline_stats& getDeadlineStats(RN2xx3_wait kind);
+    void resetDeadlineStats();
+#endif
+
     /*
      * Change the datarate at which the RN2xx3 transmits.
      * A value of between 0 and 5 can be specified,
      * as is defined in the LoRaWan specs.
      * This can be overwritten by the network when using OTAA.
      * So to force a datarate, call this function after initOTAA().
+     * While the battery policy overrides the data rate, dr is set once
+     * the policy stops overriding it.
      */
     void setDR(int dr);
 
+#if RN2XX3_LINK_CHECK
+    /*
+     * Ask the network every period seconds how well it hears the device.
+     * The request rides along with the next uplink after the period, so
+     * it costs no extra airtime. 0 switches link checks off.
+     *
+     * adaptDataRate: while ADR is off, step the data rate up when the
+     * margin and number of gateways leave room for it, and down when the
+     * margin is thin or the answer was lost.
+     */
+    bool setLinkCheck(uint16_t period, bool adaptDataRate = false);
+
+    /*
+     * Called with every link check result, right after the uplink that
+     * carried the request. The handler may send commands to the module.
+     */
+    void setLinkCheckHandler(void (*handler)(const rn2xx3_link_check& result));
+
+    /*
+     * The last link check result, all 0 before the first one.
+     */
+    const rn2xx3_link_check& getLinkCheck();
+#endif
+
     /*
      * Put the RN2xx3 to sleep for a specified timeframe.
      * The RN2xx3 accepts values from 100 to 4294967296.
@@ -205,6 +581,30 @@ class rn2xx3
      */
     RN2xx3_t moduleType();
 
+    /*
+     * Returns the firmware version of the module, for example
+     * RN2XX3_FIRMWARE(1, 0, 4), or 0 if the module was not detected yet.
+     */
+    uint16_t firmwareVersion();
+
+    /*
+     * Returns true if the firmware of the module supports the given feature.
+     */
+    bool hasFeature(RN2xx3_feature feature);
+
+    /*
+     * Keep the detected module identity (model, firmware version and hardware EUI)
+     * in persistent storage, so that it does not have to be read from the module
+     * after every reset of the host. The model and firmware version are only
+     * read from the module again when it prints its version banner after a
+     * reboot, and the hardware EUI only if they changed. The storage is only
+     * written when the identity changed.
+     *
+     * storage: The non-volatile memory to keep the identity in.
+     * address: The first of the 15 bytes used in the storage.
+     */
+    void setIdentityStorage(rn2xx3_storage& storage, uint16_t address);
+
     /*
      * Set the active channels to use.
      * Returns true if setting the channels is possible.
@@ -212,11 +612,57 @@ class rn2xx3
      */
     bool setFrequencyPlan(FREQ_PLAN);
 
+#if RN2XX3_DOWNLINK
     /*
-     * Returns the last downlink message HEX string.
+     * Returns the last downlink message HEX string. It is built on every
+     * call, getRxBytes() does not allocate memory.
      */
     String getRx();
 
+    /*
+     * Copy the last downlink message into a caller provided buffer, as raw
+     * bytes. Binary payloads containing 0x00 bytes are kept intact, and no
+     * memory is allocated. The payload was decoded from HEX as it arrived,
+     * up to RN2XX3_RX_MAX bytes.
+     *
+     * buf: buffer the payload is written to
+     * cap: size of buf in bytes
+     * port: if not NULL, receives the LoRaWAN port the downlink arrived on
+     *
+     * Returns the number of bytes written to buf. If the payload is larger
+     * than cap, only the first cap bytes are written.
+     */
+    size_t getRxBytes(uint8_t* buf, size_t cap, uint8_t* port = NULL);
+
+    /*
+     * Switch the module to class C, so it listens for downlinks all the
+     * time it is not transmitting, or back to class A. Class C needs
+     * FEATURE_CLASS_C. The class is set again before every join, because
+     * "mac reset" switches the module back to class A.
+     * Returns false if the module does not support class C.
+     */
+    bool setClassC(bool enabled);
+
+    /*
+     * Called with the port of every downlink that arrives on its own,
+     * outside the reply to a transmission, like class C downlinks do.
+     * The payload can be read with getRx() or getRxBytes() in the
+     * handler. The handler runs while a command may be waiting for its
+     * reply, so it must not send commands to the module itself.
+     *
+     *   void onDownlink(uint8_t port) { myLora.getRxBytes(buf, sizeof(buf)); }
+     *   myLora.setRxHandler(onDownlink);
+     */
+    void setRxHandler(void (*handler)(uint8_t port));
+
+    /*
+     * Read what the module sent since the last command without waiting,
+     * so downlinks are delivered while the sketch is idle.
+     * Returns true if a downlink arrived since the previous call to poll().
+     */
+    bool poll();
+#endif
+
     /*
      * Get the RN2xx3's SNR of the last received packet. Helpful to debug link quality.
      */
@@ -228,6 +674,63 @@ class rn2xx3
      */
     int getVbat();
 
+#if RN2XX3_BATTERY
+    /*
+     * Read the supply voltage at most every period seconds, only when the
+     * module is awake for an uplink anyway, and give every reading to
+     * policy. The policy starts from a neutral rn2xx3_battery_policy and
+     * changes what the voltage calls for:
+     *
+     *   void batteryPolicy(uint16_t vddMv, rn2xx3_battery_policy& policy)
+     *   {
+     *     if (vddMv < 3100) { policy.interval = 900; policy.powerIndex = 3; }
+     *     if (vddMv < 2900) { policy.defer = true; policy.maxAirtime = 400; }
+     *   }
+     *   myLora.setBatteryPolicy(batteryPolicy);
+     *
+     * The policy only runs on the way to an uplink. Data rate and power
+     * index are set then, and set back to what the application chose once
+     * the policy leaves them alone again. Uplinks the policy defers return
+     * TX_DEFERRED, and the journal is not drained while it defers.
+     * Readings from getVdd(), getVbat() and snapshot() are kept as well.
+     * getVbat() returns the last reading while it is younger than period.
+     * policy may be NULL, to only keep the voltage up to date.
+     */
+    void setBatteryPolicy(void (*policy)(uint16_t vddMv, rn2xx3_battery_policy& policy), uint16_t period = 600);
+
+    /*
+     * The last supply voltage read in mV, 0 if none yet, and the policy
+     * for it.
+     */
+    uint16_t cachedVdd();
+    const rn2xx3_battery_policy& getBatteryPolicy();
+#endif
+
+    /*
+     * Typed queries. The reply is parsed in place, without allocating
+     * memory. They return false, and leave value unchanged, if the module
+     * did not give a valid reply.
+     */
+    bool getSNR(int8_t& snr);             // radio get snr, dB
+    bool getRSSI(int16_t& rssi);          // radio get rssi, dBm, see FEATURE_RADIO_RSSI
+    bool getVdd(uint16_t& millivolts);    // sys get vdd
+    bool getHweui(uint8_t eui[8]);        // sys get hweui
+    bool getUpctr(uint32_t& upctr);       // mac get upctr
+    bool getDnctr(uint32_t& dnctr);       // mac get dnctr
+    bool getDataRate(uint8_t& dr);        // mac get dr
+    bool getPowerIndex(uint8_t& pwridx);  // mac get pwridx
+    bool getRxDelay1(uint16_t& ms);       // mac get rxdelay1
+    bool getStatus(rn2xx3_status& status); // mac get status
+
+    /*
+     * Read the status, frame counters, supply voltage, RX1 delay, data
+     * rate, power index and SNR in one go. Only the first command waits
+     * for the usual pause after the previous reply.
+     * Returns true if all values were read.
+     */
+    bool snapshot(rn2xx3_snapshot& snapshot);
+
+#if RN2XX3_STRING_HELPERS
     /*
      * Encode an ASCII string to a HEX string as needed when passed
      * to the RN2xx3 module.
@@ -237,8 +740,10 @@ class rn2xx3
     /*
      * Decode a HEX string to an ASCII string. Useful to decode a
      * string received from the RN2xx3.
+     * To decode binary data use getRxBytes() instead.
      */
     String base16decode(const String&);
+#endif
 
     /*
      * Almost all commands can return "invalid_param"
@@ -247,11 +752,52 @@ class rn2xx3
      */
     String getLastErrorInvalidParam();
 
+    /*
+     * Decode HEX characters into bytes, stopping at the first non HEX
+     * character or when cap bytes have been written.
+     * Returns the number of bytes written to out.
+     */
+    static size_t decodeHex(const char* hex, uint8_t* out, size_t cap);
+
+    /*
+     * The replies the RN2xx3 can give to a command, and a function to
+     * classify a received line. Useful when driving the module without
+     * this class, like the asynchronous host API does.
+     */
+    enum received_t {
+      busy,
+      frame_counter_err_rejoin_needed,
+      invalid_data_len,
+      invalid_param,
+      mac_err,
+      mac_paused,
+      mac_rx,
+      mac_tx_ok,
+      no_free_ch,
+      not_joined,
+      ok,
+      radio_err,
+      radio_tx_ok,
+      silent,
+      UNKNOWN
+    };
+
+    static received_t determineReceivedDataType(const String& receivedData);
+
   private:
     Stream& _serial;
 
     RN2xx3_t _moduleType = RN_NA;
 
+    // Cached module identity, valid until the module reboots
+    bool _identityValid = false;
+    bool _hweuiValid = false;
+    uint16_t _firmware = 0;
+    uint8_t _hweui[8];
+
+    rn2xx3_storage* _identityStorage = NULL;
+    uint16_t _identityAddress = 0;
+
     //Flags to switch code paths. Default is to use OTAA.
     bool _otaa = true;
 
@@ -272,39 +818,327 @@ class rn2xx3
     //the appskey/appkey to use for LoRa WAN
     String _appskey = "0";
 
-    // The downlink messenge
-    String _rxMessenge = "";
+#if RN2XX3_DOWNLINK
+    // The downlink messenge, decoded as it arrived
+    uint8_t _rx[RN2XX3_RX_MAX];
+    uint8_t _rxLength = 0;
+
+    // The port on which the downlink messenge was received
+    uint8_t _rxPort = 0;
+
+    bool _classC = false;
+
+    // An unsolicited downlink arrived that poll() did not report yet
+    bool _rxPending = false;
+    void (*_rxHandler)(uint8_t port) = NULL;
+#endif
 
     String _lastErrorInvalidParam = "";
 
+    // The next init() resets the module, instead of resuming its session
+    bool _forceReset = false;
+
+#if RN2XX3_ABP
+    // Persistent storage for the frame counters, if any
+    rn2xx3_storage* _counterStorage = NULL;
+    uint16_t _counterAddress = 0;
+    uint16_t _counterStride = 16;
+
+    // Uplinks left before the frame counters have to be saved again
+    uint16_t _uplinksBeforeCheckpoint = 0;
+
+    // The next initABP() starts a new session with new frame counters,
+    // instead of resuming or restoring the current one
+    bool _resetSession = false;
+#endif
+
+#if RN2XX3_DIAGNOSTICS
+    RN2xx3_recovery _lastRecovery = RECOVERY_NONE;
+    rn2xx3_recovery_stats _recoveryStats = {};
+#endif
+
+    // Settings the deadlines depend on, 0xFF or 0 while unknown
+    uint8_t _dr = 0xFF;
+    uint8_t _retx = 0xFF;
+    uint16_t _rxDelay1 = 0;
+    bool _adr = false;
+    uint8_t _pwridx = 0xFF;
+
+#if RN2XX3_DIAGNOSTICS
+    rn2xx3_deadline_stats _deadlineStats[WAIT_KINDS] = {};
+#endif
+
+    void (*_setHostBaud)(uint32_t baud) = NULL;
+    uint32_t _baud = 57600;
+
+#if RN2XX3_JOURNAL
+    rn2xx3_journal* _journal = NULL;
+    uint8_t _drainPerUplink = 1;
+    bool _draining = false;
+    bool _drainDue = false;        // Drain before the next uplink
+    uint8_t _journalPriority = 0;  // For the uplink being sent
+#endif
+
+#if RN2XX3_REPORT_FILTER
+    uint32_t _suppressedUplinks = 0;
+#endif
+
+#if RN2XX3_BATTERY
+    void (*_batteryPolicy)(uint16_t vddMv, rn2xx3_battery_policy& policy) = NULL;
+    uint16_t _vddPeriod = 0;
+    uint16_t _vdd = 0;
+    unsigned long _vddAt = 0;
+    bool _policyDue = false; // A reading the policy did not run for yet
+    rn2xx3_battery_policy _policy = {0xFF, 0xFF, false, 0, false, 0};
+
+    // What the application set, while the policy overrides it, else 0xFF
+    uint8_t _configuredDr = 0xFF;
+    uint8_t _configuredPwridx = 0xFF;
+    bool _applyingPolicy = false;
+
+    void cacheVdd(uint16_t vdd);
+
+    /*
+     * A setting the policy overrides was changed by someone else: keep
+     * value to restore it later, and apply the policy again.
+     */
+    void policyOverridden(uint8_t& configured, uint8_t value);
+
+    /*
+     * Read the supply voltage if the last reading is older than the
+     * period, and run the policy for a reading it has not seen yet.
+     */
+    void sampleVdd();
+    void applyBatteryPolicy();
+#endif
+
+#if RN2XX3_ENERGY
+    const rn2xx3_energy_profile* _energyProfile = NULL;
+    rn2xx3_energy_stats _energyStats[ENERGY_KINDS] = {};
+
+    // The operation being measured, ENERGY_KINDS if none. The meter only
+    // runs during an operation. What the operation spent is what it had
+    // spent before a nested operation started, plus the meter since start.
+    RN2xx3_energy _energyKind = ENERGY_KINDS;
+    rn2xx3_energy_meter _energyMeter = {};
+    rn2xx3_energy_meter _energyStart = {};
+    rn2xx3_energy_meter _energySpent = {};
+    unsigned long _energyMark = 0;
+    uint32_t _uartChars = 0;
+
+    /*
+     * Measures the operation of kind while it is in scope, and the
+     * operation it interrupted again after that.
+     */
+    class energy_scope
+    {
+      public:
+        energy_scope(rn2xx3& lora, RN2xx3_energy kind);
+        ~energy_scope();
+
+      private:
+        rn2xx3& _lora;
+        RN2xx3_energy _parentKind;
+        rn2xx3_energy_meter _parentSpent;
+    };
+
+    const rn2xx3_energy_profile& energyProfile();
+
+    /*
+     * Microjoules of current (in 0.1 mA) flowing for ms milliseconds.
+     */
+    uint32_t energy(uint16_t current, uint32_t ms);
+
+    /*
+     * Bring the meter up to now with the idle and UART energy.
+     */
+    void energyFlush();
+
+    /*
+     * Add airtime and receive window time, on top of the idle current.
+     */
+    void energyRadio(uint32_t airtimeMs, uint32_t rxMs);
+    void energyUplink(uint8_t payloadSize, bool confirmed, received_t reply, const String& receivedData);
+    void energyJoin(bool accepted);
+#endif
+
+#if RN2XX3_LINK_CHECK
+    uint16_t _linkCheckPeriod = 0;
+    bool _linkCheckAdapt = false;
+    unsigned long _linkCheckDue = 0;
+
+    // Downlink frame counter when the last link check was read, to tell
+    // a fresh answer from the previous one
+    uint32_t _linkCheckDnctr = 0;
+
+    rn2xx3_link_check _linkCheck = {};
+    void (*_linkCheckHandler)(const rn2xx3_link_check& result) = NULL;
+#endif
+
+    /*
+     * Send a break and the autobaud character at baud, and check that the
+     * module answers. slowest is the lowest rate the module may be at now.
+     */
+    bool switchBaudRate(uint32_t baud, uint32_t slowest);
+
     /*
      * Auto configure for either RN2903 or RN2483 module
      */
     RN2xx3_t configureModuleType();
 
+    /*
+     * Update the cached identity from a "sys get ver" reply or a reboot banner.
+     */
+    void parseVersion(const String& version);
+
+    /*
+     * The hardware EUI, read from the module only if it is not cached yet.
+     */
+    String cachedHweui();
+
+    void loadIdentity();
+    void saveIdentity();
+
+    /*
+     * Discard everything in the receive buffer, but notice if the module
+     * printed its version banner because it rebooted.
+     */
+    void clearSerial();
+
     void sendEncoded(const String&);
 
-    enum received_t {
-      busy,
-      frame_counter_err_rejoin_needed,
-      invalid_data_len,
-      invalid_param,
-      mac_err,
-      mac_paused,
-      mac_rx,
-      mac_tx_ok,
-      no_free_ch,
-      not_joined,
-      ok,
-      radio_err,
-      radio_tx_ok,
-      silent,
-      UNKNOWN
-    };
+    /*
+     * Count characters that went over the UART, for the energy estimate.
+     */
+    void countUart(size_t chars);
 
-    static received_t determineReceivedDataType(const String& receivedData);
+    /*
+     * Read one line, waiting until the deadline timeout milliseconds from
+     * now at most. Returns an empty string if no line arrived in time.
+     * The time it took is added to the statistics of kind, unless kind
+     * is WAIT_KINDS. Unsolicited downlinks are delivered and skipped,
+     * except while waiting for the result of a transmission (WAIT_TX).
+     */
+    String readLine(unsigned long timeout, RN2xx3_wait kind = WAIT_REPLY);
+
+    /*
+     * Read one line into buf instead. A longer line is cut off at cap - 1
+     * characters. Returns false if no whole line arrived in time.
+     */
+    bool readLine(char* buf, size_t cap, unsigned long timeout, RN2xx3_wait kind = WAIT_REPLY);
+
+    /*
+     * The next character of a line that started at start, or -1 when
+     * the deadline passed. endWait() updates the statistics.
+     */
+    int readChar(unsigned long start, unsigned long timeout);
+    void endWait(bool complete, unsigned long start, unsigned long timeout, RN2xx3_wait kind);
+
+    /*
+     * Deadlines for the final reply to a transmission and to a join.
+     */
+    unsigned long txDeadline(uint8_t payloadSize, bool confirmed);
+#if RN2XX3_OTAA
+    unsigned long joinDeadline();
+#endif
 
-    int readIntValue(const String& command);
+    /*
+     * Keep track of the settings the deadlines depend on, from commands
+     * the module accepted.
+     */
+    void trackSetting(const String& command);
+    void forgetSettings();
+
+    /*
+     * Spreading factor (0 for FSK) and bandwidth in kHz of a data rate.
+     */
+    bool dataRate(uint8_t dr, uint8_t& sf, uint16_t& bandwidth);
+    uint8_t currentDataRate();
+
+#if RN2XX3_DOWNLINK
+    /*
+     * Read the rest of a "mac_rx <port> <data>" line, after "mac_rx ", and
+     * keep the port and the payload decoded from HEX. Returns false if the
+     * line did not end within timeout ms from start.
+     */
+    bool readRx(unsigned long start, unsigned long timeout);
+
+    /*
+     * Report a downlink that arrived on its own and call the handler.
+     */
+    void deliverRx();
+#endif
+
+    /*
+     * Send a command and read its reply into buf, without allocating
+     * memory. paced waits the usual 100 ms after the previous reply first.
+     */
+    bool query(const __FlashStringHelper* command, char* buf, size_t cap, bool paced = true);
+    bool queryUnsigned(const __FlashStringHelper* command, uint32_t& value, int base = 10, bool paced = true);
+    bool querySigned(const __FlashStringHelper* command, int32_t& value, bool paced = true);
+
+    /*
+     * Resume the session the module still knows about, instead of
+     * resetting and reconfiguring it.
+     */
+#if RN2XX3_OTAA
+    bool resumeOTAA(const String& AppEUI, const String& DevEUI);
+    bool joinOTAA();
+#endif
+#if RN2XX3_ABP
+    bool resumeABP();
+    bool joinABP();
+    void restoreFrameCounters();
+    void saveFrameCounters();
+#endif
+    bool isJoined();
+
+    /*
+     * Recovery steps of txCommand(). rejoin() joins again with the keys
+     * the module still has, resync() drains the serial line and returns
+     * true if the module is still joined, reinit() resets the module and
+     * configures and joins it again, even if it still has a session.
+     */
+    bool rejoin();
+    bool resync();
+    bool reinit();
+    void recovered(RN2xx3_recovery step, unsigned long faultStart);
+
+    /*
+     * Give up on a transmission after the recovery steps up to step.
+     * Returns TX_FAIL, and keeps the uplink in the journal if there is one.
+     */
+    TX_RETURN_TYPE txFailed(RN2xx3_recovery step, const String& command, const String& data,
+                            bool shouldEncode);
+
+    void frameCounterCheckpoint();
+
+#if RN2XX3_JOURNAL
+    /*
+     * Keep a failed "mac tx" command in the journal. Returns TX_FAIL.
+     */
+    TX_RETURN_TYPE journalFailed(const String& command, const String& data, bool shouldEncode);
+
+    /*
+     * Transmit a journaled uplink once, without recovery steps.
+     * Returns the final reply.
+     */
+    received_t txJournaled(const rn2xx3_journal_record& record, const uint8_t* payload);
+#endif
+
+    /*
+     * Send the settings "mac reset" forgets, before a join.
+     */
+    void sessionSettings();
+
+#if RN2XX3_LINK_CHECK
+    /*
+     * Read the link check answer after an uplink that carried a request,
+     * and adapt the data rate to it when asked to.
+     */
+    void linkCheckCheckpoint();
+    void adaptDataRate();
+#endif
 
 
     // All "mac set ..." commands return either "ok" or "invalid_param"
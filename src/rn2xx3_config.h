@@ -0,0 +1,117 @@
+/*
+ * Compile time selection of the parts of the library to build.
+ *
+ * The driver itself is enabled by default. To save flash and RAM, define a
+ * macro as 0 in the build flags, for example in platformio.ini:
+ *
+ *   build_flags = -DRN2XX3_OTAA=0 -DRN2XX3_PLAN_TTN_US=0
+ *
+ * The optional parts further down are disabled by default, so they cost a
+ * sketch nothing until it defines them as 1:
+ *
+ *   build_flags = -DRN2XX3_JOURNAL=1 -DRN2XX3_DIAGNOSTICS=1
+ *
+ * The functions of a disabled part are not declared, so using one gives a
+ * compile error instead of silently doing nothing. A disabled frequency
+ * plan makes setFrequencyPlan() return false for it.
+ *
+ * extras/size-report.sh shows what every part costs on the example boards.
+ */
+
+#ifndef rn2xx3_config_h
+#define rn2xx3_config_h
+
+// Frequency plans of setFrequencyPlan()
+#ifndef RN2XX3_PLAN_SINGLE_CHANNEL_EU
+#define RN2XX3_PLAN_SINGLE_CHANNEL_EU 1
+#endif
+
+#ifndef RN2XX3_PLAN_TTN_EU
+#define RN2XX3_PLAN_TTN_EU 1
+#endif
+
+#ifndef RN2XX3_PLAN_TTN_US
+#define RN2XX3_PLAN_TTN_US 1
+#endif
+
+#ifndef RN2XX3_PLAN_DEFAULT_EU
+#define RN2XX3_PLAN_DEFAULT_EU 1
+#endif
+
+// Over the air activation: initOTAA()
+#ifndef RN2XX3_OTAA
+#define RN2XX3_OTAA 1
+#endif
+
+// Activation by personalization: initABP() and setFrameCounterStorage()
+#ifndef RN2XX3_ABP
+#define RN2XX3_ABP 1
+#endif
+
+// Keeping downlink messages: getRx(), getRxBytes(), setClassC() and poll()
+#ifndef RN2XX3_DOWNLINK
+#define RN2XX3_DOWNLINK 1
+#endif
+
+// Largest downlink payload kept, in bytes, at most 255. 242 bytes fit the
+// largest downlinks of every region, longer ones are cut off.
+#ifndef RN2XX3_RX_MAX
+#define RN2XX3_RX_MAX 242
+#endif
+
+// base16encode() and base16decode()
+#ifndef RN2XX3_STRING_HELPERS
+#define RN2XX3_STRING_HELPERS 1
+#endif
+
+// Optional parts, disabled unless defined as 1
+
+// Periodic link checks: setLinkCheck()
+#ifndef RN2XX3_LINK_CHECK
+#define RN2XX3_LINK_CHECK 0
+#endif
+
+// Store-and-forward of failed uplinks: setJournal(), see rn2xx3_journal.h
+#ifndef RN2XX3_JOURNAL
+#define RN2XX3_JOURNAL 0
+#endif
+
+// Report by exception: report(), see rn2xx3_report.h
+#ifndef RN2XX3_REPORT_FILTER
+#define RN2XX3_REPORT_FILTER 0
+#endif
+
+// Energy estimates per operation: getEnergyStats()
+#ifndef RN2XX3_ENERGY
+#define RN2XX3_ENERGY 0
+#endif
+
+// Battery aware transmissions: setBatteryPolicy()
+#ifndef RN2XX3_BATTERY
+#define RN2XX3_BATTERY 0
+#endif
+
+// Recovery and deadline statistics
+#ifndef RN2XX3_DIAGNOSTICS
+#define RN2XX3_DIAGNOSTICS 0
+#endif
+
+// Logging, see rn2xx3_log.h
+#define RN2XX3_LOG_NONE 0
+#define RN2XX3_LOG_ERROR 1 // Faults and the recovery steps taken
+#define RN2XX3_LOG_INFO 2  // Classified replies, retries, joins and timings
+#define RN2XX3_LOG_DEBUG 3 // Every line sent and received
+
+#ifndef RN2XX3_LOG_LEVEL
+#define RN2XX3_LOG_LEVEL RN2XX3_LOG_NONE
+#endif
+
+#if !RN2XX3_OTAA && !RN2XX3_ABP
+#error "RN2XX3_OTAA and RN2XX3_ABP can not both be disabled"
+#endif
+
+#if RN2XX3_RX_MAX > 255
+#error "RN2XX3_RX_MAX can be 255 at most"
+#endif
+
+#endif
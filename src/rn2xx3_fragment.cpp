@@ -0,0 +1,542 @@
+/*
+ * Send and receive blobs larger than one LoRaWAN frame.
+ */
+
+#include "rn2xx3_fragment.h"
+
+static uint32_t mix(uint32_t x)
+{
+  x ^= x >> 16;
+  x *= 0x7FEB352DUL;
+  x ^= x >> 15;
+  x *= 0x846CA68BUL;
+  x ^= x >> 16;
+  return x;
+}
+
+/*
+ * Whether coded fragment index includes data fragment j. Every coded
+ * fragment includes at least one data fragment, and about half of them.
+ */
+static bool includes(uint16_t index, uint16_t count, uint16_t j)
+{
+  if (j == index % count)
+  {
+    return true;
+  }
+  return mix(mix(count) ^ ((uint32_t)index << 12 | j)) & 1;
+}
+
+rn2xx3_fragmenter::rn2xx3_fragmenter(rn2xx3& lora, uint8_t port):
+_lora(lora),
+_port(port),
+_reader(NULL),
+_size(0),
+_fragmentSize(0),
+_perFragment(0),
+_id(0),
+_count(0),
+_coded(0),
+_next(0),
+_redundancy(0),
+_dutyCycle(1),
+_lastSent(0),
+_offTime(0)
+{
+}
+
+bool rn2xx3_fragmenter::begin(uint32_t size, size_t (*reader)(uint32_t offset, uint8_t* buf, size_t length),
+                              uint8_t fragmentSize)
+{
+  if (fragmentSize == 0)
+  {
+    fragmentSize = _lora.maxPayload();
+    if (fragmentSize > RN2XX3_FOPTS_RESERVE + 2 * RN2XX3_FRAGMENT_HEADER)
+    {
+      fragmentSize -= RN2XX3_FOPTS_RESERVE;
+    }
+  }
+  // Coded fragments carry the size of the last data fragment
+  uint8_t overhead = RN2XX3_FRAGMENT_HEADER + (_redundancy > 0 ? 1 : 0);
+  if (fragmentSize <= overhead)
+  {
+    return false;
+  }
+
+  uint8_t perFragment = fragmentSize - overhead;
+  uint32_t count = (size + perFragment - 1) / perFragment;
+  if (count == 0)
+  {
+    // An empty blob is still sent, so the other side knows about it
+    count = 1;
+  }
+  uint32_t coded = (count * _redundancy + 99) / 100;
+  if (count + coded > RN2XX3_FRAGMENT_MAX_COUNT)
+  {
+    return false;
+  }
+
+  _reader = reader;
+  _size = size;
+  _fragmentSize = fragmentSize;
+  _perFragment = perFragment;
+  _count = count;
+  _coded = coded;
+  _next = 0;
+  // A new id tells the other side this is not the previous blob again
+  _id++;
+  return true;
+}
+
+void rn2xx3_fragmenter::setRedundancy(uint8_t percent)
+{
+  _redundancy = percent;
+}
+
+void rn2xx3_fragmenter::setDutyCycle(uint8_t percent)
+{
+  _dutyCycle = percent > 0 && percent <= 100 ? percent : 1;
+}
+
+RN2xx3_fragment_status rn2xx3_fragmenter::poll()
+{
+  if (done())
+  {
+    return FRAGMENT_DONE;
+  }
+  if (_next > 0 && millis() - _lastSent < _offTime)
+  {
+    return FRAGMENT_WAITING;
+  }
+
+  uint8_t frame[_fragmentSize];
+  uint8_t length = fragment(_next, frame);
+  if (length == 0)
+  {
+    return FRAGMENT_FAILED;
+  }
+
+  TX_RETURN_TYPE result = _lora.txBytes(frame, length, _port);
+  if (result == TX_DEFERRED)
+  {
+    // Nothing went on the air, try the same fragment again later
+    return FRAGMENT_WAITING;
+  }
+
+  // Also wait after a failure, the module may have been on the air
+  _lastSent = millis();
+  _offTime = _lora.timeOnAir(length) * (100 - _dutyCycle) / _dutyCycle;
+
+  if (result != TX_SUCCESS && result != TX_WITH_RX)
+  {
+    return FRAGMENT_FAILED;
+  }
+  _next++;
+  return done() ? FRAGMENT_DONE : FRAGMENT_SENT;
+}
+
+uint8_t rn2xx3_fragmenter::fragment(uint16_t index, uint8_t* frame)
+{
+  frame[0] = _id;
+  frame[1] = index >> 4;
+  frame[2] = (index << 4) | (_count >> 8);
+  frame[3] = _count;
+
+  uint32_t lastOffset = (uint32_t)(_count - 1) * _perFragment;
+  if (index < _count)
+  {
+    uint32_t offset = (uint32_t)index * _perFragment;
+    uint8_t length = _size - offset < _perFragment ? _size - offset : _perFragment;
+    if (length > 0 && _reader(offset, &frame[RN2XX3_FRAGMENT_HEADER], length) != length)
+    {
+      return 0;
+    }
+    return RN2XX3_FRAGMENT_HEADER + length;
+  }
+
+  // A coded fragment
+  uint8_t* payload = &frame[RN2XX3_FRAGMENT_HEADER + 1];
+  uint8_t data[_perFragment];
+  frame[RN2XX3_FRAGMENT_HEADER] = _size - lastOffset;
+  memset(payload, 0, _perFragment);
+
+  for (uint16_t j = 0; j < _count; j++)
+  {
+    if (!includes(index, _count, j))
+    {
+      continue;
+    }
+    uint32_t offset = (uint32_t)j * _perFragment;
+    uint8_t length = _size - offset < _perFragment ? _size - offset : _perFragment;
+    if (length > 0 && _reader(offset, data, length) != length)
+    {
+      return 0;
+    }
+    for (uint8_t i = 0; i < length; i++)
+    {
+      payload[i] ^= data[i];
+    }
+  }
+  return RN2XX3_FRAGMENT_HEADER + 1 + _perFragment;
+}
+
+bool rn2xx3_fragmenter::done()
+{
+  return _next >= _count + _coded;
+}
+
+uint16_t rn2xx3_fragmenter::sent()
+{
+  return _next;
+}
+
+uint16_t rn2xx3_fragmenter::count()
+{
+  return _count;
+}
+
+uint16_t rn2xx3_fragmenter::coded()
+{
+  return _coded;
+}
+
+rn2xx3_reassembler::rn2xx3_reassembler(bool (*writer)(uint32_t offset, const uint8_t* data, size_t length),
+                                       uint8_t* bitmap, size_t bitmapSize, uint8_t fragmentSize):
+_writer(writer),
+_reader(NULL),
+_bitmap(bitmap),
+_bitmapSize(bitmapSize),
+_matrix(NULL),
+_matrixSize(0),
+_configuredSize(fragmentSize),
+_started(false),
+_id(0),
+_fragmentSize(fragmentSize),
+_count(0),
+_missing(0),
+_size(0),
+_lastLength(0)
+{
+}
+
+void rn2xx3_reassembler::setCoding(uint8_t* matrix, size_t matrixSize,
+                                   bool (*reader)(uint32_t offset, uint8_t* data, size_t length))
+{
+  _matrix = matrix;
+  _matrixSize = matrixSize;
+  _reader = reader;
+  _started = false;
+}
+
+void rn2xx3_reassembler::restart(uint8_t id, uint16_t count)
+{
+  memset(_bitmap, 0, (count + 7) / 8);
+  if (_matrix != NULL)
+  {
+    memset(_matrix, 0, (size_t)count * ((count + 7) / 8));
+  }
+  _started = true;
+  _id = id;
+  _count = count;
+  _missing = count;
+  _fragmentSize = _configuredSize;
+  _size = 0;
+  _lastLength = 0;
+}
+
+RN2xx3_reassembly_status rn2xx3_reassembler::add(const uint8_t* frame, size_t length)
+{
+  if (length < RN2XX3_FRAGMENT_HEADER)
+  {
+    return REASSEMBLY_INVALID;
+  }
+
+  uint8_t id = frame[0];
+  uint16_t index = frame[1] << 4 | frame[2] >> 4;
+  uint16_t count = (frame[2] & 0x0F) << 8 | frame[3];
+  bool coded = index >= count;
+  size_t rowBytes = (count + 7) / 8;
+  if (count == 0 || count > _bitmapSize * 8 ||
+      (coded && (_matrix == NULL || count > RN2XX3_FRAGMENT_MAX_CODED ||
+                 (size_t)count * rowBytes > _matrixSize)))
+  {
+    return REASSEMBLY_INVALID;
+  }
+
+  if (!_started || id != _id || count != _count)
+  {
+    restart(id, count);
+  }
+  if (_missing == 0)
+  {
+    return REASSEMBLY_DUPLICATE;
+  }
+
+  if (coded)
+  {
+    // Header, size of the last data fragment, and a whole fragment
+    if (_fragmentSize == 0 && length > RN2XX3_FRAGMENT_HEADER + 1)
+    {
+      _fragmentSize = length - 1;
+    }
+    if (length != (size_t)_fragmentSize + 1)
+    {
+      return REASSEMBLY_INVALID;
+    }
+    _lastLength = frame[RN2XX3_FRAGMENT_HEADER];
+
+    // The bits past count stay 0, they are copied into the matrix
+    uint8_t coefficients[(RN2XX3_FRAGMENT_MAX_CODED + 7) / 8];
+    uint8_t payload[_fragmentSize - RN2XX3_FRAGMENT_HEADER];
+    memset(coefficients, 0, rowBytes);
+    for (uint16_t j = 0; j < count; j++)
+    {
+      if (includes(index, count, j))
+      {
+        coefficients[j / 8] |= 1 << (j % 8);
+      }
+    }
+    memcpy(payload, &frame[RN2XX3_FRAGMENT_HEADER + 1], sizeof(payload));
+    if (!addCoded(coefficients, payload))
+    {
+      return REASSEMBLY_INVALID;
+    }
+  }
+  else
+  {
+    if (_bitmap[index / 8] & (1 << (index % 8)))
+    {
+      return REASSEMBLY_DUPLICATE;
+    }
+
+    bool last = index == count - 1;
+    if (!last)
+    {
+      if (_fragmentSize == 0)
+      {
+        _fragmentSize = length;
+      }
+      if (length != _fragmentSize)
+      {
+        return REASSEMBLY_INVALID;
+      }
+    }
+    else if (count > 1 && (_fragmentSize == 0 || length > _fragmentSize))
+    {
+      return REASSEMBLY_INVALID;
+    }
+
+    size_t dataLength = length - RN2XX3_FRAGMENT_HEADER;
+    if (!addData(index, &frame[RN2XX3_FRAGMENT_HEADER], dataLength))
+    {
+      return REASSEMBLY_INVALID;
+    }
+    if (last)
+    {
+      _lastLength = dataLength;
+    }
+  }
+
+  if (_missing == 0 && !solve())
+  {
+    return REASSEMBLY_INVALID;
+  }
+  if (_missing == 0)
+  {
+    _size = (uint32_t)(count - 1) * (_fragmentSize - RN2XX3_FRAGMENT_HEADER) + _lastLength;
+  }
+  return _missing == 0 ? REASSEMBLY_COMPLETE : REASSEMBLY_PROGRESS;
+}
+
+uint8_t* rn2xx3_reassembler::row(uint16_t index)
+{
+  return &_matrix[(size_t)index * ((_count + 7) / 8)];
+}
+
+bool rn2xx3_reassembler::isPivot(uint16_t index)
+{
+  return _matrix != NULL && (row(index)[index / 8] & (1 << (index % 8)));
+}
+
+bool rn2xx3_reassembler::xorSlot(uint16_t index, uint8_t* payload)
+{
+  uint8_t perFragment = _fragmentSize - RN2XX3_FRAGMENT_HEADER;
+  uint8_t data[perFragment];
+  if (!_reader(index * (uint32_t)perFragment, data, perFragment))
+  {
+    return false;
+  }
+  for (uint8_t i = 0; i < perFragment; i++)
+  {
+    payload[i] ^= data[i];
+  }
+  return true;
+}
+
+bool rn2xx3_reassembler::addData(uint16_t index, const uint8_t* data, size_t length)
+{
+  uint32_t offset = (uint32_t)index * (_fragmentSize - RN2XX3_FRAGMENT_HEADER);
+
+  if (_matrix == NULL)
+  {
+    if (!_writer(offset, data, length))
+    {
+      return false;
+    }
+  }
+  else
+  {
+    // Coded fragments XOR whole fragments, so pad the last one with zeros
+    uint8_t perFragment = _fragmentSize - RN2XX3_FRAGMENT_HEADER;
+    uint8_t padded[perFragment];
+    memset(padded, 0, perFragment);
+    memcpy(padded, data, length);
+
+    if (isPivot(index))
+    {
+      // The slot holds a coded fragment. Take this fragment out of it and
+      // find it another slot.
+      size_t rowBytes = (_count + 7) / 8;
+      uint8_t coefficients[(RN2XX3_FRAGMENT_MAX_CODED + 7) / 8];
+      uint8_t payload[perFragment];
+      memcpy(coefficients, row(index), rowBytes);
+      memset(row(index), 0, rowBytes);
+      if (!_reader(offset, payload, perFragment))
+      {
+        return false;
+      }
+      for (uint8_t i = 0; i < perFragment; i++)
+      {
+        payload[i] ^= padded[i];
+      }
+      coefficients[index / 8] &= ~(1 << (index % 8));
+
+      // The slot stays resolved, now by the data. Mark it known first, so
+      // addCoded() uses the data in it.
+      if (!_writer(offset, padded, perFragment))
+      {
+        return false;
+      }
+      _bitmap[index / 8] |= 1 << (index % 8);
+      return addCoded(coefficients, payload);
+    }
+
+    if (!_writer(offset, padded, perFragment))
+    {
+      return false;
+    }
+  }
+
+  _bitmap[index / 8] |= 1 << (index % 8);
+  _missing--;
+  return true;
+}
+
+bool rn2xx3_reassembler::addCoded(uint8_t* coefficients, uint8_t* payload)
+{
+  size_t rowBytes = (_count + 7) / 8;
+
+  while (true)
+  {
+    // Take out the data fragments that are known, and reduce by the
+    // coded fragments kept so far, until a new pivot is found
+    uint16_t pivot = _count;
+    for (uint16_t j = 0; j < _count; j++)
+    {
+      if (!(coefficients[j / 8] & (1 << (j % 8))))
+      {
+        continue;
+      }
+      if (_bitmap[j / 8] & (1 << (j % 8)))
+      {
+        if (!xorSlot(j, payload))
+        {
+          return false;
+        }
+        coefficients[j / 8] &= ~(1 << (j % 8));
+      }
+      else if (pivot == _count)
+      {
+        pivot = j;
+      }
+    }
+
+    if (pivot == _count)
+    {
+      // Nothing new in this fragment
+      return true;
+    }
+    if (!isPivot(pivot))
+    {
+      memcpy(row(pivot), coefficients, rowBytes);
+      if (!_writer(pivot * (uint32_t)(_fragmentSize - RN2XX3_FRAGMENT_HEADER), payload,
+                   _fragmentSize - RN2XX3_FRAGMENT_HEADER))
+      {
+        return false;
+      }
+      _missing--;
+      return true;
+    }
+
+    const uint8_t* other = row(pivot);
+    for (size_t i = 0; i < rowBytes; i++)
+    {
+      coefficients[i] ^= other[i];
+    }
+    if (!xorSlot(pivot, payload))
+    {
+      return false;
+    }
+  }
+}
+
+bool rn2xx3_reassembler::solve()
+{
+  if (_matrix == NULL)
+  {
+    return true;
+  }
+
+  // Every coded fragment only depends on higher data fragments besides
+  // its pivot. Resolve them from the last one down.
+  uint8_t perFragment = _fragmentSize - RN2XX3_FRAGMENT_HEADER;
+  size_t rowBytes = (_count + 7) / 8;
+  for (uint16_t p = _count; p-- > 0;)
+  {
+    if (!isPivot(p))
+    {
+      continue;
+    }
+    uint8_t payload[perFragment];
+    uint32_t offset = p * (uint32_t)perFragment;
+    if (!_reader(offset, payload, perFragment))
+    {
+      return false;
+    }
+    const uint8_t* coefficients = row(p);
+    for (uint16_t j = p + 1; j < _count; j++)
+    {
+      if ((coefficients[j / 8] & (1 << (j % 8))) && !xorSlot(j, payload))
+      {
+        return false;
+      }
+    }
+    if (!_writer(offset, payload, perFragment))
+    {
+      return false;
+    }
+    memset(row(p), 0, rowBytes);
+    _bitmap[p / 8] |= 1 << (p % 8);
+  }
+  return true;
+}
+
+uint16_t rn2xx3_reassembler::missing()
+{
+  return _missing;
+}
+
+uint32_t rn2xx3_reassembler::size()
+{
+  return _size;
+}
@@ -0,0 +1,218 @@
+/*
+ * Send and receive blobs larger than one LoRaWAN frame.
+ *
+ * rn2xx3_fragmenter splits a blob into fragments that fit an uplink at the
+ * current data rate, and sends them one at a time, no more often than the
+ * duty cycle allows. The blob is read piece by piece from a callback, so it
+ * never has to fit in RAM:
+ *
+ *   size_t readLog(uint32_t offset, uint8_t* buf, size_t length)
+ *   {
+ *     return logFile.seek(offset) ? logFile.read(buf, length) : 0;
+ *   }
+ *
+ *   rn2xx3_fragmenter fragmenter(myLora, 10);
+ *   fragmenter.begin(logFile.size(), readLog);
+ *   while (!fragmenter.done()) { fragmenter.poll(); }
+ *
+ * rn2xx3_reassembler puts fragmented downlinks back together, writing every
+ * fragment to its place through a callback as it arrives:
+ *
+ *   uint8_t bitmap[16]; // room for 128 fragments
+ *   rn2xx3_reassembler reassembler(writeFirmware, bitmap, sizeof(bitmap));
+ *
+ *   void onDownlink(uint8_t port)
+ *   {
+ *     uint8_t frame[64];
+ *     size_t length = myLora.getRxBytes(frame, sizeof(frame));
+ *     if (port == 10 && reassembler.add(frame, length) == REASSEMBLY_COMPLETE) { ... }
+ *   }
+ *
+ * Every fragment starts with a 4 byte header: the blob id, then the
+ * fragment index and the number of fragments as two 12 bit numbers, big
+ * endian. All fragments of a blob have the same size, except the last.
+ *
+ * Optionally coded fragments are sent after the data fragments, so lost
+ * ones do not have to be sent again. A coded fragment is the XOR of a
+ * pseudo random subset of the data fragments, the last one padded with
+ * zeros, and has an index of count or higher. After the header it holds
+ * the size of the last data fragment. With coding every fragment carries
+ * one byte less data, and the receiver can rebuild the blob from any set
+ * of fragments that together determine all data fragments, typically a
+ * few more than count.
+ */
+
+#ifndef rn2xx3_fragment_h
+#define rn2xx3_fragment_h
+
+#include "Arduino.h"
+#include "rn2xx3.h"
+
+#define RN2XX3_FRAGMENT_HEADER 4
+#define RN2XX3_FRAGMENT_MAX_COUNT 4095
+
+// Coded fragments can be decoded for blobs of up to this many fragments.
+// Decoding keeps a row of coefficients, one bit per fragment, on the stack.
+#ifndef RN2XX3_FRAGMENT_MAX_CODED
+#define RN2XX3_FRAGMENT_MAX_CODED 512
+#endif
+
+enum RN2xx3_fragment_status {
+  FRAGMENT_WAITING,  // Nothing sent, the duty cycle or the battery policy does not allow it yet
+  FRAGMENT_SENT,     // One fragment sent
+  FRAGMENT_DONE,     // All fragments were sent
+  FRAGMENT_FAILED    // The fragment could not be sent or read, poll() tries it again
+};
+
+class rn2xx3_fragmenter
+{
+  public:
+    /*
+     * lora: the module to send with
+     * port: the LoRaWAN port for the fragments
+     */
+    rn2xx3_fragmenter(rn2xx3& lora, uint8_t port);
+
+    /*
+     * Start sending a blob of size bytes, read through reader. reader
+     * returns the number of bytes it copied to buf, from offset onwards.
+     *
+     * fragmentSize: payload bytes per fragment, header included. 0 picks
+     *               the largest that fits at the current data rate.
+     * Returns false if the blob needs more than RN2XX3_FRAGMENT_MAX_COUNT
+     * fragments.
+     */
+    bool begin(uint32_t size, size_t (*reader)(uint32_t offset, uint8_t* buf, size_t length),
+               uint8_t fragmentSize = 0);
+
+    /*
+     * Send percent more fragments than the blob needs, as coded fragments.
+     * Takes effect at the next begin(). 0, the default, switches coding off.
+     */
+    void setRedundancy(uint8_t percent);
+
+    /*
+     * The share of time the fragments may use the air, in percent.
+     * The default of 1 matches the strictest EU868 sub-bands.
+     */
+    void setDutyCycle(uint8_t percent);
+
+    /*
+     * Send the next fragment, if the duty cycle allows it.
+     */
+    RN2xx3_fragment_status poll();
+
+    bool done();
+    uint16_t sent();
+
+    /*
+     * Data fragments, and coded fragments sent after them.
+     */
+    uint16_t count();
+    uint16_t coded();
+
+    /*
+     * Build fragment index into frame, which must hold the fragment size.
+     * Returns its length, or 0 if the blob could not be read.
+     */
+    uint8_t fragment(uint16_t index, uint8_t* frame);
+
+  private:
+    rn2xx3& _lora;
+    uint8_t _port;
+    size_t (*_reader)(uint32_t offset, uint8_t* buf, size_t length);
+
+    uint32_t _size;
+    uint8_t _fragmentSize;
+    uint8_t _perFragment;
+    uint8_t _id;
+    uint16_t _count;
+    uint16_t _coded;
+    uint16_t _next;
+    uint8_t _redundancy;
+
+    uint8_t _dutyCycle;
+    unsigned long _lastSent;
+    unsigned long _offTime;
+};
+
+enum RN2xx3_reassembly_status {
+  REASSEMBLY_PROGRESS,  // Fragment stored, more are missing
+  REASSEMBLY_COMPLETE,  // The blob is complete
+  REASSEMBLY_DUPLICATE, // Fragment was received before
+  REASSEMBLY_INVALID    // Not a fragment, it does not fit, or it could not be written
+};
+
+class rn2xx3_reassembler
+{
+  public:
+    /*
+     * writer: stores length bytes of the blob at offset
+     * bitmap: one bit per fragment, to track which ones arrived. Its size
+     *         in bytes limits the number of fragments to 8 * bitmapSize.
+     * fragmentSize: the size of all but the last fragment, header
+     *               included. 0 learns it from the first fragment that is
+     *               not the last one.
+     */
+    rn2xx3_reassembler(bool (*writer)(uint32_t offset, const uint8_t* data, size_t length),
+                       uint8_t* bitmap, size_t bitmapSize, uint8_t fragmentSize = 0);
+
+    /*
+     * Add a received fragment. A fragment of a new blob id starts over.
+     * The last fragment is rejected as long as the fragment size is not
+     * known, because its offset depends on it.
+     */
+    RN2xx3_reassembly_status add(const uint8_t* frame, size_t length);
+
+    /*
+     * Accept coded fragments. The blob storage has to hold count whole
+     * fragments then, and is read back through reader while decoding.
+     *
+     * matrix: room for the coefficients of the coded fragments that are
+     *         not resolved yet, count * ((count + 7) / 8) bytes
+     * Coded fragments of blobs with more than RN2XX3_FRAGMENT_MAX_CODED
+     * fragments are rejected.
+     */
+    void setCoding(uint8_t* matrix, size_t matrixSize,
+                   bool (*reader)(uint32_t offset, uint8_t* data, size_t length));
+
+    /*
+     * Fragments still missing, and the size of the blob once the last
+     * fragment arrived.
+     */
+    uint16_t missing();
+    uint32_t size();
+
+  private:
+    bool (*_writer)(uint32_t offset, const uint8_t* data, size_t length);
+    bool (*_reader)(uint32_t offset, uint8_t* data, size_t length);
+    uint8_t* _bitmap;
+    size_t _bitmapSize;
+    uint8_t* _matrix;
+    size_t _matrixSize;
+    uint8_t _configuredSize;
+
+    bool _started;
+    uint8_t _id;
+    uint8_t _fragmentSize;
+    uint16_t _count;
+    uint16_t _missing;
+    uint32_t _size;
+    uint8_t _lastLength;
+
+    void restart(uint8_t id, uint16_t count);
+
+    /*
+     * Decoding: a coded fragment is kept in the slot of the lowest data
+     * fragment it still depends on, its pivot. Its coefficients are row
+     * pivot of the matrix.
+     */
+    uint8_t* row(uint16_t index);
+    bool isPivot(uint16_t index);
+    bool addData(uint16_t index, const uint8_t* data, size_t length);
+    bool addCoded(uint8_t* coefficients, uint8_t* payload);
+    bool solve();
+    bool xorSlot(uint16_t index, uint8_t* payload);
+};
+
+#endif
@@ -0,0 +1,209 @@
+/*
+ * Persistent store-and-forward journal for uplinks.
+ */
+
+#include "rn2xx3_journal.h"
+
+#define SLOT_UNSENT 0xA5
+#define SLOT_SENT 0x5A
+#define HEADER_SIZE 10
+
+static uint32_t defaultClock()
+{
+  return millis();
+}
+
+rn2xx3_journal::rn2xx3_journal(rn2xx3_storage& storage, uint16_t address, uint8_t slots, uint8_t slotSize):
+_storage(storage),
+_address(address),
+_slots(slots),
+_slotSize(slotSize),
+_head(0),
+_nextSeq(0),
+_pending(0),
+_overwritten(0),
+_clock(defaultClock)
+{
+}
+
+uint16_t rn2xx3_journal::slotAddress(uint8_t slot)
+{
+  return _address + slot * (uint16_t)_slotSize;
+}
+
+uint8_t rn2xx3_journal::maxPayload()
+{
+  return _slotSize > RN2XX3_JOURNAL_OVERHEAD ? _slotSize - RN2XX3_JOURNAL_OVERHEAD : 0;
+}
+
+uint8_t rn2xx3_journal::pending()
+{
+  return _pending;
+}
+
+uint16_t rn2xx3_journal::overwritten()
+{
+  return _overwritten;
+}
+
+void rn2xx3_journal::setClock(uint32_t (*clock)())
+{
+  _clock = clock;
+}
+
+uint8_t rn2xx3_journal::readHeader(uint8_t slot, rn2xx3_journal_record& record)
+{
+  uint8_t header[HEADER_SIZE];
+  uint16_t address = slotAddress(slot);
+  if (!_storage.read(address, header, sizeof(header)) ||
+      (header[0] != SLOT_UNSENT && header[0] != SLOT_SENT) ||
+      header[5] > maxPayload())
+  {
+    return 0;
+  }
+
+  // The checksum covers the payload too, read it in small pieces
+  uint8_t sum = rn2xx3_checksum(&header[1], sizeof(header) - 1);
+  uint8_t chunk[16];
+  uint8_t left = header[5];
+  address += sizeof(header);
+  while (left > 0)
+  {
+    uint8_t length = left < sizeof(chunk) ? left : sizeof(chunk);
+    if (!_storage.read(address, chunk, length))
+    {
+      return 0;
+    }
+    sum = rn2xx3_checksum(chunk, length, sum);
+    address += length;
+    left -= length;
+  }
+  if (!_storage.read(address, chunk, 1) || chunk[0] != sum)
+  {
+    return 0;
+  }
+
+  record.slot = slot;
+  record.seq = header[1] | header[2] << 8;
+  record.priority = header[3] & 0x03;
+  record.confirmed = header[3] & 0x04;
+  record.port = header[4];
+  record.size = header[5];
+  record.timestamp = (uint32_t)header[6] | (uint32_t)header[7] << 8 |
+                     (uint32_t)header[8] << 16 | (uint32_t)header[9] << 24;
+  return header[0];
+}
+
+void rn2xx3_journal::begin()
+{
+  rn2xx3_journal_record record;
+  bool found = false;
+  _pending = 0;
+  _head = 0;
+  _nextSeq = 0;
+
+  for (uint8_t slot = 0; slot < _slots; slot++)
+  {
+    uint8_t state = readHeader(slot, record);
+    if (state == 0)
+    {
+      continue;
+    }
+    if (state == SLOT_UNSENT)
+    {
+      _pending++;
+    }
+
+    // Continue after the newest record, sent or not. Sequence numbers
+    // wrap, but the records in the ring are never far apart.
+    if (!found || (int16_t)(record.seq - _nextSeq) >= 0)
+    {
+      _nextSeq = record.seq + 1;
+      _head = (slot + 1) % _slots;
+      found = true;
+    }
+  }
+}
+
+bool rn2xx3_journal::push(const uint8_t* data, uint8_t size, uint8_t port, uint8_t priority, bool confirmed)
+{
+  if (size > maxPayload() || _slots == 0)
+  {
+    return false;
+  }
+
+  rn2xx3_journal_record old;
+  if (readHeader(_head, old) == SLOT_UNSENT)
+  {
+    _pending--;
+    _overwritten++;
+  }
+
+  uint32_t timestamp = _clock();
+  uint8_t header[HEADER_SIZE];
+  header[0] = SLOT_UNSENT;
+  header[1] = _nextSeq;
+  header[2] = _nextSeq >> 8;
+  header[3] = (priority & 0x03) | (confirmed ? 0x04 : 0);
+  header[4] = port;
+  header[5] = size;
+  header[6] = timestamp;
+  header[7] = timestamp >> 8;
+  header[8] = timestamp >> 16;
+  header[9] = timestamp >> 24;
+  uint8_t sum = rn2xx3_checksum(data, size, rn2xx3_checksum(&header[1], sizeof(header) - 1));
+
+  uint16_t address = slotAddress(_head);
+  if (!_storage.write(address, header, sizeof(header)) ||
+      !_storage.write(address + sizeof(header), data, size) ||
+      !_storage.write(address + sizeof(header) + size, &sum, 1))
+  {
+    return false;
+  }
+
+  _head = (_head + 1) % _slots;
+  _nextSeq++;
+  _pending++;
+  return true;
+}
+
+bool rn2xx3_journal::peek(rn2xx3_journal_record& record, uint8_t* buf, uint8_t cap)
+{
+  bool found = false;
+  rn2xx3_journal_record candidate;
+
+  for (uint8_t slot = 0; slot < _slots && _pending > 0; slot++)
+  {
+    if (readHeader(slot, candidate) != SLOT_UNSENT)
+    {
+      continue;
+    }
+    if (!found || candidate.priority > record.priority ||
+        (candidate.priority == record.priority && (int16_t)(candidate.seq - record.seq) < 0))
+    {
+      record = candidate;
+      found = true;
+    }
+  }
+
+  if (!found)
+  {
+    return false;
+  }
+  uint8_t length = record.size < cap ? record.size : cap;
+  return _storage.read(slotAddress(record.slot) + HEADER_SIZE, buf, length);
+}
+
+bool rn2xx3_journal::drop(const rn2xx3_journal_record& record)
+{
+  uint8_t state = SLOT_SENT;
+  if (!_storage.write(slotAddress(record.slot), &state, 1))
+  {
+    return false;
+  }
+  if (_pending > 0)
+  {
+    _pending--;
+  }
+  return true;
+}
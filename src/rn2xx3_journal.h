@@ -0,0 +1,114 @@
+/*
+ * Persistent store-and-forward journal for uplinks.
+ *
+ * rn2xx3_journal keeps payloads that could not be sent in a ring of fixed
+ * size slots in an rn2xx3_storage, so they survive a reset of the host.
+ * Give it to the library and uplinks that fail, or are made while the
+ * module can not join, are kept and sent later:
+ *
+ *   EepromStorage eeprom;
+ *   rn2xx3_journal journal(eeprom, 64, 16, 24); // 16 slots of 24 bytes
+ *   journal.begin();
+ *   myLora.setJournal(journal);
+ *
+ * Records are written to the slots in turn, so every slot wears the same.
+ * When all slots hold unsent records the oldest one is overwritten.
+ *
+ * Slot format: a state byte (0xA5 unsent, 0x5A sent, anything else empty),
+ * the sequence number (2 bytes, little endian), flags (bits 0-1 priority,
+ * bit 2 confirmed), the LoRaWAN port, the payload size, the capture
+ * timestamp (4 bytes, little endian), the payload, and a checksum over
+ * everything but the state byte, so marking a record as sent is a single
+ * byte write.
+ */
+
+#ifndef rn2xx3_journal_h
+#define rn2xx3_journal_h
+
+#include "Arduino.h"
+#include "rn2xx3_storage.h"
+
+// Bytes of a slot that are not payload
+#define RN2XX3_JOURNAL_OVERHEAD 11
+
+struct rn2xx3_journal_record {
+  uint8_t slot;
+  uint16_t seq;
+  uint8_t priority;   // 0 to 3, higher is sent first
+  bool confirmed;
+  uint8_t port;
+  uint8_t size;
+  uint32_t timestamp; // From the clock when the record was added
+};
+
+class rn2xx3_journal
+{
+  public:
+    /*
+     * storage: where the journal is kept
+     * address: the first byte of the journal in storage
+     * slots: number of records the journal can hold
+     * slotSize: bytes per slot, payloads can be up to
+     *           slotSize - RN2XX3_JOURNAL_OVERHEAD bytes
+     */
+    rn2xx3_journal(rn2xx3_storage& storage, uint16_t address, uint8_t slots, uint8_t slotSize);
+
+    /*
+     * Find the unsent records left in storage. Call once at startup.
+     */
+    void begin();
+
+    /*
+     * The clock for the capture timestamps, millis() by default. A real
+     * time clock keeps the timestamps meaningful across resets.
+     */
+    void setClock(uint32_t (*clock)());
+
+    /*
+     * Add a payload. Returns false if it does not fit in a slot, or if
+     * the storage could not be written.
+     */
+    bool push(const uint8_t* data, uint8_t size, uint8_t port = 1, uint8_t priority = 0, bool confirmed = false);
+
+    /*
+     * The record to send next: the highest priority, and of those the
+     * oldest. Its payload is copied to buf, up to cap bytes.
+     * Returns false if there is no unsent record.
+     */
+    bool peek(rn2xx3_journal_record& record, uint8_t* buf, uint8_t cap);
+
+    /*
+     * Mark a record returned by peek() as sent.
+     */
+    bool drop(const rn2xx3_journal_record& record);
+
+    /*
+     * Unsent records, and records overwritten before they were sent
+     * since begin().
+     */
+    uint8_t pending();
+    uint16_t overwritten();
+
+    uint8_t maxPayload();
+
+  private:
+    rn2xx3_storage& _storage;
+    uint16_t _address;
+    uint8_t _slots;
+    uint8_t _slotSize;
+
+    uint8_t _head;       // Slot the next record is written to
+    uint16_t _nextSeq;
+    uint8_t _pending;
+    uint16_t _overwritten;
+    uint32_t (*_clock)();
+
+    /*
+     * Read the header of a slot. Returns its state byte, or 0 if the
+     * slot does not hold a valid record.
+     */
+    uint8_t readHeader(uint8_t slot, rn2xx3_journal_record& record);
+    uint16_t slotAddress(uint8_t slot);
+};
+
+#endif
@@ -0,0 +1,130 @@
+/*
+ * Compile time logging for the rn2xx3 library.
+ *
+ * Set RN2XX3_LOG_LEVEL to RN2XX3_LOG_ERROR (1), RN2XX3_LOG_INFO (2) or
+ * RN2XX3_LOG_DEBUG (3) in the build flags to enable it. Messages of a
+ * higher level compile to nothing, and with the default level
+ * RN2XX3_LOG_NONE (0) the library contains no logging code at all.
+ *
+ * Messages go to the Print that RN2XX3_LOG_SINK names, by default the
+ * result of a function the sketch provides:
+ *
+ *   Print& rn2xx3_log_sink()
+ *   {
+ *     return Serial;
+ *   }
+ *
+ * Printing to a serial port takes time and can delay the replies of the
+ * module. To keep the radio timing unchanged, log into an
+ * rn2xx3_log_buffer and print it later:
+ *
+ *   rn2xx3_log_buffer<512> logBuffer;
+ *   Print& rn2xx3_log_sink() { return logBuffer; }
+ *   ...
+ *   logBuffer.printTo(Serial);
+ *
+ * Every message is one line: the time in milliseconds, the level (E, I or
+ * D) and the text. Nothing is allocated on the heap.
+ */
+
+#ifndef rn2xx3_log_h
+#define rn2xx3_log_h
+
+#include "Arduino.h"
+#include "rn2xx3_config.h"
+
+/*
+ * A Print that keeps the last Size bytes written to it. When it is full,
+ * the oldest bytes are overwritten.
+ */
+template <size_t Size>
+class rn2xx3_log_buffer : public Print
+{
+  public:
+    rn2xx3_log_buffer() : _head(0), _length(0) {}
+
+    size_t write(uint8_t c)
+    {
+      _data[_head] = c;
+      _head = (_head + 1) % Size;
+      if (_length < Size)
+      {
+        _length++;
+      }
+      return 1;
+    }
+
+    using Print::write;
+
+    /*
+     * Print the contents, oldest first, and empty the buffer.
+     */
+    void printTo(Print& out)
+    {
+      size_t tail = (_head + Size - _length) % Size;
+      for (size_t i = 0; i < _length; i++)
+      {
+        out.write(_data[(tail + i) % Size]);
+      }
+      _length = 0;
+    }
+
+    size_t length() const { return _length; }
+
+  private:
+    uint8_t _data[Size];
+    size_t _head;
+    size_t _length;
+};
+
+#if RN2XX3_LOG_LEVEL > RN2XX3_LOG_NONE
+
+#ifndef RN2XX3_LOG_SINK
+Print& rn2xx3_log_sink();
+#define RN2XX3_LOG_SINK rn2xx3_log_sink()
+#endif
+
+inline void rn2xx3_log_print(Print&)
+{
+}
+
+template <typename T, typename... Rest>
+void rn2xx3_log_print(Print& sink, const T& value, const Rest&... rest)
+{
+  sink.print(value);
+  rn2xx3_log_print(sink, rest...);
+}
+
+template <typename... Args>
+void rn2xx3_log(char level, const Args&... args)
+{
+  Print& sink = RN2XX3_LOG_SINK;
+  sink.print(millis());
+  sink.print(' ');
+  sink.print(level);
+  sink.print(' ');
+  rn2xx3_log_print(sink, args...);
+  sink.println();
+}
+
+#endif
+
+#if RN2XX3_LOG_LEVEL >= RN2XX3_LOG_ERROR
+#define RN2XX3_LOG_E(...) rn2xx3_log('E', __VA_ARGS__)
+#else
+#define RN2XX3_LOG_E(...) do {} while (0)
+#endif
+
+#if RN2XX3_LOG_LEVEL >= RN2XX3_LOG_INFO
+#define RN2XX3_LOG_I(...) rn2xx3_log('I', __VA_ARGS__)
+#else
+#define RN2XX3_LOG_I(...) do {} while (0)
+#endif
+
+#if RN2XX3_LOG_LEVEL >= RN2XX3_LOG_DEBUG
+#define RN2XX3_LOG_D(...) rn2xx3_log('D', __VA_ARGS__)
+#else
+#define RN2XX3_LOG_D(...) do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * Report by exception: only send readings that changed.
+ */
+
+#include "rn2xx3_report.h"
+
+static uint32_t defaultClock()
+{
+  return millis();
+}
+
+rn2xx3_report_filter::rn2xx3_report_filter(rn2xx3_metric* metrics, uint8_t count, uint16_t heartbeat):
+_metrics(metrics),
+_count(count),
+_heartbeat(heartbeat * 1000UL),
+_clock(defaultClock),
+_reported(false),
+_acknowledged(false),
+_lastReport(0),
+_suppressed(0)
+{
+  memset(_metrics, 0, count * sizeof(rn2xx3_metric));
+}
+
+void rn2xx3_report_filter::setDeadband(uint8_t metric, uint32_t deadband)
+{
+  if (metric < _count)
+  {
+    _metrics[metric].deadband = deadband;
+  }
+}
+
+void rn2xx3_report_filter::setClock(uint32_t (*clock)())
+{
+  _clock = clock;
+}
+
+void rn2xx3_report_filter::set(uint8_t metric, int32_t value)
+{
+  if (metric >= _count)
+  {
+    return;
+  }
+  rn2xx3_metric& m = _metrics[metric];
+  m.value = value;
+  m.known = true;
+  if (!changed(metric))
+  {
+    m.suppressed++;
+  }
+}
+
+int32_t rn2xx3_report_filter::value(uint8_t metric)
+{
+  return metric < _count ? _metrics[metric].value : 0;
+}
+
+bool rn2xx3_report_filter::changed(uint8_t metric)
+{
+  if (metric >= _count || !_metrics[metric].known)
+  {
+    return false;
+  }
+  const rn2xx3_metric& m = _metrics[metric];
+  if (!m.sent)
+  {
+    return true;
+  }
+  // The difference of two int32_t values always fits in an uint32_t
+  uint32_t difference = m.value >= m.reported ? (uint32_t)m.value - (uint32_t)m.reported
+                                              : (uint32_t)m.reported - (uint32_t)m.value;
+  return difference > m.deadband;
+}
+
+bool rn2xx3_report_filter::due()
+{
+  if (!_reported || (_heartbeat > 0 && silence() >= _heartbeat))
+  {
+    return true;
+  }
+  for (uint8_t i = 0; i < _count; i++)
+  {
+    if (changed(i))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+void rn2xx3_report_filter::reported(bool acknowledged)
+{
+  for (uint8_t i = 0; i < _count; i++)
+  {
+    if (_metrics[i].known)
+    {
+      _metrics[i].reported = _metrics[i].value;
+      _metrics[i].sent = true;
+    }
+  }
+  _reported = true;
+  _acknowledged = acknowledged;
+  _lastReport = _clock();
+}
+
+void rn2xx3_report_filter::suppress()
+{
+  _suppressed++;
+}
+
+int32_t rn2xx3_report_filter::received(uint8_t metric)
+{
+  return metric < _count ? _metrics[metric].reported : 0;
+}
+
+bool rn2xx3_report_filter::acknowledged()
+{
+  return _acknowledged;
+}
+
+uint16_t rn2xx3_report_filter::suppressed()
+{
+  return _suppressed;
+}
+
+uint32_t rn2xx3_report_filter::silence()
+{
+  return _clock() - _lastReport;
+}
@@ -0,0 +1,109 @@
+/*
+ * Report by exception: only send readings that changed.
+ *
+ * rn2xx3_report_filter keeps the latest value of every metric and the
+ * value the network last received. An uplink is only due when a metric
+ * moved more than its deadband away from what the network knows, or when
+ * nothing was sent for longer than the heartbeat interval:
+ *
+ *   rn2xx3_metric metrics[2];
+ *   rn2xx3_report_filter filter(metrics, 2, 3600); // heartbeat every hour
+ *   filter.setDeadband(0, 50); // temperature in 0.01 degrees
+ *   filter.setDeadband(1, 20); // humidity in 0.1%
+ *
+ *   filter.set(0, temperature);
+ *   filter.set(1, humidity);
+ *   myLora.report(filter, payload, sizeof(payload), 1);
+ *
+ * rn2xx3::report() sends only when the filter says so, and updates the
+ * filter with the result. Use one filter per group of metrics that share
+ * an uplink.
+ */
+
+#ifndef rn2xx3_report_h
+#define rn2xx3_report_h
+
+#include "Arduino.h"
+
+struct rn2xx3_metric {
+  int32_t value;       // The latest value
+  int32_t reported;    // The value in the last successful uplink
+  uint32_t deadband;   // Changes up to this much are not worth an uplink
+  uint16_t suppressed; // Values set that stayed within the deadband
+  bool known;          // A value was set
+  bool sent;           // reported holds a value
+};
+
+class rn2xx3_report_filter
+{
+  public:
+    /*
+     * metrics: one entry per metric, count entries
+     * heartbeat: seconds without an uplink after which one is due anyway,
+     *            0 for none
+     */
+    rn2xx3_report_filter(rn2xx3_metric* metrics, uint8_t count, uint16_t heartbeat = 0);
+
+    /*
+     * Changes of at most deadband are not reported. The default is 0, so
+     * every change is.
+     */
+    void setDeadband(uint8_t metric, uint32_t deadband);
+
+    /*
+     * The clock for the heartbeat in milliseconds, millis() by default.
+     * Give a clock that keeps running while the host sleeps.
+     */
+    void setClock(uint32_t (*clock)());
+
+    /*
+     * Update the latest value of a metric.
+     */
+    void set(uint8_t metric, int32_t value);
+    int32_t value(uint8_t metric);
+
+    /*
+     * Whether a metric moved beyond its deadband, and whether an uplink is
+     * due: a metric changed, nothing was sent yet, or the heartbeat
+     * interval passed.
+     */
+    bool changed(uint8_t metric);
+    bool due();
+
+    /*
+     * Record a successful uplink with the latest values. acknowledged
+     * tells that the network confirmed it got the uplink.
+     */
+    void reported(bool acknowledged);
+
+    /*
+     * Record an uplink that was not sent because it was not due.
+     */
+    void suppress();
+
+    /*
+     * What the network last received of a metric, and whether it
+     * confirmed that uplink. received() is only valid if metrics[i].sent.
+     */
+    int32_t received(uint8_t metric);
+    bool acknowledged();
+
+    /*
+     * Uplinks suppressed, and milliseconds since the last one was sent.
+     */
+    uint16_t suppressed();
+    uint32_t silence();
+
+  private:
+    rn2xx3_metric* _metrics;
+    uint8_t _count;
+    uint32_t _heartbeat;
+    uint32_t (*_clock)();
+
+    bool _reported;
+    bool _acknowledged;
+    uint32_t _lastReport;
+    uint16_t _suppressed;
+};
+
+#endif
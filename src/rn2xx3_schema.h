@@ -0,0 +1,288 @@
+/*
+ * Compile time described, bit packed payloads.
+ *
+ * A payload is a list of fields. Each field has a range and a resolution,
+ * and takes just enough bits to hold every value in that range. The field
+ * offsets, sizes and the payload size are all worked out by the compiler,
+ * so encoding is a fixed sequence of shifts, without a schema to interpret
+ * at run time:
+ *
+ *   typedef rn2xx3_schema<
+ *     rn2xx3_field<-90, 90, 50000>,   // Latitude in steps of 1/50000 degree
+ *     rn2xx3_field<-180, 180, 50000>, // Longitude
+ *     rn2xx3_field<-500, 9000>,       // Altitude in meters
+ *     rn2xx3_field<0, 25, 10>         // HDOP in steps of 0.1
+ *   > MapperPayload;
+ *
+ *   uint8_t payload[MapperPayload::size];   // 9 bytes
+ *   MapperPayload::encode(payload, lat, lon, alt, hdop);
+ *   float lat = MapperPayload::get<0>(payload);
+ *
+ * Values outside the range of a field are clamped to it. Fields are packed
+ * most significant bit first, starting with the first byte.
+ *
+ * double is a 32 bit float on AVR, with 24 bits of precision. encode()
+ * scales the whole and the fractional part of a value apart, so it does
+ * not lose steps, but the float itself only holds a longitude to about
+ * 1/65000 degree. Where the source has more, like a GPS module reporting
+ * whole degrees and billionths, give the values in steps of 1 / Scale to
+ * encodeSteps(), which is exact:
+ *
+ *   MapperPayload::encodeSteps(payload, latSteps, lonSteps, alt, hdop);
+ *
+ * printDecoder() prints a matching decodeUplink() function for the payload
+ * formatters of The Things Stack, so the network side never goes out of
+ * sync with the device.
+ */
+
+#ifndef rn2xx3_schema_h
+#define rn2xx3_schema_h
+
+#include "Arduino.h"
+
+namespace rn2xx3_schema_detail
+{
+  // Bits needed to hold the values 0 to range
+  constexpr uint8_t bitsFor(uint32_t range)
+  {
+    return range == 0 ? 0 : 1 + bitsFor(range >> 1);
+  }
+
+  inline void putBits(uint8_t* out, uint16_t offset, uint8_t width, uint32_t value)
+  {
+    for (uint8_t i = width; i-- > 0; offset++)
+    {
+      uint8_t mask = 0x80 >> (offset % 8);
+      if ((value >> i) & 1)
+      {
+        out[offset / 8] |= mask;
+      }
+      else
+      {
+        out[offset / 8] &= ~mask;
+      }
+    }
+  }
+
+  inline uint32_t getBits(const uint8_t* in, uint16_t offset, uint8_t width)
+  {
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < width; i++, offset++)
+    {
+      value = value << 1 | ((in[offset / 8] >> (7 - offset % 8)) & 1);
+    }
+    return value;
+  }
+
+  // The type and bit offset of field I
+  template <uint8_t I, uint16_t Offset, typename... Fields> struct at;
+
+  template <uint16_t Offset, typename Field, typename... Rest>
+  struct at<0, Offset, Field, Rest...>
+  {
+    typedef Field type;
+    static constexpr uint16_t offset = Offset;
+  };
+
+  template <uint8_t I, uint16_t Offset, typename Field, typename... Rest>
+  struct at<I, Offset, Field, Rest...> : at<I - 1, Offset + Field::bits, Rest...>
+  {
+  };
+
+  // Packing all fields at once
+  template <uint16_t Offset, typename... Fields> struct packer;
+
+  template <uint16_t Offset>
+  struct packer<Offset>
+  {
+    static void pack(uint8_t*) {}
+    static void packSteps(uint8_t*) {}
+    static void printDecoder(Print&, const char* const*, uint8_t) {}
+    static constexpr uint16_t bits = 0;
+  };
+
+  template <uint16_t Offset, typename Field, typename... Rest>
+  struct packer<Offset, Field, Rest...>
+  {
+    template <typename... Values>
+    static void pack(uint8_t* out, double value, Values... rest)
+    {
+      putBits(out, Offset, Field::bits, Field::encode(value));
+      packer<Offset + Field::bits, Rest...>::pack(out, rest...);
+    }
+
+    template <typename... Values>
+    static void packSteps(uint8_t* out, int32_t steps, Values... rest)
+    {
+      putBits(out, Offset, Field::bits, Field::encodeSteps(steps));
+      packer<Offset + Field::bits, Rest...>::packSteps(out, rest...);
+    }
+
+    static void printDecoder(Print& out, const char* const* names, uint8_t index)
+    {
+      out.print(F("    "));
+      out.print(names[index]);
+      out.print(F(": bits("));
+      out.print(Offset);
+      out.print(F(", "));
+      out.print(Field::bits);
+      out.print(F(") / "));
+      out.print(Field::scale);
+      out.print(F(" + ("));
+      out.print(Field::min);
+      out.println(sizeof...(Rest) > 0 ? F("),") : F(")"));
+      packer<Offset + Field::bits, Rest...>::printDecoder(out, names, index + 1);
+    }
+
+    static constexpr uint16_t bits = Field::bits + packer<Offset + Field::bits, Rest...>::bits;
+  };
+}
+
+/*
+ * A field holding values from Min to Max in steps of 1 / Scale.
+ */
+template <int32_t Min, int32_t Max, uint32_t Scale = 1>
+struct rn2xx3_field
+{
+  static_assert(Max > Min, "The range of a field must not be empty");
+  static_assert((uint64_t)(Max - Min) * Scale <= 0xFFFFFFFFULL, "A field can be 32 bits at most");
+
+  static constexpr int32_t min = Min;
+  static constexpr int32_t max = Max;
+  static constexpr uint32_t scale = Scale;
+  static constexpr uint32_t range = (uint32_t)(Max - Min) * Scale;
+  static constexpr uint8_t bits = rn2xx3_schema_detail::bitsFor(range);
+
+  static uint32_t encode(double value)
+  {
+    if (!(value > Min))
+    {
+      return 0;
+    }
+    if (value >= Max)
+    {
+      return range;
+    }
+    // Only the fraction is scaled in floating point, where it needs no
+    // more bits than Scale. The whole degrees, or whatever the unit is,
+    // are scaled exactly.
+    int32_t whole = (int32_t)value;
+    int32_t fraction = (int32_t)floor((value - whole) * Scale + 0.5);
+    return encodeSteps((int64_t)whole * Scale + fraction);
+  }
+
+  static double decode(uint32_t raw)
+  {
+    return (double)((int32_t)(raw / Scale) + Min) + (double)(raw % Scale) / Scale;
+  }
+
+  /*
+   * Encode and decode a value in steps of 1 / Scale, with integers only.
+   */
+  static uint32_t encodeSteps(int64_t steps)
+  {
+    int64_t offset = steps - (int64_t)Min * Scale;
+    if (offset <= 0)
+    {
+      return 0;
+    }
+    return offset >= range ? range : (uint32_t)offset;
+  }
+
+  static int32_t decodeSteps(uint32_t raw)
+  {
+    static_assert((int64_t)Min * Scale >= -0x7FFFFFFFLL - 1 && (int64_t)Max * Scale <= 0x7FFFFFFFLL,
+                  "The steps of this field do not fit an int32_t");
+    return (int32_t)((int64_t)raw + (int64_t)Min * Scale);
+  }
+};
+
+template <typename... Fields>
+class rn2xx3_schema
+{
+  public:
+    static constexpr uint8_t fields = sizeof...(Fields);
+    static constexpr uint16_t bits = rn2xx3_schema_detail::packer<0, Fields...>::bits;
+
+    // Bytes of an encoded payload
+    static constexpr uint8_t size = (bits + 7) / 8;
+
+    /*
+     * Encode one value for every field, in order, into out.
+     */
+    template <typename... Values>
+    static void encode(uint8_t* out, Values... values)
+    {
+      static_assert(sizeof...(Values) == sizeof...(Fields), "Give one value for every field");
+      // Clear the padding bits of the last byte
+      out[size - 1] = 0;
+      rn2xx3_schema_detail::packer<0, Fields...>::pack(out, values...);
+    }
+
+    /*
+     * Encode one value for every field in steps of 1 / Scale of that
+     * field, so with integer arithmetic only.
+     */
+    template <typename... Values>
+    static void encodeSteps(uint8_t* out, Values... values)
+    {
+      static_assert(sizeof...(Values) == sizeof...(Fields), "Give one value for every field");
+      out[size - 1] = 0;
+      rn2xx3_schema_detail::packer<0, Fields...>::packSteps(out, values...);
+    }
+
+    /*
+     * Set or read field I of an encoded payload.
+     */
+    template <uint8_t I>
+    static void set(uint8_t* out, double value)
+    {
+      typedef rn2xx3_schema_detail::at<I, 0, Fields...> field;
+      rn2xx3_schema_detail::putBits(out, field::offset, field::type::bits, field::type::encode(value));
+    }
+
+    template <uint8_t I>
+    static double get(const uint8_t* in)
+    {
+      typedef rn2xx3_schema_detail::at<I, 0, Fields...> field;
+      return field::type::decode(rn2xx3_schema_detail::getBits(in, field::offset, field::type::bits));
+    }
+
+    template <uint8_t I>
+    static void setSteps(uint8_t* out, int32_t steps)
+    {
+      typedef rn2xx3_schema_detail::at<I, 0, Fields...> field;
+      rn2xx3_schema_detail::putBits(out, field::offset, field::type::bits, field::type::encodeSteps(steps));
+    }
+
+    template <uint8_t I>
+    static int32_t getSteps(const uint8_t* in)
+    {
+      typedef rn2xx3_schema_detail::at<I, 0, Fields...> field;
+      return field::type::decodeSteps(rn2xx3_schema_detail::getBits(in, field::offset, field::type::bits));
+    }
+
+    /*
+     * Print a JavaScript decodeUplink() function for this payload, with
+     * names[i] as the name of field i.
+     */
+    static void printDecoder(Print& out, const char* const names[])
+    {
+      out.println(F("function decodeUplink(input) {"));
+      out.println(F("  var b = input.bytes;"));
+      out.println(F("  function bits(offset, width) {"));
+      out.println(F("    var v = 0;"));
+      out.println(F("    for (var i = offset; i < offset + width; i++) v = v * 2 + ((b[i >> 3] >> (7 - (i & 7))) & 1);"));
+      out.println(F("    return v;"));
+      out.println(F("  }"));
+      out.print(F("  if (b.length < "));
+      out.print(size);
+      out.println(F(") return { errors: ['payload too short'] };"));
+      out.println(F("  return { data: {"));
+      rn2xx3_schema_detail::packer<0, Fields...>::printDecoder(out, names, 0);
+      out.println(F("  } };"));
+      out.println(F("}"));
+    }
+};
+
+#endif
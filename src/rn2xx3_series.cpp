@@ -0,0 +1,259 @@
+/*
+ * Batch time series samples into as few uplinks as possible.
+ */
+
+#include "rn2xx3_series.h"
+
+// A varint of 32 bits takes 5 bytes at most
+#define VARINT_MAX 5
+
+static uint32_t zigzag(int32_t value)
+{
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value)
+{
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static uint8_t putVarint(uint8_t* out, uint32_t value)
+{
+  uint8_t length = 0;
+  while (value >= 0x80)
+  {
+    out[length++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  out[length++] = value;
+  return length;
+}
+
+static bool getVarint(const uint8_t*& in, const uint8_t* end, uint32_t& value)
+{
+  value = 0;
+  for (uint8_t shift = 0; shift < 7 * VARINT_MAX && in < end; shift += 7)
+  {
+    uint8_t b = *in++;
+    value |= (uint32_t)(b & 0x7F) << shift;
+    if (!(b & 0x80))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+rn2xx3_series::rn2xx3_series(rn2xx3& lora, uint8_t port, uint8_t channels, uint8_t* buffer, uint8_t capacity):
+_lora(lora),
+_port(port),
+_channels(channels > 0 && channels <= RN2XX3_SERIES_MAX_CHANNELS ? channels : 1),
+_buffer(buffer),
+_capacity(capacity),
+_frameSize(0),
+_size(0),
+_samples(0),
+_last()
+{
+}
+
+void rn2xx3_series::setFrameSize(uint8_t size)
+{
+  _frameSize = size;
+}
+
+uint8_t rn2xx3_series::samples()
+{
+  return _samples;
+}
+
+uint8_t rn2xx3_series::size()
+{
+  return _size;
+}
+
+uint8_t rn2xx3_series::frameSize()
+{
+  uint8_t size = _frameSize;
+  if (size == 0)
+  {
+    size = _lora.maxPayload();
+    if (size > 2 * RN2XX3_FOPTS_RESERVE)
+    {
+      size -= RN2XX3_FOPTS_RESERVE;
+    }
+    else if (size == 0)
+    {
+      // The data rate is not known, the module will tell if it is too much
+      size = _capacity;
+    }
+  }
+  return size < _capacity ? size : _capacity;
+}
+
+void rn2xx3_series::clear()
+{
+  _size = 0;
+  _samples = 0;
+}
+
+bool rn2xx3_series::add(uint32_t time, const int32_t* values)
+{
+  return append(time, values, frameSize());
+}
+
+bool rn2xx3_series::append(uint32_t time, const int32_t* values, uint8_t limit)
+{
+  uint8_t sample[VARINT_MAX * (1 + RN2XX3_SERIES_MAX_CHANNELS)];
+  uint8_t length = 0;
+  rn2xx3_series_state state;
+
+  if (_samples == 0)
+  {
+    state.interval = 0;
+    length += putVarint(sample, time);
+    for (uint8_t i = 0; i < _channels; i++)
+    {
+      length += putVarint(&sample[length], zigzag(values[i]));
+    }
+  }
+  else
+  {
+    // Differences wrap around like the values do, so they always decode
+    state.interval = time - _last.time;
+    length += putVarint(sample, zigzag((int32_t)(state.interval - _last.interval)));
+    for (uint8_t i = 0; i < _channels; i++)
+    {
+      length += putVarint(&sample[length], zigzag((int32_t)((uint32_t)values[i] - (uint32_t)_last.values[i])));
+    }
+  }
+
+  if (_size + length > limit)
+  {
+    return false;
+  }
+
+  state.time = time;
+  memcpy(state.values, values, _channels * sizeof(int32_t));
+  memcpy(&_buffer[_size], sample, length);
+  _size += length;
+  _samples++;
+  _last = state;
+  return true;
+}
+
+TX_RETURN_TYPE rn2xx3_series::send(bool confirmed)
+{
+  if (_samples == 0)
+  {
+    return TX_SUCCESS;
+  }
+
+  // Send the samples that fit, if the frame is too large by now
+  uint8_t limit = frameSize();
+  uint8_t length = _size;
+  uint8_t count = _samples;
+  rn2xx3_series_state boundary = _last;
+  if (_size > limit)
+  {
+    const uint8_t* in = _buffer;
+    rn2xx3_series_state state;
+    length = 0;
+    count = 0;
+    while (count < _samples && next(in, _buffer + _size, _channels, count == 0, state) &&
+           in - _buffer <= limit)
+    {
+      length = in - _buffer;
+      boundary = state;
+      count++;
+    }
+    if (count == 0)
+    {
+      return TX_FAIL;
+    }
+  }
+
+  TX_RETURN_TYPE result = _lora.txBytes(_buffer, length, _port, confirmed);
+  if (result != TX_SUCCESS && result != TX_WITH_RX)
+  {
+    return result;
+  }
+
+  uint8_t remaining = _samples - count;
+  if (remaining == 0)
+  {
+    clear();
+    return result;
+  }
+
+  // Start a new frame with the samples left, the first one in full
+  uint8_t rest = _size - length;
+  uint8_t tail[rest];
+  memcpy(tail, &_buffer[length], rest);
+  clear();
+
+  const uint8_t* in = tail;
+  for (uint8_t i = 0; i < remaining && next(in, tail + rest, _channels, false, boundary); i++)
+  {
+    // The first sample in full can be a few bytes larger than its
+    // difference was. Only what no longer fits the buffer is lost.
+    if (!append(boundary.time, boundary.values, _capacity))
+    {
+      break;
+    }
+  }
+  return result;
+}
+
+bool rn2xx3_series::next(const uint8_t*& in, const uint8_t* end, uint8_t channels,
+                         bool first, rn2xx3_series_state& state)
+{
+  uint32_t value;
+  if (!getVarint(in, end, value))
+  {
+    return false;
+  }
+  if (first)
+  {
+    state.time = value;
+    state.interval = 0;
+  }
+  else
+  {
+    state.interval += unzigzag(value);
+    state.time += state.interval;
+  }
+
+  for (uint8_t i = 0; i < channels; i++)
+  {
+    if (!getVarint(in, end, value))
+    {
+      return false;
+    }
+    state.values[i] = first ? unzigzag(value) : (int32_t)((uint32_t)state.values[i] + (uint32_t)unzigzag(value));
+  }
+  return true;
+}
+
+int rn2xx3_series::decode(const uint8_t* frame, uint8_t length, uint8_t channels,
+                          void (*sink)(uint32_t time, const int32_t* values))
+{
+  if (channels == 0 || channels > RN2XX3_SERIES_MAX_CHANNELS)
+  {
+    return -1;
+  }
+
+  rn2xx3_series_state state;
+  const uint8_t* in = frame;
+  int count = 0;
+  while (in < frame + length)
+  {
+    if (!next(in, frame + length, channels, count == 0, state))
+    {
+      return -1;
+    }
+    sink(state.time, state.values);
+    count++;
+  }
+  return count;
+}
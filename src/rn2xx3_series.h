@@ -0,0 +1,123 @@
+/*
+ * Batch time series samples into as few uplinks as possible.
+ *
+ * rn2xx3_series collects samples of one or more channels, like a
+ * temperature and a humidity, and packs them into a single frame until it
+ * reaches the largest payload the current data rate allows:
+ *
+ *   uint8_t frame[64];
+ *   rn2xx3_series series(myLora, 20, 2, frame, sizeof(frame));
+ *
+ *   int32_t values[2] = {temperature, humidity};
+ *   if (!series.add(millis() / 1000, values))
+ *   {
+ *     series.send();
+ *     series.add(millis() / 1000, values);
+ *   }
+ *
+ * A frame starts with the time of its first sample and the values of all
+ * channels. Every following sample only holds how much its interval
+ * differs from the previous one, and how much each value changed. All
+ * numbers are zig-zag encoded varints, so small changes either way take a
+ * single byte, and a steady sampling interval costs one byte per sample.
+ * Frames can be decoded with decode() or the same scheme on the network side.
+ */
+
+#ifndef rn2xx3_series_h
+#define rn2xx3_series_h
+
+#include "Arduino.h"
+#include "rn2xx3.h"
+
+#define RN2XX3_SERIES_MAX_CHANNELS 8
+
+/*
+ * The time, interval and values of the last sample of a frame.
+ */
+struct rn2xx3_series_state {
+  uint32_t time;
+  uint32_t interval;
+  int32_t values[RN2XX3_SERIES_MAX_CHANNELS];
+};
+
+class rn2xx3_series
+{
+  public:
+    /*
+     * lora: the module to send with
+     * port: the LoRaWAN port for the frames
+     * channels: values per sample, 1 to RN2XX3_SERIES_MAX_CHANNELS
+     * buffer: holds the frame being built, capacity bytes. A frame is never
+     *         larger than the buffer.
+     */
+    rn2xx3_series(rn2xx3& lora, uint8_t port, uint8_t channels, uint8_t* buffer, uint8_t capacity);
+
+    /*
+     * Limit frames to size bytes. 0, the default, fills them up to the
+     * largest payload of the current data rate, less RN2XX3_FOPTS_RESERVE.
+     */
+    void setFrameSize(uint8_t size);
+
+    /*
+     * Add a sample, with one value per channel. time can be in any unit,
+     * but should not go backwards.
+     * Returns false if the sample does not fit in the frame any more, then
+     * send() the frame first. Also false if a single sample does not fit.
+     */
+    bool add(uint32_t time, const int32_t* values);
+
+    /*
+     * Send the samples collected so far in one uplink. If the data rate
+     * went down since they were added, only the samples that fit are sent
+     * and the others are kept for the next frame.
+     * On TX_FAIL or TX_DEFERRED all samples are kept, so send() can try
+     * again. Returns TX_SUCCESS without sending if there are no samples.
+     */
+    TX_RETURN_TYPE send(bool confirmed = false);
+
+    /*
+     * Forget the samples collected so far.
+     */
+    void clear();
+
+    /*
+     * Samples and bytes in the frame, and the largest frame that can be
+     * sent now.
+     */
+    uint8_t samples();
+    uint8_t size();
+    uint8_t frameSize();
+
+    /*
+     * Decode a frame, calling sink for every sample in it.
+     * Returns the number of samples, or -1 if the frame is malformed.
+     */
+    static int decode(const uint8_t* frame, uint8_t length, uint8_t channels,
+                      void (*sink)(uint32_t time, const int32_t* values));
+
+  private:
+    rn2xx3& _lora;
+    uint8_t _port;
+    uint8_t _channels;
+    uint8_t* _buffer;
+    uint8_t _capacity;
+    uint8_t _frameSize;
+
+    uint8_t _size;
+    uint8_t _samples;
+    rn2xx3_series_state _last;
+
+    /*
+     * Add a sample if the frame stays within limit bytes.
+     */
+    bool append(uint32_t time, const int32_t* values, uint8_t limit);
+
+    /*
+     * Read the sample at in into state, first if it starts a frame.
+     * Returns false if it runs past end.
+     */
+    static bool next(const uint8_t*& in, const uint8_t* end, uint8_t channels,
+                     bool first, rn2xx3_series_state& state);
+};
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ * Persistent storage interface for the rn2xx3 library.
+ *
+ * The library uses this to keep state, like the LoRaWAN frame counters,
+ * across resets of the host. Implement it on top of whatever non-volatile
+ * memory the board has. For example on an AVR board using EEPROM.h:
+ *
+ *   class EepromStorage : public rn2xx3_storage
+ *   {
+ *     public:
+ *       bool read(uint16_t address, uint8_t* data, uint16_t length)
+ *       {
+ *         for (uint16_t i = 0; i < length; i++) data[i] = EEPROM.read(address + i);
+ *         return true;
+ *       }
+ *       bool write(uint16_t address, const uint8_t* data, uint16_t length)
+ *       {
+ *         for (uint16_t i = 0; i < length; i++) EEPROM.update(address + i, data[i]);
+ *         return true;
+ *       }
+ *   };
+ *
+ */
+
+#ifndef rn2xx3_storage_h
+#define rn2xx3_storage_h
+
+#include "Arduino.h"
+
+class rn2xx3_storage
+{
+  public:
+    /*
+     * Read length bytes starting at address into data.
+     * Returns false if the storage could not be read.
+     */
+    virtual bool read(uint16_t address, uint8_t* data, uint16_t length) = 0;
+
+    /*
+     * Write length bytes from data starting at address.
+     * Returns false if the storage could not be written.
+     */
+    virtual bool write(uint16_t address, const uint8_t* data, uint16_t length) = 0;
+};
+
+/*
+ * The checksum of the records the library stores. Pass the sum of the
+ * previous part to checksum a record in parts.
+ */
+static inline uint8_t rn2xx3_checksum(const uint8_t* data, uint8_t length, uint8_t sum = 0)
+{
+  for (uint8_t i = 0; i < length; i++)
+  {
+    sum = (sum << 1 | sum >> 7) ^ data[i];
+  }
+  return sum;
+}
+
+#endif
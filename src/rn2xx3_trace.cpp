@@ -0,0 +1,332 @@
+/*
+ * Record and replay the serial conversation with an RN2xx3 module.
+ */
+
+#include "rn2xx3_trace.h"
+
+static const char traceMagic[] = "RN2T";
+#define TRACE_VERSION 1
+
+rn2xx3_trace::rn2xx3_trace(Stream& module, Print& sink):
+_module(module),
+_sink(sink),
+_started(false),
+_open(0),
+_last(0),
+_sent(0),
+_received(0)
+{
+}
+
+void rn2xx3_trace::record(uint8_t type, uint8_t c)
+{
+  if (!_started)
+  {
+    _sink.write((const uint8_t*)traceMagic, 4);
+    _sink.write((uint8_t)TRACE_VERSION);
+    _last = millis();
+    _started = true;
+  }
+
+  if (c == '\r')
+  {
+    return;
+  }
+
+  if (c == '\n')
+  {
+    if (_open == type)
+    {
+      _sink.write('\n');
+      _open = 0;
+    }
+    return;
+  }
+
+  if (_open != type)
+  {
+    // A line in the other direction started, close the open one
+    if (_open != 0)
+    {
+      _sink.write('\n');
+    }
+
+    unsigned long now = millis();
+    unsigned long delta = now - _last;
+    _last = now;
+
+    _sink.write(type);
+    do
+    {
+      uint8_t b = delta & 0x7F;
+      delta >>= 7;
+      _sink.write((uint8_t)(delta ? (b | 0x80) : b));
+    } while (delta);
+
+    _open = type;
+    if (type == RN2XX3_TRACE_SENT)
+    {
+      _sent++;
+    }
+    else
+    {
+      _received++;
+    }
+  }
+
+  _sink.write(c);
+}
+
+int rn2xx3_trace::available()
+{
+  return _module.available();
+}
+
+int rn2xx3_trace::read()
+{
+  int c = _module.read();
+  if (c >= 0)
+  {
+    record(RN2XX3_TRACE_RECEIVED, c);
+  }
+  return c;
+}
+
+int rn2xx3_trace::peek()
+{
+  return _module.peek();
+}
+
+size_t rn2xx3_trace::write(uint8_t c)
+{
+  record(RN2XX3_TRACE_SENT, c);
+  return _module.write(c);
+}
+
+void rn2xx3_trace::flush()
+{
+  _module.flush();
+  _sink.flush();
+}
+
+unsigned long rn2xx3_trace::linesSent()
+{
+  return _sent;
+}
+
+unsigned long rn2xx3_trace::linesReceived()
+{
+  return _received;
+}
+
+
+rn2xx3_replay::rn2xx3_replay(Stream& trace):
+_trace(trace),
+_scale(1),
+_next(0),
+_delay(0),
+_base(0),
+_serving(false),
+_lineEnd(false),
+_writing(false),
+_mismatch(false),
+_commands(0),
+_mismatches(0)
+{
+  // Skip the magic and the version, then read the first record header
+  for (uint8_t i = 0; i < 5; i++)
+  {
+    traceRead();
+  }
+  _base = millis();
+  nextRecord();
+}
+
+void rn2xx3_replay::setTimeScale(float scale)
+{
+  _scale = scale;
+}
+
+int rn2xx3_replay::traceRead()
+{
+  // The trace is a file, so a short wait is enough
+  unsigned long start = millis();
+  do
+  {
+    int c = _trace.read();
+    if (c >= 0)
+    {
+      return c;
+    }
+  } while (millis() - start < 100);
+  return -1;
+}
+
+void rn2xx3_replay::nextRecord()
+{
+  int type = traceRead();
+  if (type != RN2XX3_TRACE_SENT && type != RN2XX3_TRACE_RECEIVED)
+  {
+    _next = 0;
+    return;
+  }
+  _next = type;
+
+  _delay = 0;
+  for (uint8_t shift = 0; shift < 32; shift += 7)
+  {
+    int b = traceRead();
+    if (b < 0)
+    {
+      _next = 0;
+      return;
+    }
+    _delay |= (unsigned long)(b & 0x7F) << shift;
+    if (!(b & 0x80))
+    {
+      break;
+    }
+  }
+}
+
+bool rn2xx3_replay::ready()
+{
+  if (_serving)
+  {
+    return true;
+  }
+  if (_next != RN2XX3_TRACE_RECEIVED)
+  {
+    // Nothing to hand out until the library sent its next command
+    return false;
+  }
+  if (millis() - _base < (unsigned long)(_delay * _scale))
+  {
+    return false;
+  }
+  _base = millis();
+  _serving = true;
+  return true;
+}
+
+int rn2xx3_replay::available()
+{
+  return ready() ? 1 : 0;
+}
+
+int rn2xx3_replay::read()
+{
+  int c = peek();
+  if (c < 0)
+  {
+    return c;
+  }
+
+  if (c == '\r')
+  {
+    _lineEnd = true;
+  }
+  else if (c == '\n')
+  {
+    _lineEnd = false;
+    _serving = false;
+    traceRead();
+    nextRecord();
+  }
+  else
+  {
+    traceRead();
+  }
+  return c;
+}
+
+int rn2xx3_replay::peek()
+{
+  if (!ready())
+  {
+    return -1;
+  }
+  if (_lineEnd)
+  {
+    return '\n';
+  }
+  int c = _trace.peek();
+  if (c < 0 || c == '\n')
+  {
+    return '\r';
+  }
+  return c;
+}
+
+size_t rn2xx3_replay::write(uint8_t c)
+{
+  if (c == '\r')
+  {
+    return 1;
+  }
+
+  if (!_writing)
+  {
+    _writing = true;
+    _mismatch = (_next != RN2XX3_TRACE_SENT);
+    if (!_mismatch)
+    {
+      // Time the replies from when the command was sent
+      _base = millis();
+    }
+  }
+
+  if (c == '\n')
+  {
+    _writing = false;
+    _commands++;
+    if (_next == RN2XX3_TRACE_SENT)
+    {
+      // Skip what is left of the recorded command
+      int t;
+      do
+      {
+        t = traceRead();
+        if (t >= 0 && t != '\n')
+        {
+          _mismatch = true;
+        }
+      } while (t >= 0 && t != '\n');
+      nextRecord();
+    }
+    if (_mismatch)
+    {
+      _mismatches++;
+    }
+    return 1;
+  }
+
+  if (!_mismatch && _next == RN2XX3_TRACE_SENT)
+  {
+    int t = _trace.peek();
+    if (t == c)
+    {
+      traceRead();
+    }
+    else
+    {
+      _mismatch = true;
+    }
+  }
+  return 1;
+}
+
+bool rn2xx3_replay::finished()
+{
+  return _next == 0 && !_serving;
+}
+
+unsigned long rn2xx3_replay::commands()
+{
+  return _commands;
+}
+
+unsigned long rn2xx3_replay::mismatches()
+{
+  return _mismatches;
+}
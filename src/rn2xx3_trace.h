@@ -0,0 +1,121 @@
+/*
+ * Record and replay the serial conversation with an RN2xx3 module.
+ *
+ * rn2xx3_trace sits between the rn2xx3 library and the Stream of the module
+ * and writes every line sent and received, with a timestamp, to a Print,
+ * for example a file on an SD card:
+ *
+ *   rn2xx3_trace trace(Serial1, traceFile);
+ *   rn2xx3 myLora(trace);
+ *
+ * rn2xx3_replay plays such a trace back as a fake module, so a recorded
+ * field session can be run against a changed library offline:
+ *
+ *   rn2xx3_replay replay(traceFile);
+ *   rn2xx3 myLora(replay);
+ *
+ * Trace format: the magic "RN2T" and a version byte, followed by records.
+ * A record is a type byte (1 = sent to the module, 2 = received from it),
+ * the milliseconds since the previous record as an unsigned LEB128 varint,
+ * the line without line ending, and a terminating '\n'.
+ */
+
+#ifndef rn2xx3_trace_h
+#define rn2xx3_trace_h
+
+#include "Arduino.h"
+
+#define RN2XX3_TRACE_SENT 1
+#define RN2XX3_TRACE_RECEIVED 2
+
+class rn2xx3_trace : public Stream
+{
+  public:
+    /*
+     * module: the Stream connected to the module
+     * sink: where the trace is written to
+     */
+    rn2xx3_trace(Stream& module, Print& sink);
+
+    int available();
+    int read();
+    int peek();
+    size_t write(uint8_t c);
+    void flush();
+
+    using Print::write;
+
+    /*
+     * Number of lines recorded in each direction.
+     */
+    unsigned long linesSent();
+    unsigned long linesReceived();
+
+  private:
+    Stream& _module;
+    Print& _sink;
+
+    bool _started;
+    uint8_t _open;         // Type of the record being written, or 0
+    unsigned long _last;   // Time of the previous record
+    unsigned long _sent;
+    unsigned long _received;
+
+    void record(uint8_t type, uint8_t c);
+};
+
+class rn2xx3_replay : public Stream
+{
+  public:
+    /*
+     * trace: a Stream to read a trace written by rn2xx3_trace from
+     */
+    rn2xx3_replay(Stream& trace);
+
+    /*
+     * Scale the recorded time between lines. 1 replays in real time,
+     * 0.1 ten times faster and 0 as fast as possible.
+     */
+    void setTimeScale(float scale);
+
+    int available();
+    int read();
+    int peek();
+    size_t write(uint8_t c);
+
+    using Print::write;
+
+    /*
+     * True when the whole trace has been replayed.
+     */
+    bool finished();
+
+    /*
+     * Commands received from the library so far, and how many of them
+     * differed from the recorded command.
+     */
+    unsigned long commands();
+    unsigned long mismatches();
+
+  private:
+    Stream& _trace;
+    float _scale;
+
+    uint8_t _next;          // Type of the next record, or 0 at the end
+    unsigned long _delay;   // Recorded time before the next record
+    unsigned long _base;    // When the previous record was replayed
+
+    bool _serving;          // Busy handing out a received line
+    bool _lineEnd;          // '\r' handed out, '\n' is next
+    bool _writing;          // Busy receiving a command
+    bool _mismatch;
+
+    unsigned long _commands;
+    unsigned long _mismatches;
+
+    int traceRead();
+    void nextRecord();
+    bool ready();
+};
+
+#endif